@@ -0,0 +1,256 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* libscopehal v0.1                                                                                                     *
+*                                                                                                                      *
+* Copyright (c) 2012-2021 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of ElementwiseFilter
+ */
+
+#include "scopehal.h"
+#include <omp.h>
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+ElementwiseFilter::ElementwiseFilter(const string& color, Category cat)
+	: Filter(OscilloscopeChannel::CHANNEL_TYPE_ANALOG, color, cat)
+	, m_fusedIntoConsumer(false)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Chain detection
+
+/**
+	@brief Returns the filter connected to input i if we should evaluate it as part of our own refresh, or NULL if we
+	should use its output waveform instead.
+ */
+ElementwiseFilter* ElementwiseFilter::GetFusedInput(size_t i)
+{
+	auto f = dynamic_cast<ElementwiseFilter*>(m_inputs[i].m_channel);
+	if(!f || (m_inputs[i].m_stream != 0) )
+		return NULL;
+
+	//Already up to date, nothing to gain
+	if(!f->m_dirty)
+		return NULL;
+
+	//The only reference to it is this input. Anything else (a view, another filter, or our other input)
+	//needs its output waveform.
+	if(f->GetRefCount() != 1)
+		return NULL;
+
+	return f;
+}
+
+/**
+	@brief Returns true if our consumer is going to evaluate us as part of its own refresh
+ */
+bool ElementwiseFilter::IsFusedIntoConsumer()
+{
+	if(GetRefCount() != 1)
+		return false;
+
+	//Find who's using us
+	for(auto f : m_filters)
+	{
+		auto e = dynamic_cast<ElementwiseFilter*>(f);
+		for(size_t i=0; i<f->GetInputCount(); i++)
+		{
+			if(f->GetInput(i).m_channel != this)
+				continue;
+
+			//Only skip our refresh if the consumer is going to evaluate us, or already has
+			return e && (e->GetFusedInput(i) == this) && (e->m_dirty || m_fusedIntoConsumer);
+		}
+	}
+
+	return false;
+}
+
+void ElementwiseFilter::RefreshIfDirty()
+{
+	//Don't produce an output waveform nobody is going to look at
+	if(m_dirty && IsFusedIntoConsumer())
+		return;
+
+	Filter::RefreshIfDirty();
+}
+
+/**
+	@brief Adds this filter, and any fused inputs, to a chain of stages
+
+	@param stages		Stages in evaluation order
+	@param externals	Waveforms read by the chain
+
+	@return Index of our stage, or -1 if any filter in the chain can't produce output
+ */
+int ElementwiseFilter::BuildStages(vector<Stage>& stages, vector<AnalogWaveform*>& externals)
+{
+	Stage stage;
+	stage.m_filter = this;
+	for(size_t i=0; i<m_inputs.size(); i++)
+	{
+		auto f = GetFusedInput(i);
+		if(f)
+		{
+			f->RefreshInputsIfDirty();
+			f->m_fusedIntoConsumer = true;
+
+			//The fused filter never refreshes on its own, so free its old output rather than leave stale data around
+			f->SetData(NULL, 0);
+
+			int index = f->BuildStages(stages, externals);
+			if(index < 0)
+				return -1;
+			stage.m_sources.push_back(index);
+		}
+
+		else
+		{
+			if(!VerifyInputOK(i))
+				return -1;
+			auto data = GetAnalogInputWaveform(i);
+			if(!data)
+				return -1;
+
+			stage.m_sources.push_back(-1 - (int)externals.size());
+			externals.push_back(data);
+		}
+	}
+
+	//Inputs are ready, so we can check units etc
+	if(!PrepareElementwise())
+		return -1;
+
+	stages.push_back(stage);
+	return stages.size() - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Actual decoder logic
+
+void ElementwiseFilter::Refresh()
+{
+	m_fusedIntoConsumer = false;
+
+	vector<Stage> stages;
+	vector<AnalogWaveform*> externals;
+	if(BuildStages(stages, externals) < 0)
+	{
+		SetData(NULL, 0);
+		return;
+	}
+
+	//Timestamps come from whatever is ultimately connected to our first input
+	int src = stages.back().m_sources[0];
+	while(src >= 0)
+		src = stages[src].m_sources[0];
+	auto din = externals[-1 - src];
+
+	size_t len = din->m_samples.size();
+	for(auto w : externals)
+		len = min(len, w->m_samples.size());
+
+	//Output timestamps are the same as the input's, so reference them rather than copying
+	AnalogWaveform* cap;
+	if(len == din->m_offsets.size())
+	{
+		cap = SetupEmptyOutputWaveform(din, 0, false);
+		cap->ShareTimestamps(din);
+		cap->m_triggerPhase = din->m_triggerPhase;
+		cap->m_samples.resize(len);
+	}
+	else
+	{
+		cap = SetupOutputWaveform(din, 0, 0, 0);
+		cap->Resize(len);
+	}
+	float* out = (float*)&cap->m_samples[0];
+
+	//Divide large waveforms (>1M points) into blocks and multithread them.
+	//Keep block boundaries a multiple of BLOCK_SIZE so every stage sees aligned buffers.
+	size_t numblocks = 1;
+	if(len > 1000000)
+		numblocks = omp_get_max_threads();
+	size_t lastblock = numblocks - 1;
+	size_t blocksize = (len / numblocks) - ((len / numblocks) % BLOCK_SIZE);
+
+	#pragma omp parallel for
+	for(size_t i=0; i<numblocks; i++)
+	{
+		size_t istart = i*blocksize;
+		size_t iend = (i == lastblock) ? len : istart + blocksize;
+		RunStages(stages, externals, out, istart, iend);
+	}
+}
+
+/**
+	@brief Evaluates a chain of stages over a range of samples
+
+	Every stage but the last writes to a small per-stage buffer which stays in L1/L2 cache. The last one writes to
+	the output waveform.
+ */
+void ElementwiseFilter::RunStages(
+	const vector<Stage>& stages,
+	const vector<AnalogWaveform*>& externals,
+	float* out,
+	size_t istart,
+	size_t iend)
+{
+	size_t laststage = stages.size() - 1;
+	vector<float, AlignedAllocator<float, 64> > buffers(laststage * BLOCK_SIZE);
+	vector<const float*> inputs;
+
+	for(size_t base = istart; base < iend; base += BLOCK_SIZE)
+	{
+		size_t n = min(BLOCK_SIZE, iend - base);
+
+		for(size_t i=0; i<stages.size(); i++)
+		{
+			auto& stage = stages[i];
+
+			inputs.clear();
+			for(auto src : stage.m_sources)
+			{
+				if(src >= 0)
+					inputs.push_back(&buffers[src * BLOCK_SIZE]);
+				else
+					inputs.push_back((const float*)&externals[-1 - src]->m_samples[base]);
+			}
+
+			float* dst = (i == laststage) ? (out + base) : &buffers[i * BLOCK_SIZE];
+			stage.m_filter->ProcessElementwise(dst, &inputs[0], n);
+		}
+	}
+}
@@ -0,0 +1,105 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* libscopehal v0.1                                                                                                     *
+*                                                                                                                      *
+* Copyright (c) 2012-2021 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of ElementwiseFilter
+ */
+#ifndef ElementwiseFilter_h
+#define ElementwiseFilter_h
+
+/**
+	@brief A filter whose output sample i depends only on sample i of each of its (analog) inputs
+
+	Chains of these (scale, offset, subtract, etc) are evaluated together in a single pass. When an elementwise input
+	is dirty and nothing but us uses its output, we don't wait for it to produce a full output waveform. Instead we
+	run its math on small cache-resident blocks of samples and feed them straight into our own, so only the chain's
+	external inputs are read from memory and only our output is written. The fused upstream filter is left dirty
+	and will compute its own output as usual if anything else starts using it.
+ */
+class ElementwiseFilter : public Filter
+{
+public:
+	ElementwiseFilter(const std::string& color, Category cat);
+
+	virtual void Refresh();
+	virtual void RefreshIfDirty();
+
+protected:
+	/**
+		@brief Reads parameters and checks input units before any samples are processed
+
+		Called once per refresh, after PrepareElementwise() has been called on all fused inputs.
+
+		@return False if no output can be produced
+	 */
+	virtual bool PrepareElementwise() =0;
+
+	/**
+		@brief Calculates a block of output samples
+
+		May be called from several threads at once, so must not modify any filter state.
+
+		@param out		Output samples
+		@param in		Samples for each input, in the same order as m_inputs
+		@param len		Number of samples
+	 */
+	virtual void ProcessElementwise(float* out, const float* const* in, size_t len) =0;
+
+	ElementwiseFilter* GetFusedInput(size_t i);
+	bool IsFusedIntoConsumer();
+
+	///@brief One filter in a fused chain
+	class Stage
+	{
+	public:
+		ElementwiseFilter* m_filter;
+
+		///@brief Source of each input: index of an earlier stage if >= 0, otherwise external input (-1 - index)
+		std::vector<int> m_sources;
+	};
+
+	int BuildStages(std::vector<Stage>& stages, std::vector<AnalogWaveform*>& externals);
+	void RunStages(
+		const std::vector<Stage>& stages,
+		const std::vector<AnalogWaveform*>& externals,
+		float* out,
+		size_t istart,
+		size_t iend);
+
+	///@brief True if our consumer evaluated us as part of its last refresh, so we have no output of our own
+	bool m_fusedIntoConsumer;
+
+	///@brief Number of samples processed by each stage at a time
+	static const size_t BLOCK_SIZE = 2048;
+};
+
+#endif
@@ -0,0 +1,218 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* libscopehal v0.1                                                                                                     *
+*                                                                                                                      *
+* Copyright (c) 2012-2021 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of FFTPlanCache and FFTPlan
+ */
+
+#include "scopehal.h"
+#include "FFTPlanCache.h"
+
+using namespace std;
+
+mutex FFTPlanCache::m_mutex;
+map<FFTPlanCache::Key, FFTPlanCache::Entry> FFTPlanCache::m_entries;
+uint64_t FFTPlanCache::m_nextID = 1;
+atomic<uint64_t> FFTPlanCache::m_generation(0);
+
+/**
+	@brief Per-thread state for the plan cache
+ */
+class FFTPlanThreadState
+{
+public:
+	FFTPlanThreadState()
+	: m_generation(0)
+	{}
+
+	uint64_t m_generation;
+
+	///@brief Our instance of each plan, and the ID of the cache entry it belongs to
+	map<FFTPlanCache::Key, pair<uint64_t, ffts_plan_t*> > m_plans;
+	vector< vector<float, AlignedAllocator<float, 64> > > m_scratch;
+};
+
+static thread_local FFTPlanThreadState g_fftThreadState;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// FFTPlanCache
+
+void FFTPlanCache::AddRef(size_t npoints, int direction, TransformType type)
+{
+	lock_guard<mutex> lock(m_mutex);
+	auto& entry = m_entries[Key(npoints, direction, type)];
+	if(entry.m_refcount == 0)
+		entry.m_id = m_nextID ++;
+	entry.m_refcount ++;
+}
+
+void FFTPlanCache::Release(size_t npoints, int direction, TransformType type)
+{
+	lock_guard<mutex> lock(m_mutex);
+
+	auto it = m_entries.find(Key(npoints, direction, type));
+	if(it == m_entries.end())
+		return;
+
+	auto& entry = it->second;
+	entry.m_refcount --;
+	if(entry.m_refcount == 0)
+	{
+		//Bump the generation before freeing anything so no thread trusts a stale lookup table
+		m_generation ++;
+
+		for(auto p : entry.m_plans)
+			ffts_free(p);
+		m_entries.erase(it);
+	}
+}
+
+/**
+	@brief Gets the calling thread's instance of a plan, creating it if needed
+
+	The caller must hold a reference to the plan (via an FFTPlan handle).
+ */
+ffts_plan_t* FFTPlanCache::GetPlan(size_t npoints, int direction, TransformType type)
+{
+	auto& state = g_fftThreadState;
+	Key key(npoints, direction, type);
+
+	//Something was freed since we last looked. Drop our instances of any plans which no longer exist,
+	//but keep everything that's still alive.
+	uint64_t gen = m_generation;
+	if(state.m_generation != gen)
+	{
+		lock_guard<mutex> lock(m_mutex);
+		for(auto it = state.m_plans.begin(); it != state.m_plans.end(); )
+		{
+			auto jt = m_entries.find(it->first);
+			if( (jt == m_entries.end()) || (jt->second.m_id != it->second.first) )
+				it = state.m_plans.erase(it);
+			else
+				++it;
+		}
+		state.m_generation = gen;
+	}
+
+	//Fast path: we already have it
+	auto it = state.m_plans.find(key);
+	if(it != state.m_plans.end())
+		return it->second.second;
+
+	//Nope, need to make a new instance for this thread
+	lock_guard<mutex> lock(m_mutex);
+	auto jt = m_entries.find(key);
+	if(jt == m_entries.end())
+	{
+		LogError("FFTPlanCache::GetPlan: no reference held to %zu-point plan\n", npoints);
+		return NULL;
+	}
+
+	ffts_plan_t* plan;
+	if(type == TRANSFORM_REAL)
+		plan = ffts_init_1d_real(npoints, direction);
+	else
+		plan = ffts_init_1d(npoints, direction);
+
+	jt->second.m_plans.push_back(plan);
+	state.m_plans[key] = pair<uint64_t, ffts_plan_t*>(jt->second.m_id, plan);
+	return plan;
+}
+
+/**
+	@brief Gets a per-thread scratch buffer
+
+	Buffers are 64-byte aligned and only grow. Contents are not preserved across calls to other code which may use
+	the same buffer index, so don't hold on to one across a call into another filter.
+
+	@param index	Index of the buffer (for code needing more than one buffer at a time)
+	@param len		Minimum size of the buffer, in floats
+ */
+float* FFTPlanCache::GetScratchBuffer(size_t index, size_t len)
+{
+	auto& scratch = g_fftThreadState.m_scratch;
+	if(scratch.size() <= index)
+		scratch.resize(index + 1);
+	if(scratch[index].size() < len)
+		scratch[index].resize(len);
+	return &scratch[index][0];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// FFTPlan
+
+FFTPlan::FFTPlan()
+	: m_npoints(0)
+	, m_direction(FFTS_FORWARD)
+	, m_type(FFTPlanCache::TRANSFORM_REAL)
+{
+}
+
+FFTPlan::FFTPlan(size_t npoints, int direction, FFTPlanCache::TransformType type)
+	: m_npoints(0)
+	, m_direction(FFTS_FORWARD)
+	, m_type(FFTPlanCache::TRANSFORM_REAL)
+{
+	Reset(npoints, direction, type);
+}
+
+FFTPlan::~FFTPlan()
+{
+	Clear();
+}
+
+/**
+	@brief Switches this handle to a different transform
+ */
+void FFTPlan::Reset(size_t npoints, int direction, FFTPlanCache::TransformType type)
+{
+	if( (npoints == m_npoints) && (direction == m_direction) && (type == m_type) )
+		return;
+
+	if(npoints != 0)
+		FFTPlanCache::AddRef(npoints, direction, type);
+	Clear();
+
+	m_npoints = npoints;
+	m_direction = direction;
+	m_type = type;
+}
+
+/**
+	@brief Drops the reference to the current plan, if any
+ */
+void FFTPlan::Clear()
+{
+	if(m_npoints != 0)
+		FFTPlanCache::Release(m_npoints, m_direction, m_type);
+	m_npoints = 0;
+}
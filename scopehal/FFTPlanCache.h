@@ -0,0 +1,165 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* libscopehal v0.1                                                                                                     *
+*                                                                                                                      *
+* Copyright (c) 2012-2021 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of FFTPlanCache and FFTPlan
+ */
+
+#ifndef FFTPlanCache_h
+#define FFTPlanCache_h
+
+#include <ffts.h>
+#include <mutex>
+#include <atomic>
+#include "AlignedAllocator.h"
+
+/**
+	@brief Process-wide cache of ffts plans
+
+	Creating a plan for a large transform is expensive, so rather than every filter owning private plans, all filters
+	doing the same transform (size, direction, real or complex) share them.
+
+	An ffts plan contains internal scratch space, so a single plan can't be executed by two threads at once. The cache
+	therefore hands out a separate instance of each plan to every thread that asks for one (created on first use, and
+	shared by everything running on that thread). Lookups on a thread that already has the plan don't take any locks.
+
+	Plans are reference counted by FFTPlan handles, and all instances of a plan are freed once no handle refers to it.
+ */
+class FFTPlanCache
+{
+public:
+	enum TransformType
+	{
+		TRANSFORM_REAL,
+		TRANSFORM_COMPLEX
+	};
+
+	/**
+		@brief Identifies a transform
+	 */
+	class Key
+	{
+	public:
+		Key(size_t npoints, int direction, TransformType type)
+		: m_npoints(npoints)
+		, m_direction(direction)
+		, m_type(type)
+		{}
+
+		size_t m_npoints;
+		int m_direction;
+		TransformType m_type;
+
+		bool operator<(const Key& rhs) const
+		{
+			if(m_npoints != rhs.m_npoints)
+				return m_npoints < rhs.m_npoints;
+			if(m_direction != rhs.m_direction)
+				return m_direction < rhs.m_direction;
+			return m_type < rhs.m_type;
+		}
+	};
+
+	static float* GetScratchBuffer(size_t index, size_t len);
+
+protected:
+	friend class FFTPlan;
+
+	static void AddRef(size_t npoints, int direction, TransformType type);
+	static void Release(size_t npoints, int direction, TransformType type);
+	static ffts_plan_t* GetPlan(size_t npoints, int direction, TransformType type);
+
+	/**
+		@brief All instances of a single transform
+	 */
+	class Entry
+	{
+	public:
+		Entry()
+		: m_refcount(0)
+		, m_id(0)
+		{}
+
+		size_t m_refcount;
+
+		///@brief Unique ID of this entry, so threads can tell a freed and recreated entry from the original
+		uint64_t m_id;
+
+		std::vector<ffts_plan_t*> m_plans;
+	};
+
+	static std::mutex m_mutex;
+	static std::map<Key, Entry> m_entries;
+
+	///@brief ID for the next entry to be created
+	static uint64_t m_nextID;
+
+	///Incremented every time plans are freed, so threads know to check their local lookup tables for stale plans
+	static std::atomic<uint64_t> m_generation;
+};
+
+/**
+	@brief Reference counted handle to a cached FFT plan
+ */
+class FFTPlan
+{
+public:
+	FFTPlan();
+	FFTPlan(size_t npoints, int direction, FFTPlanCache::TransformType type = FFTPlanCache::TRANSFORM_REAL);
+	~FFTPlan();
+
+	//not copyable or assignable
+	FFTPlan(const FFTPlan&) =delete;
+	FFTPlan& operator=(const FFTPlan&) =delete;
+
+	void Reset(size_t npoints, int direction, FFTPlanCache::TransformType type = FFTPlanCache::TRANSFORM_REAL);
+	void Clear();
+
+	/**
+		@brief Gets the calling thread's instance of the plan
+	 */
+	ffts_plan_t* Get() const
+	{ return FFTPlanCache::GetPlan(m_npoints, m_direction, m_type); }
+
+	size_t GetSize() const
+	{ return m_npoints; }
+
+	bool empty() const
+	{ return m_npoints == 0; }
+
+protected:
+	size_t m_npoints;
+	int m_direction;
+	FFTPlanCache::TransformType m_type;
+};
+
+#endif
@@ -35,6 +35,8 @@
 
 #include "scopehal.h"
 #include "Filter.h"
+#include <immintrin.h>
+#include <omp.h>
 
 using namespace std;
 
@@ -42,7 +44,10 @@ Filter::CreateMapType Filter::m_createprocs;
 set<Filter*> Filter::m_filters;
 
 mutex Filter::m_cacheMutex;
-map<pair<WaveformBase*, float>, vector<int64_t> > Filter::m_zeroCrossingCache;
+map<pair<uint64_t, float>, pair<uint64_t, Filter::EdgeListPtr> > Filter::m_zeroCrossingCache;
+map<pair<uint64_t, int>, pair<uint64_t, Filter::EdgeListPtr> > Filter::m_clockEdgeCache;
+map<pair<uint64_t, float>, pair<uint64_t, Filter::LevelCrossingsPtr> > Filter::m_levelCrossingCache;
+map<uint64_t, pair<uint64_t, pair<float, float> > > Filter::m_baseTopCache;
 
 Gdk::Color Filter::m_standardColors[STANDARD_COLOR_COUNT] =
 {
@@ -308,37 +313,7 @@ bool Filter::VerifyAllInputsOKAndDigital()
  */
 void Filter::SampleOnRisingEdges(DigitalWaveform* data, DigitalWaveform* clock, DigitalWaveform& samples)
 {
-	samples.clear();
-
-	size_t ndata = 0;
-	size_t len = clock->m_offsets.size();
-	size_t dlen = data->m_samples.size();
-	for(size_t i=1; i<len; i++)
-	{
-		//Throw away clock samples until we find a rising edge
-		if(!(clock->m_samples[i] && !clock->m_samples[i-1]))
-			continue;
-
-		//Throw away data samples until the data is synced with us
-		int64_t clkstart = clock->m_offsets[i] * clock->m_timescale + clock->m_triggerPhase;
-		while( (ndata+1 < dlen) && ((data->m_offsets[ndata+1] * data->m_timescale + data->m_triggerPhase) < clkstart) )
-			ndata ++;
-		if(ndata >= dlen)
-			break;
-
-		//Extend the previous sample's duration (if any) to our start
-		size_t ssize = samples.m_samples.size();
-		if(ssize)
-		{
-			size_t last = ssize - 1;
-			samples.m_durations[last] = clkstart - samples.m_offsets[last];
-		}
-
-		//Add the new sample
-		samples.m_offsets.push_back(clkstart);
-		samples.m_durations.push_back(1);
-		samples.m_samples.push_back(data->m_samples[ndata]);
-	}
+	SampleOnEdges(data, clock, CLOCK_EDGE_RISING, samples);
 }
 
 /**
@@ -354,37 +329,7 @@ void Filter::SampleOnRisingEdges(DigitalWaveform* data, DigitalWaveform* clock,
  */
 void Filter::SampleOnRisingEdges(DigitalBusWaveform* data, DigitalWaveform* clock, DigitalBusWaveform& samples)
 {
-	samples.clear();
-
-	size_t ndata = 0;
-	size_t len = clock->m_offsets.size();
-	size_t dlen = data->m_samples.size();
-	for(size_t i=1; i<len; i++)
-	{
-		//Throw away clock samples until we find a rising edge
-		if(!(clock->m_samples[i] && !clock->m_samples[i-1]))
-			continue;
-
-		//Throw away data samples until the data is synced with us
-		int64_t clkstart = clock->m_offsets[i] * clock->m_timescale + clock->m_triggerPhase;
-		while( (ndata+1 < dlen) && ((data->m_offsets[ndata+1] * data->m_timescale + data->m_triggerPhase) < clkstart) )
-			ndata ++;
-		if(ndata >= dlen)
-			break;
-
-		//Extend the previous sample's duration (if any) to our start
-		size_t ssize = samples.m_samples.size();
-		if(ssize)
-		{
-			size_t last = ssize - 1;
-			samples.m_durations[last] = clkstart - samples.m_offsets[last];
-		}
-
-		//Add the new sample
-		samples.m_offsets.push_back(clkstart);
-		samples.m_durations.push_back(1);
-		samples.m_samples.push_back(data->m_samples[ndata]);
-	}
+	SampleOnEdges(data, clock, CLOCK_EDGE_RISING, samples);
 }
 
 /**
@@ -400,37 +345,23 @@ void Filter::SampleOnRisingEdges(DigitalBusWaveform* data, DigitalWaveform* cloc
  */
 void Filter::SampleOnFallingEdges(DigitalWaveform* data, DigitalWaveform* clock, DigitalWaveform& samples)
 {
-	samples.clear();
+	SampleOnEdges(data, clock, CLOCK_EDGE_FALLING, samples);
+}
 
-	size_t ndata = 0;
-	size_t len = clock->m_offsets.size();
-	size_t dlen = data->m_samples.size();
-	for(size_t i=1; i<len; i++)
-	{
-		//Throw away clock samples until we find a falling edge
-		if(!(!clock->m_samples[i] && clock->m_samples[i-1]))
-			continue;
+/**
+	@brief Samples a digital bus waveform on the falling edges of a clock
 
-		//Throw away data samples until the data is synced with us
-		int64_t clkstart = clock->m_offsets[i] * clock->m_timescale + clock->m_triggerPhase;
-		while( (ndata+1 < dlen) && ((data->m_offsets[ndata+1] * data->m_timescale + data->m_triggerPhase) < clkstart) )
-			ndata ++;
-		if(ndata >= dlen)
-			break;
+	The sampling rate of the data and clock signals need not be equal or uniform.
 
-		//Extend the previous sample's duration (if any) to our start
-		size_t ssize = samples.m_samples.size();
-		if(ssize)
-		{
-			size_t last = ssize - 1;
-			samples.m_durations[last] = clkstart - samples.m_offsets[last];
-		}
+	The sampled waveform has a time scale in femtoseconds regardless of the incoming waveform's time scale.
 
-		//Add the new sample
-		samples.m_offsets.push_back(clkstart);
-		samples.m_durations.push_back(1);
-		samples.m_samples.push_back(data->m_samples[ndata]);
-	}
+	@param data		The data signal to sample
+	@param clock	The clock signal to use
+	@param samples	Output waveform
+ */
+void Filter::SampleOnFallingEdges(DigitalBusWaveform* data, DigitalWaveform* clock, DigitalBusWaveform& samples)
+{
+	SampleOnEdges(data, clock, CLOCK_EDGE_FALLING, samples);
 }
 
 /**
@@ -445,83 +376,401 @@ void Filter::SampleOnFallingEdges(DigitalWaveform* data, DigitalWaveform* clock,
 	@param samples	Output waveform
  */
 void Filter::SampleOnAnyEdges(DigitalWaveform* data, DigitalWaveform* clock, DigitalWaveform& samples)
+{
+	SampleOnEdges(data, clock, CLOCK_EDGE_ANY, samples);
+}
+
+/**
+	@brief Samples a digital bus waveform on all edges of a clock
+
+	The sampling rate of the data and clock signals need not be equal or uniform.
+
+	The sampled waveform has a time scale in femtoseconds regardless of the incoming waveform's time scale.
+
+	@param data		The data signal to sample
+	@param clock	The clock signal to use
+	@param samples	Output waveform
+ */
+void Filter::SampleOnAnyEdges(DigitalBusWaveform* data, DigitalWaveform* clock, DigitalBusWaveform& samples)
+{
+	SampleOnEdges(data, clock, CLOCK_EDGE_ANY, samples);
+}
+
+/**
+	@brief Common backend for all of the SampleOn*Edges() functions
+
+	Each output sample is the data value in effect at (strictly before) a clock edge. Edge timestamps come from the
+	cached clock edge index, and the matching data sample is located by galloping search from the previous one so
+	long runs of data samples between clock edges are skipped in logarithmic time.
+
+	Large clocks are split into blocks of edges which are sampled in parallel. Each block locates its starting data
+	sample independently, so the output is identical to a serial walk.
+ */
+template<class T>
+void Filter::SampleOnEdges(T* data, DigitalWaveform* clock, ClockEdgeType type, T& samples)
 {
 	samples.clear();
 
-	size_t ndata = 0;
-	size_t len = clock->m_offsets.size();
 	size_t dlen = data->m_samples.size();
-	for(size_t i=1; i<len; i++)
+	if(dlen == 0)
+		return;
+
+	auto pedges = GetClockEdges(clock, type);
+	auto& edges = *pedges;
+	size_t nedges = edges.size();
+	if(nedges == 0)
+		return;
+
+	samples.Resize(nedges);
+
+	//Divide large waveforms (>100K edges) into blocks and multithread them
+	//TODO: tune split
+	size_t numblocks = 1;
+	if(nedges > 100000)
+		numblocks = omp_get_max_threads();
+	size_t lastblock = numblocks - 1;
+	size_t blocksize = nedges / numblocks;
+
+	#pragma omp parallel for
+	for(size_t i=0; i<numblocks; i++)
 	{
-		//Throw away clock samples until we find an edge
-		if(clock->m_samples[i] == clock->m_samples[i-1])
-			continue;
+		//Last block gets any extra that didn't divide evenly
+		size_t start = i*blocksize;
+		size_t end = start + blocksize;
+		if(i == lastblock)
+			end = nedges;
+
+		size_t ndata = 0;
+		for(size_t j=start; j<end; j++)
+		{
+			int64_t clkstart = edges[j];
+
+			//Throw away data samples until the data is synced with us
+			ndata = GallopToTimestamp(data, ndata, dlen, clkstart);
+
+			//Each sample lasts until the next clock edge
+			samples.m_offsets[j] = clkstart;
+			if(j+1 < nedges)
+				samples.m_durations[j] = edges[j+1] - clkstart;
+			else
+				samples.m_durations[j] = 1;
+			samples.m_samples[j] = data->m_samples[ndata];
+		}
+	}
+}
+
+/**
+	@brief Gets the timestamps of edges in a clock signal
+
+	Unlike FindRisingEdges() etc, timestamps are at the start of the sample containing the new clock value (not the
+	midpoint), matching the sampling instants used by SampleOnRisingEdges() and friends.
+
+	Results are cached per waveform and edge type until the waveform is modified, or the cache is cleared by
+	ClearAnalysisCache(). The returned list is shared with the cache and must not be modified.
+
+	@param clock	The clock signal
+	@param type		Which edges to return
 
-		//Throw away data samples until the data is synced with us
-		int64_t clkstart = clock->m_offsets[i] * clock->m_timescale + clock->m_triggerPhase;
-		while( (ndata+1 < dlen) && ((data->m_offsets[ndata+1] * data->m_timescale + data->m_triggerPhase) < clkstart) )
-			ndata ++;
-		if(ndata >= dlen)
-			break;
+	@return Timestamps of each edge, in femtoseconds
+ */
+Filter::EdgeListPtr Filter::GetClockEdges(DigitalWaveform* clock, ClockEdgeType type)
+{
+	pair<uint64_t, int> cachekey(clock->m_serial, type);
 
-		//Extend the previous sample's duration (if any) to our start
-		size_t ssize = samples.m_samples.size();
-		if(ssize)
+	//Check cache
+	{
+		lock_guard<mutex> lock(m_cacheMutex);
+		auto it = m_clockEdgeCache.find(cachekey);
+		if( (it != m_clockEdgeCache.end()) && (it->second.first == clock->m_revision) )
+			return it->second.second;
+	}
+
+	auto edges = make_shared<vector<int64_t> >();
+	size_t len = clock->m_samples.size();
+
+	//Divide large waveforms (>1M points) into blocks and multithread them
+	//TODO: tune split
+	if(len > 1000000)
+	{
+		size_t numblocks = omp_get_max_threads();
+		size_t lastblock = numblocks - 1;
+		size_t blocksize = (len - 1) / numblocks;
+
+		vector< vector<int64_t> > blockedges(numblocks);
+
+		#pragma omp parallel for
+		for(size_t i=0; i<numblocks; i++)
 		{
-			size_t last = ssize - 1;
-			samples.m_durations[last] = clkstart - samples.m_offsets[last];
+			//Last block gets any extra that didn't divide evenly
+			size_t start = 1 + i*blocksize;
+			size_t end = start + blocksize;
+			if(i == lastblock)
+				end = len;
+
+			FindClockEdgesBlock(clock, type, start, end, blockedges[i]);
 		}
 
-		//Add the new sample
-		samples.m_offsets.push_back(clkstart);
-		samples.m_durations.push_back(1);
-		samples.m_samples.push_back(data->m_samples[ndata]);
+		//Concatenate the per-block results
+		size_t total = 0;
+		for(auto& b : blockedges)
+			total += b.size();
+		edges->reserve(total);
+		for(auto& b : blockedges)
+			edges->insert(edges->end(), b.begin(), b.end());
 	}
+
+	//Small waveforms get done single threaded to avoid overhead
+	else if(len > 1)
+		FindClockEdgesBlock(clock, type, 1, len, *edges);
+
+	//Add to cache, replacing any stale result from a previous revision
+	lock_guard<mutex> lock(m_cacheMutex);
+	m_clockEdgeCache[cachekey] = pair<uint64_t, EdgeListPtr>(clock->m_revision, edges);
+	return edges;
 }
 
 /**
-	@brief Samples a digital waveform on all edges of a clock
+	@brief Finds interpolated crossings of several voltage levels
 
-	The sampling rate of the data and clock signals need not be equal or uniform.
+	Transition-time measurements on the same channel usually ask for the same levels (e.g. 20% and 80% of the
+	base-to-top swing for both rise and fall time), so each level is cached separately. Any levels not in the cache
+	are found together in a single pass over the waveform.
 
-	The sampled waveform has a time scale in femtoseconds regardless of the incoming waveform's time scale.
+	Results are cached per waveform and level until the waveform is modified, or the cache is cleared by
+	ClearAnalysisCache(). The returned tables are shared with the cache and must not be modified.
 
-	@param data		The data signal to sample
-	@param clock	The clock signal to use
-	@param samples	Output waveform
+	@param data		The waveform to search
+	@param levels	Voltage levels to find crossings of
+
+	@return Crossing table for each level, in the same order as levels
  */
-void Filter::SampleOnAnyEdges(DigitalBusWaveform* data, DigitalWaveform* clock, DigitalBusWaveform& samples)
+vector<Filter::LevelCrossingsPtr> Filter::GetLevelCrossings(AnalogWaveform* data, const vector<float>& levels)
 {
-	samples.clear();
+	vector<LevelCrossingsPtr> ret(levels.size());
 
-	size_t ndata = 0;
-	size_t len = clock->m_offsets.size();
-	size_t dlen = data->m_samples.size();
-	for(size_t i=1; i<len; i++)
+	//Check cache
+	vector<float> missing;
+	vector<size_t> missingIndexes;
 	{
-		//Throw away clock samples until we find an edge
-		if(clock->m_samples[i] == clock->m_samples[i-1])
-			continue;
+		lock_guard<mutex> lock(m_cacheMutex);
+		for(size_t i=0; i<levels.size(); i++)
+		{
+			auto it = m_levelCrossingCache.find(pair<uint64_t, float>(data->m_serial, levels[i]));
+			if( (it != m_levelCrossingCache.end()) && (it->second.first == data->m_revision) )
+				ret[i] = it->second.second;
+			else
+			{
+				missing.push_back(levels[i]);
+				missingIndexes.push_back(i);
+			}
+		}
+	}
+	if(missing.empty())
+		return ret;
+
+	//Each sample is compared against the previous one, so the first possible crossing is between samples 0 and 1
+	size_t len = data->m_samples.size();
+	const size_t istart = 1;
+	size_t nlevels = missing.size();
+	vector<shared_ptr<LevelCrossings> > tables(nlevels);
+	for(auto& t : tables)
+		t = make_shared<LevelCrossings>();
+
+	//Divide large waveforms (>1M points) into blocks and multithread them
+	//TODO: tune split
+	if(len > 1000000)
+	{
+		size_t numblocks = omp_get_max_threads();
+		size_t lastblock = numblocks - 1;
+		size_t blocksize = (len - istart) / numblocks;
+
+		vector< vector<LevelCrossings> > blockcrossings(numblocks, vector<LevelCrossings>(nlevels));
+
+		#pragma omp parallel for
+		for(size_t i=0; i<numblocks; i++)
+		{
+			//Last block gets any extra that didn't divide evenly
+			size_t start = istart + i*blocksize;
+			size_t end = start + blocksize;
+			if(i == lastblock)
+				end = len;
+
+			FindLevelCrossingsBlock(data, missing, start, end, blockcrossings[i]);
+		}
+
+		//Concatenate the per-block results
+		for(size_t j=0; j<nlevels; j++)
+		{
+			size_t nrising = 0;
+			size_t nfalling = 0;
+			for(auto& b : blockcrossings)
+			{
+				nrising += b[j].m_rising.size();
+				nfalling += b[j].m_falling.size();
+			}
+
+			auto& t = *tables[j];
+			t.m_rising.reserve(nrising);
+			t.m_falling.reserve(nfalling);
+			for(auto& b : blockcrossings)
+			{
+				t.m_rising.insert(t.m_rising.end(), b[j].m_rising.begin(), b[j].m_rising.end());
+				t.m_falling.insert(t.m_falling.end(), b[j].m_falling.begin(), b[j].m_falling.end());
+			}
+		}
+	}
+
+	//Small waveforms get done single threaded to avoid overhead
+	else if(len > istart)
+	{
+		vector<LevelCrossings> crossings(nlevels);
+		FindLevelCrossingsBlock(data, missing, istart, len, crossings);
+		for(size_t j=0; j<nlevels; j++)
+			*tables[j] = move(crossings[j]);
+	}
+
+	//Add to cache, replacing any stale result from a previous revision
+	lock_guard<mutex> lock(m_cacheMutex);
+	for(size_t j=0; j<nlevels; j++)
+	{
+		ret[missingIndexes[j]] = tables[j];
+		m_levelCrossingCache[pair<uint64_t, float>(data->m_serial, missing[j])] =
+			pair<uint64_t, LevelCrossingsPtr>(data->m_revision, tables[j]);
+	}
+	return ret;
+}
 
-		//Throw away data samples until the data is synced with us
-		int64_t clkstart = clock->m_offsets[i] * clock->m_timescale + clock->m_triggerPhase;
-		while( (ndata+1 < dlen) && ((data->m_offsets[ndata+1] * data->m_timescale + data->m_triggerPhase) < clkstart) )
-			ndata ++;
-		if(ndata >= dlen)
-			break;
+/**
+	@brief Finds crossings of each level between samples [istart-1, iend) of a waveform, using the fastest available
+	backend
 
-		//Extend the previous sample's duration (if any) to our start
-		size_t ssize = samples.m_samples.size();
-		if(ssize)
+	Crossings are appended to the table for each level.
+ */
+void Filter::FindLevelCrossingsBlock(
+	AnalogWaveform* data,
+	const vector<float>& levels,
+	size_t istart,
+	size_t iend,
+	vector<LevelCrossings>& crossings)
+{
+	if(g_hasAvx2)
+		FindLevelCrossingsAVX2(data, levels, istart, iend, crossings);
+	else
+		FindLevelCrossingsGeneric(data, levels, istart, iend, crossings);
+}
+
+/**
+	@brief Generic backend for FindLevelCrossingsBlock()
+ */
+void Filter::FindLevelCrossingsGeneric(
+	AnalogWaveform* data,
+	const vector<float>& levels,
+	size_t istart,
+	size_t iend,
+	vector<LevelCrossings>& crossings)
+{
+	float* samples = (float*)&data->m_samples[0];
+	size_t nlevels = levels.size();
+
+	for(size_t i=istart; i<iend; i++)
+	{
+		float last = samples[i-1];
+		float cur = samples[i];
+		for(size_t j=0; j<nlevels; j++)
 		{
-			size_t last = ssize - 1;
-			samples.m_durations[last] = clkstart - samples.m_offsets[last];
+			float level = levels[j];
+			if( (last <= level) && (cur > level) )
+				AddLevelCrossing(data, level, i, true, crossings[j]);
+			else if( (last >= level) && (cur < level) )
+				AddLevelCrossing(data, level, i, false, crossings[j]);
 		}
+	}
+}
+
+/**
+	@brief Optimized AVX2 backend for FindLevelCrossingsBlock()
 
-		//Add the new sample
-		samples.m_offsets.push_back(clkstart);
-		samples.m_durations.push_back(1);
-		samples.m_samples.push_back(data->m_samples[ndata]);
+	Compares eight samples at a time against each level, and only drops to scalar code for blocks containing a crossing.
+ */
+__attribute__((target("avx2")))
+void Filter::FindLevelCrossingsAVX2(
+	AnalogWaveform* data,
+	const vector<float>& levels,
+	size_t istart,
+	size_t iend,
+	vector<LevelCrossings>& crossings)
+{
+	float* samples = (float*)&data->m_samples[0];
+	size_t nlevels = levels.size();
+	size_t end = istart + ((iend - istart) - ((iend - istart) % 8));
+
+	for(size_t i=istart; i<end; i += 8)
+	{
+		__m256 cur = _mm256_loadu_ps(samples + i);
+		__m256 last = _mm256_loadu_ps(samples + i - 1);
+
+		for(size_t j=0; j<nlevels; j++)
+		{
+			__m256 level = _mm256_set1_ps(levels[j]);
+
+			__m256 rising = _mm256_and_ps(
+				_mm256_cmp_ps(last, level, _CMP_LE_OQ),
+				_mm256_cmp_ps(cur, level, _CMP_GT_OQ));
+			__m256 falling = _mm256_and_ps(
+				_mm256_cmp_ps(last, level, _CMP_GE_OQ),
+				_mm256_cmp_ps(cur, level, _CMP_LT_OQ));
+
+			unsigned int rmask = _mm256_movemask_ps(rising);
+			unsigned int fmask = _mm256_movemask_ps(falling);
+			unsigned int mask = rmask | fmask;
+			while(mask)
+			{
+				unsigned int k = __builtin_ctz(mask);
+				mask &= mask - 1;
+				AddLevelCrossing(data, levels[j], i + k, (rmask >> k) & 1, crossings[j]);
+			}
+		}
+	}
+
+	//Get any extras we didn't get in the SIMD loop
+	FindLevelCrossingsGeneric(data, levels, end, iend, crossings);
+}
+
+/**
+	@brief Stores a precomputed list of clock edges in the cache
+
+	Filters which find edges anyway while generating a digital waveform can call this so that later calls to
+	GetClockEdges() on their output don't need to scan it again. The list must be exactly what GetClockEdges() would
+	return for the current revision of the waveform.
+
+	@param clock	The clock signal
+	@param type		Which edges are in the list
+	@param edges	Timestamps of each edge, in femtoseconds
+ */
+void Filter::SetClockEdges(DigitalWaveform* clock, ClockEdgeType type, EdgeListPtr edges)
+{
+	lock_guard<mutex> lock(m_cacheMutex);
+	m_clockEdgeCache[pair<uint64_t, int>(clock->m_serial, type)] = pair<uint64_t, EdgeListPtr>(clock->m_revision, edges);
+}
+
+/**
+	@brief Finds clock edges between samples [istart-1, iend) of a waveform
+
+	Edges are appended to the edge list.
+ */
+void Filter::FindClockEdgesBlock(
+	DigitalWaveform* clock, ClockEdgeType type, size_t istart, size_t iend, vector<int64_t>& edges)
+{
+	bool rising = (type & CLOCK_EDGE_RISING) != 0;
+	bool falling = (type & CLOCK_EDGE_FALLING) != 0;
+
+	bool last = clock->m_samples[istart-1];
+	for(size_t i=istart; i<iend; i++)
+	{
+		bool value = clock->m_samples[i];
+		if( (value && !last && rising) || (!value && last && falling) )
+			edges.push_back(clock->m_offsets[i] * clock->m_timescale + clock->m_triggerPhase);
+		last = value;
 	}
 }
 
@@ -596,83 +845,198 @@ void Filter::FindRisingEdges(AnalogWaveform* data, float threshold, vector<int64
 
 /**
 	@brief Find zero crossings in a waveform, interpolating as necessary
+
+	This overload copies the edge list into the caller's vector. Callers which only need to read the edges should use
+	the overload returning an EdgeListPtr instead.
  */
 void Filter::FindZeroCrossings(AnalogWaveform* data, float threshold, vector<int64_t>& edges)
 {
-	pair<WaveformBase*, float> cachekey(data, threshold);
+	edges = *FindZeroCrossings(data, threshold);
+}
+
+/**
+	@brief Find zero crossings in a waveform, interpolating as necessary
+
+	Results are cached per waveform and threshold until the waveform is modified, or the cache is cleared by
+	ClearAnalysisCache(). The returned list is shared with the cache and must not be modified.
+
+	@param data			The waveform to search
+	@param threshold	Decision threshold
+
+	@return Timestamps of each crossing, in femtoseconds
+ */
+Filter::EdgeListPtr Filter::FindZeroCrossings(AnalogWaveform* data, float threshold)
+{
+	pair<uint64_t, float> cachekey(data->m_serial, threshold);
 
 	//Check cache
 	{
 		lock_guard<mutex> lock(m_cacheMutex);
 		auto it = m_zeroCrossingCache.find(cachekey);
-		if(it != m_zeroCrossingCache.end())
-		{
-			edges = it->second;
-			return;
-		}
+		if( (it != m_zeroCrossingCache.end()) && (it->second.first == data->m_revision) )
+			return it->second.second;
 	}
 
-	//Find times of the zero crossings
-	bool first = true;
-	bool last = false;
-	int64_t phoff = data->m_triggerPhase;
+	//Each sample is compared against the previous one, and the first sample is only used as history
+	//(so the first possible transition is between samples 1 and 2)
+	auto edges = make_shared<vector<int64_t> >();
 	size_t len = data->m_samples.size();
-	float fscale = data->m_timescale;
+	const size_t istart = 2;
 
-	if(data->m_densePacked)
+	//Divide large waveforms (>1M points) into blocks and multithread them
+	//TODO: tune split
+	if(len > 1000000)
 	{
-		for(size_t i=1; i<len; i++)
-		{
-			bool value = data->m_samples[i] > threshold;
+		//Round blocks to multiples of 64 samples for clean vectorization
+		size_t numblocks = omp_get_max_threads();
+		size_t lastblock = numblocks - 1;
+		size_t blocksize = (len - istart) / numblocks;
+		blocksize = blocksize - (blocksize % 64);
 
-			//Save the last value
-			if(first)
-			{
-				last = value;
-				first = false;
-				continue;
-			}
+		vector< vector<int64_t> > blockedges(numblocks);
 
-			//Skip samples with no transition
-			if(last == value)
-				continue;
+		#pragma omp parallel for
+		for(size_t i=0; i<numblocks; i++)
+		{
+			//Last block gets any extra that didn't divide evenly
+			size_t start = istart + i*blocksize;
+			size_t end = start + blocksize;
+			if(i == lastblock)
+				end = len;
 
-			//Midpoint of the sample, plus the zero crossing
-			int64_t tfrac = fscale * InterpolateTime(data, i-1, threshold);
-			int64_t t = phoff + data->m_timescale*(i-1) + tfrac;
-			edges.push_back(t);
-			last = value;
+			FindZeroCrossingsBlock(data, threshold, start, end, blockedges[i]);
 		}
+
+		//Concatenate the per-block results
+		size_t total = 0;
+		for(auto& b : blockedges)
+			total += b.size();
+		edges->reserve(total);
+		for(auto& b : blockedges)
+			edges->insert(edges->end(), b.begin(), b.end());
 	}
+
+	//Small waveforms get done single threaded to avoid overhead
+	else if(len > istart)
+		FindZeroCrossingsBlock(data, threshold, istart, len, *edges);
+
+	//Add to cache, replacing any stale result from a previous revision
+	lock_guard<mutex> lock(m_cacheMutex);
+	m_zeroCrossingCache[cachekey] = pair<uint64_t, EdgeListPtr>(data->m_revision, edges);
+	return edges;
+}
+
+/**
+	@brief Finds zero crossings between samples [istart-1, iend) of a waveform, using the fastest available backend
+
+	Crossings are appended to the edge list.
+ */
+void Filter::FindZeroCrossingsBlock(
+	AnalogWaveform* data, float threshold, size_t istart, size_t iend, vector<int64_t>& edges)
+{
+	if(g_hasAvx512F)
+		FindZeroCrossingsAVX512F(data, threshold, istart, iend, edges);
+	else if(g_hasAvx2)
+		FindZeroCrossingsAVX2(data, threshold, istart, iend, edges);
 	else
+		FindZeroCrossingsGeneric(data, threshold, istart, iend, edges);
+}
+
+/**
+	@brief Generic backend for FindZeroCrossingsBlock()
+ */
+void Filter::FindZeroCrossingsGeneric(
+	AnalogWaveform* data, float threshold, size_t istart, size_t iend, vector<int64_t>& edges)
+{
+	float* samples = (float*)&data->m_samples[0];
+
+	bool last = samples[istart-1] > threshold;
+	for(size_t i=istart; i<iend; i++)
 	{
-		for(size_t i=1; i<len; i++)
+		bool value = samples[i] > threshold;
+
+		//Skip samples with no transition
+		if(last == value)
+			continue;
+
+		edges.push_back(GetZeroCrossingTimestamp(data, threshold, i-1));
+		last = value;
+	}
+}
+
+/**
+	@brief Optimized AVX2 backend for FindZeroCrossingsBlock()
+
+	Compares 8 samples at a time against the threshold and XORs the result with the comparison of the previous
+	samples, so only vectors containing at least one transition fall through to the scalar interpolation.
+ */
+__attribute__((target("avx2")))
+void Filter::FindZeroCrossingsAVX2(
+	AnalogWaveform* data, float threshold, size_t istart, size_t iend, vector<int64_t>& edges)
+{
+	float* samples = (float*)&data->m_samples[0];
+	size_t count = iend - istart;
+	size_t end = istart + count - (count % 8);
+
+	__m256 vthresh = _mm256_set1_ps(threshold);
+
+	for(size_t i=istart; i<end; i += 8)
+	{
+		__m256 cur = _mm256_loadu_ps(samples + i);
+		__m256 prev = _mm256_loadu_ps(samples + i - 1);
+
+		__m256 curhigh = _mm256_cmp_ps(cur, vthresh, _CMP_GT_OQ);
+		__m256 prevhigh = _mm256_cmp_ps(prev, vthresh, _CMP_GT_OQ);
+
+		unsigned int mask = _mm256_movemask_ps(_mm256_xor_ps(curhigh, prevhigh));
+		while(mask)
 		{
-			bool value = data->m_samples[i] > threshold;
+			size_t j = __builtin_ctz(mask);
+			mask &= (mask - 1);
+			edges.push_back(GetZeroCrossingTimestamp(data, threshold, i + j - 1));
+		}
+	}
 
-			//Save the last value
-			if(first)
-			{
-				last = value;
-				first = false;
-				continue;
-			}
+	//Catch any stragglers
+	if(end < iend)
+		FindZeroCrossingsGeneric(data, threshold, end, iend, edges);
+}
 
-			//Skip samples with no transition
-			if(last == value)
-				continue;
+/**
+	@brief Optimized AVX512F backend for FindZeroCrossingsBlock()
 
-			//Midpoint of the sample, plus the zero crossing
-			int64_t tfrac = fscale * InterpolateTime(data, i-1, threshold);
-			int64_t t = phoff + data->m_timescale * data->m_offsets[i-1] + tfrac;
-			edges.push_back(t);
-			last = value;
+	Same algorithm as the AVX2 version, but 16 samples at a time using mask registers.
+ */
+__attribute__((target("avx512f")))
+void Filter::FindZeroCrossingsAVX512F(
+	AnalogWaveform* data, float threshold, size_t istart, size_t iend, vector<int64_t>& edges)
+{
+	float* samples = (float*)&data->m_samples[0];
+	size_t count = iend - istart;
+	size_t end = istart + count - (count % 16);
+
+	__m512 vthresh = _mm512_set1_ps(threshold);
+
+	for(size_t i=istart; i<end; i += 16)
+	{
+		__m512 cur = _mm512_loadu_ps(samples + i);
+		__m512 prev = _mm512_loadu_ps(samples + i - 1);
+
+		__mmask16 curhigh = _mm512_cmp_ps_mask(cur, vthresh, _CMP_GT_OQ);
+		__mmask16 prevhigh = _mm512_cmp_ps_mask(prev, vthresh, _CMP_GT_OQ);
+
+		unsigned int mask = curhigh ^ prevhigh;
+		while(mask)
+		{
+			size_t j = __builtin_ctz(mask);
+			mask &= (mask - 1);
+			edges.push_back(GetZeroCrossingTimestamp(data, threshold, i + j - 1));
 		}
 	}
 
-	//Add to cache
-	lock_guard<mutex> lock(m_cacheMutex);
-	m_zeroCrossingCache[cachekey] = edges;
+	//Catch any stragglers
+	if(end < iend)
+		FindZeroCrossingsGeneric(data, threshold, end, iend, edges);
 }
 
 /**
@@ -766,6 +1130,149 @@ void Filter::FindFallingEdges(DigitalWaveform* data, vector<int64_t>& edges)
 	}
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Bit packing helpers
+
+/**
+	@brief Packs samples of a digital waveform into a bit vector
+
+	Sample start+i is stored in bit (i % 64) of out[i / 64]. Unused bits at the end of the last word are zero.
+
+	@param wfm		The waveform to pack
+	@param start	Index of the first sample to pack
+	@param count	Number of samples to pack
+	@param out		Output buffer, must have room for at least (count+63)/64 words
+ */
+void Filter::PackBits(DigitalWaveform* wfm, size_t start, size_t count, uint64_t* out)
+{
+	if(g_hasAvx2)
+		PackBitsAVX2(wfm, start, count, out);
+	else
+		PackBitsGeneric(wfm, start, count, out);
+}
+
+/**
+	@brief Generic backend for PackBits()
+ */
+void Filter::PackBitsGeneric(DigitalWaveform* wfm, size_t start, size_t count, uint64_t* out)
+{
+	size_t nwords = (count + 63) / 64;
+	memset(out, 0, nwords * sizeof(uint64_t));
+
+	bool* samples = (bool*)&wfm->m_samples[start];
+	for(size_t i=0; i<count; i++)
+	{
+		if(samples[i])
+			out[i >> 6] |= (1ULL << (i & 63));
+	}
+}
+
+/**
+	@brief Optimized AVX2 backend for PackBits()
+
+	Converts 64 samples at a time using byte compares and movemask.
+ */
+__attribute__((target("avx2")))
+void Filter::PackBitsAVX2(DigitalWaveform* wfm, size_t start, size_t count, uint64_t* out)
+{
+	size_t end = count - (count % 64);
+	bool* samples = (bool*)&wfm->m_samples[start];
+	__m256i zero = _mm256_setzero_si256();
+
+	for(size_t i=0; i<end; i += 64)
+	{
+		__m256i lo = _mm256_loadu_si256(reinterpret_cast<__m256i*>(samples + i));
+		__m256i hi = _mm256_loadu_si256(reinterpret_cast<__m256i*>(samples + i + 32));
+
+		//bools are 0 or 1, so anything greater than zero is a 1 bit
+		uint32_t lobits = _mm256_movemask_epi8(_mm256_cmpgt_epi8(lo, zero));
+		uint32_t hibits = _mm256_movemask_epi8(_mm256_cmpgt_epi8(hi, zero));
+		out[i >> 6] = (static_cast<uint64_t>(hibits) << 32) | lobits;
+	}
+
+	//Catch any stragglers
+	if(end < count)
+		PackBitsGeneric(wfm, start + end, count - end, out + (end >> 6));
+}
+
+/**
+	@brief Unpacks a bit vector (as produced by PackBits()) into samples of a digital waveform
+
+	Only sample values are written, timestamps are not touched.
+
+	@param in		Packed input bits
+	@param count	Number of bits to unpack
+	@param wfm		The waveform to write to. Must already be large enough.
+	@param start	Index of the first sample to write
+ */
+void Filter::UnpackBits(const uint64_t* in, size_t count, DigitalWaveform* wfm, size_t start)
+{
+	if(g_hasAvx2)
+		UnpackBitsAVX2(in, count, wfm, start);
+	else
+		UnpackBitsGeneric(in, count, wfm, start);
+}
+
+/**
+	@brief Generic backend for UnpackBits()
+ */
+void Filter::UnpackBitsGeneric(const uint64_t* in, size_t count, DigitalWaveform* wfm, size_t start)
+{
+	bool* samples = (bool*)&wfm->m_samples[start];
+	for(size_t i=0; i<count; i += 64)
+	{
+		uint64_t word = in[i >> 6];
+		size_t n = min((size_t)64, count - i);
+
+		//Fast path for runs of zeroes (common when checking error vectors)
+		if(word == 0)
+			memset(samples + i, 0, n);
+		else
+		{
+			for(size_t j=0; j<n; j++)
+				samples[i + j] = (word >> j) & 1;
+		}
+	}
+}
+
+/**
+	@brief Optimized AVX2 backend for UnpackBits()
+
+	Expands 32 bits at a time: each byte of the word is broadcast to eight output bytes, which are then tested
+	against a different bit mask.
+ */
+__attribute__((target("avx2")))
+void Filter::UnpackBitsAVX2(const uint64_t* in, size_t count, DigitalWaveform* wfm, size_t start)
+{
+	size_t end = count - (count % 64);
+	bool* samples = (bool*)&wfm->m_samples[start];
+
+	__m256i shuf = _mm256_setr_epi8(
+		0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+		2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+	__m256i bits = _mm256_setr_epi8(
+		1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+		1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+	__m256i one = _mm256_set1_epi8(1);
+
+	for(size_t i=0; i<end; i += 64)
+	{
+		uint64_t word = in[i >> 6];
+
+		__m256i lo = _mm256_shuffle_epi8(_mm256_set1_epi32(static_cast<uint32_t>(word)), shuf);
+		__m256i hi = _mm256_shuffle_epi8(_mm256_set1_epi32(static_cast<uint32_t>(word >> 32)), shuf);
+		lo = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(lo, bits), bits), one);
+		hi = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(hi, bits), bits), one);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(samples + i), lo);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(samples + i + 32), hi);
+	}
+
+	//Catch any stragglers
+	if(end < count)
+		UnpackBitsGeneric(in + (end >> 6), count - end, wfm, start + end);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Serialization
 
@@ -952,14 +1459,10 @@ float Filter::InterpolateValue(AnalogWaveform* cap, size_t index, float frac_tic
  */
 float Filter::GetMinVoltage(AnalogWaveform* cap)
 {
-	//Loop over samples and find the minimum
-	float tmp = FLT_MAX;
-	for(float f : cap->m_samples)
-	{
-		if(f < tmp)
-			tmp = f;
-	}
-	return tmp;
+	float vmin;
+	float vmax;
+	GetMinMaxVoltage(cap, vmin, vmax);
+	return vmin;
 }
 
 /**
@@ -967,14 +1470,94 @@ float Filter::GetMinVoltage(AnalogWaveform* cap)
  */
 float Filter::GetMaxVoltage(AnalogWaveform* cap)
 {
-	//Loop over samples and find the maximum
-	float tmp = -FLT_MAX;
-	for(float f : cap->m_samples)
+	float vmin;
+	float vmax;
+	GetMinMaxVoltage(cap, vmin, vmax);
+	return vmax;
+}
+
+/**
+	@brief Gets the lowest and highest voltage of a waveform in a single pass
+ */
+void Filter::GetMinMaxVoltage(AnalogWaveform* cap, float& vmin, float& vmax)
+{
+	vmin = FLT_MAX;
+	vmax = -FLT_MAX;
+
+	size_t len = cap->m_samples.size();
+	if(len == 0)
+		return;
+	const float* samples = (const float*)&cap->m_samples[0];
+
+	//Divide large waveforms (>1M points) into blocks and multithread them
+	size_t numblocks = 1;
+	if(len > 1000000)
+		numblocks = omp_get_max_threads();
+	size_t lastblock = numblocks - 1;
+	size_t blocksize = len / numblocks;
+
+	#pragma omp parallel for
+	for(size_t i=0; i<numblocks; i++)
+	{
+		size_t istart = i*blocksize;
+		size_t iend = (i == lastblock) ? len : istart + blocksize;
+
+		float bmin;
+		float bmax;
+		if(g_hasAvx2)
+			GetMinMaxVoltageAVX2(samples + istart, iend - istart, bmin, bmax);
+		else
+			GetMinMaxVoltageGeneric(samples + istart, iend - istart, bmin, bmax);
+
+		#pragma omp critical
+		{
+			vmin = min(vmin, bmin);
+			vmax = max(vmax, bmax);
+		}
+	}
+}
+
+void Filter::GetMinMaxVoltageGeneric(const float* samples, size_t len, float& vmin, float& vmax)
+{
+	vmin = FLT_MAX;
+	vmax = -FLT_MAX;
+	for(size_t i=0; i<len; i++)
 	{
-		if(f > tmp)
-			tmp = f;
+		float f = samples[i];
+		if(f < vmin)
+			vmin = f;
+		if(f > vmax)
+			vmax = f;
+	}
+}
+
+__attribute__((target("avx2")))
+void Filter::GetMinMaxVoltageAVX2(const float* samples, size_t len, float& vmin, float& vmax)
+{
+	size_t end = len - (len % 8);
+
+	__m256 vmin_x8 = _mm256_set1_ps(FLT_MAX);
+	__m256 vmax_x8 = _mm256_set1_ps(-FLT_MAX);
+	for(size_t i=0; i<end; i += 8)
+	{
+		__m256 v = _mm256_loadu_ps(samples + i);
+		vmin_x8 = _mm256_min_ps(vmin_x8, v);
+		vmax_x8 = _mm256_max_ps(vmax_x8, v);
+	}
+
+	//Horizontal reduction
+	float mins[8] __attribute__((aligned(32)));
+	float maxes[8] __attribute__((aligned(32)));
+	_mm256_store_ps(mins, vmin_x8);
+	_mm256_store_ps(maxes, vmax_x8);
+
+	//Get any extras we didn't get in the SIMD loop
+	GetMinMaxVoltageGeneric(samples + end, len - end, vmin, vmax);
+	for(size_t i=0; i<8; i++)
+	{
+		vmin = min(vmin, mins[i]);
+		vmax = max(vmax, maxes[i]);
 	}
-	return tmp;
 }
 
 /**
@@ -1001,28 +1584,26 @@ float Filter::GetAvgVoltage(AnalogWaveform* cap)
  */
 vector<size_t> Filter::MakeHistogram(AnalogWaveform* cap, float low, float high, size_t bins)
 {
-	vector<size_t> ret;
-	for(size_t i=0; i<bins; i++)
-		ret.push_back(0);
-
-	//Early out if we have zero span
-	if(bins == 0)
-		return ret;
+	float vmin;
+	float vmax;
+	return MakeHistogramInternal(cap, low, high, bins, false, vmin, vmax);
+}
 
-	float delta = high-low;
+/**
+	@brief Makes a histogram from a waveform, and finds its lowest and highest values in the same pass
 
-	for(float v : cap->m_samples)
-	{
-		float fbin = (v-low) / delta;
-		size_t bin = floor(fbin * bins);
-		if(fbin < 0)
-			bin = 0;
-		else
-			bin = min(bin, bins-1);
-		ret[bin] ++;
-	}
+	Any values outside the range are clamped (put in bin 0 or bins-1 as appropriate). Callers that guess the range
+	(for example from the previous waveform) can compare it against vmin/vmax and only rebin if the guess was wrong.
 
-	return ret;
+	@param low	Low endpoint of the histogram (volts)
+	@param high High endpoint of the histogram (volts)
+	@param bins	Number of histogram bins
+	@param vmin	Lowest sample value
+	@param vmax	Highest sample value
+ */
+vector<size_t> Filter::MakeHistogram(AnalogWaveform* cap, float low, float high, size_t bins, float& vmin, float& vmax)
+{
+	return MakeHistogramInternal(cap, low, high, bins, false, vmin, vmax);
 }
 
 /**
@@ -1036,26 +1617,173 @@ vector<size_t> Filter::MakeHistogram(AnalogWaveform* cap, float low, float high,
  */
 vector<size_t> Filter::MakeHistogramClipped(AnalogWaveform* cap, float low, float high, size_t bins)
 {
-	vector<size_t> ret;
-	for(size_t i=0; i<bins; i++)
-		ret.push_back(0);
+	float vmin;
+	float vmax;
+	return MakeHistogramInternal(cap, low, high, bins, true, vmin, vmax);
+}
+
+/**
+	@brief Common backend for MakeHistogram() and MakeHistogramClipped()
+
+	@param clip	If true, discard out-of-range values. If false, count them in the first or last bin.
+	@param vmin	Lowest sample value, found during the binning pass
+	@param vmax	Highest sample value, found during the binning pass
+ */
+vector<size_t> Filter::MakeHistogramInternal(
+	AnalogWaveform* cap, float low, float high, size_t bins, bool clip, float& vmin, float& vmax)
+{
+	vector<size_t> ret(bins, 0);
+	vmin = FLT_MAX;
+	vmax = -FLT_MAX;
 
 	//Early out if we have zero span
-	if(bins == 0)
+	size_t len = cap->m_samples.size();
+	if( (bins == 0) || (len == 0) )
 		return ret;
 
 	float delta = high-low;
+	const float* samples = (const float*)&cap->m_samples[0];
+
+	//Divide large waveforms (>1M points) into blocks and multithread them.
+	//Each block gets its own histogram so threads never fight over popular bins.
+	size_t numblocks = 1;
+	if(len > 1000000)
+		numblocks = omp_get_max_threads();
+	size_t lastblock = numblocks - 1;
+	size_t blocksize = len / numblocks;
+
+	#pragma omp parallel for
+	for(size_t i=0; i<numblocks; i++)
+	{
+		size_t istart = i*blocksize;
+		size_t iend = (i == lastblock) ? len : istart + blocksize;
+
+		vector<size_t> hist(bins, 0);
+		float bmin;
+		float bmax;
+		if(g_hasAvx2)
+			MakeHistogramAVX2(samples + istart, iend - istart, low, delta, bins, clip, &hist[0], bmin, bmax);
+		else
+			MakeHistogramGeneric(samples + istart, iend - istart, low, delta, bins, clip, &hist[0], bmin, bmax);
 
-	for(float v : cap->m_samples)
+		#pragma omp critical
+		{
+			for(size_t j=0; j<bins; j++)
+				ret[j] += hist[j];
+			vmin = min(vmin, bmin);
+			vmax = max(vmax, bmax);
+		}
+	}
+
+	return ret;
+}
+
+void Filter::MakeHistogramGeneric(
+	const float* samples, size_t len, float low, float delta, size_t bins, bool clip, size_t* hist,
+	float& vmin, float& vmax)
+{
+	vmin = FLT_MAX;
+	vmax = -FLT_MAX;
+	float fbins = bins;
+	float maxbin = bins - 1;
+	for(size_t i=0; i<len; i++)
 	{
+		float v = samples[i];
+		if(v < vmin)
+			vmin = v;
+		if(v > vmax)
+			vmax = v;
+
 		float fbin = (v-low) / delta;
-		size_t bin = floor(fbin * bins);
-		if(bin >= bins)	//negative values wrap to huge positive and get caught here
-			continue;
-		ret[bin] ++;
+		float f = floor(fbin * fbins);
+		if(clip)
+		{
+			if( (f >= 0) && (f < fbins) )
+				hist[(size_t)f] ++;
+		}
+		else if(fbin < 0)
+			hist[0] ++;
+		else
+			hist[(size_t)min(f, maxbin)] ++;
 	}
+}
 
-	return ret;
+/**
+	@brief Vectorized histogram kernel
+
+	Bin indexes are calculated 8 at a time. The increments themselves can't be vectorized, but spreading them over
+	four copies of the histogram keeps long runs of samples in the same bin (very common for digital signals) from
+	serializing on a single counter.
+ */
+__attribute__((target("avx2")))
+void Filter::MakeHistogramAVX2(
+	const float* samples, size_t len, float low, float delta, size_t bins, bool clip, size_t* hist,
+	float& vmin, float& vmax)
+{
+	size_t end = len - (len % 8);
+
+	vector<size_t> sub(4*bins, 0);
+	size_t* subs[4] = { &sub[0], &sub[bins], &sub[2*bins], &sub[3*bins] };
+
+	__m256 vlow = _mm256_set1_ps(low);
+	__m256 vdelta = _mm256_set1_ps(delta);
+	__m256 vbins = _mm256_set1_ps(bins);
+	__m256 vmaxbin = _mm256_set1_ps(bins - 1);
+	__m256 vzero = _mm256_setzero_ps();
+	__m256i vinvalid = _mm256_set1_epi32(-1);
+	__m256 vmin_x8 = _mm256_set1_ps(FLT_MAX);
+	__m256 vmax_x8 = _mm256_set1_ps(-FLT_MAX);
+
+	int32_t idx[8] __attribute__((aligned(32)));
+	for(size_t i=0; i<end; i += 8)
+	{
+		__m256 v = _mm256_loadu_ps(samples + i);
+		vmin_x8 = _mm256_min_ps(vmin_x8, v);
+		vmax_x8 = _mm256_max_ps(vmax_x8, v);
+		__m256 fbin = _mm256_div_ps(_mm256_sub_ps(v, vlow), vdelta);
+		__m256 f = _mm256_floor_ps(_mm256_mul_ps(fbin, vbins));
+
+		__m256i vidx;
+		if(clip)
+		{
+			//Out of range samples get an index of -1 and are skipped
+			__m256 valid = _mm256_and_ps(
+				_mm256_cmp_ps(f, vzero, _CMP_GE_OQ),
+				_mm256_cmp_ps(f, vbins, _CMP_LT_OQ));
+			vidx = _mm256_blendv_epi8(vinvalid, _mm256_cvttps_epi32(f), _mm256_castps_si256(valid));
+		}
+		else
+		{
+			//Out of range samples get clamped to the first or last bin
+			f = _mm256_min_ps(_mm256_max_ps(f, vzero), vmaxbin);
+			vidx = _mm256_cvttps_epi32(f);
+		}
+		_mm256_store_si256((__m256i*)idx, vidx);
+
+		for(size_t j=0; j<8; j++)
+		{
+			if(idx[j] >= 0)
+				subs[j & 3][idx[j]] ++;
+		}
+	}
+
+	//Get any extras we didn't get in the SIMD loop
+	MakeHistogramGeneric(samples + end, len - end, low, delta, bins, clip, hist, vmin, vmax);
+
+	//Merge the sub-histograms
+	for(size_t j=0; j<bins; j++)
+		hist[j] += subs[0][j] + subs[1][j] + subs[2][j] + subs[3][j];
+
+	//Horizontal min/max reduction
+	float mins[8] __attribute__((aligned(32)));
+	float maxes[8] __attribute__((aligned(32)));
+	_mm256_store_ps(mins, vmin_x8);
+	_mm256_store_ps(maxes, vmax_x8);
+	for(size_t i=0; i<8; i++)
+	{
+		vmin = min(vmin, mins[i]);
+		vmax = max(vmax, maxes[i]);
+	}
 }
 
 /**
@@ -1063,8 +1791,46 @@ vector<size_t> Filter::MakeHistogramClipped(AnalogWaveform* cap, float low, floa
  */
 float Filter::GetBaseVoltage(AnalogWaveform* cap)
 {
-	float vmin = GetMinVoltage(cap);
-	float vmax = GetMaxVoltage(cap);
+	float base;
+	float top;
+	GetBaseAndTopVoltage(cap, base, top);
+	return base;
+}
+
+/**
+	@brief Gets the most probable "1" level for a digital waveform
+ */
+float Filter::GetTopVoltage(AnalogWaveform* cap)
+{
+	float base;
+	float top;
+	GetBaseAndTopVoltage(cap, base, top);
+	return top;
+}
+
+/**
+	@brief Gets the most probable "0" and "1" levels for a digital waveform
+
+	Both come from the same histogram, so this costs one min/max and one histogram pass. Results are cached per
+	waveform until it's modified, so several measurements on one channel only pay for this once.
+ */
+void Filter::GetBaseAndTopVoltage(AnalogWaveform* cap, float& base, float& top)
+{
+	//Check cache
+	{
+		lock_guard<mutex> lock(m_cacheMutex);
+		auto it = m_baseTopCache.find(cap->m_serial);
+		if( (it != m_baseTopCache.end()) && (it->second.first == cap->m_revision) )
+		{
+			base = it->second.second.first;
+			top = it->second.second.second;
+			return;
+		}
+	}
+
+	float vmin;
+	float vmax;
+	GetMinMaxVoltage(cap, vmin, vmax);
 	float delta = vmax - vmin;
 	const int nbins = 100;
 	auto hist = MakeHistogram(cap, vmin, vmax, nbins);
@@ -1080,25 +1846,11 @@ float Filter::GetBaseVoltage(AnalogWaveform* cap)
 			idx = i;
 		}
 	}
-
-	float fbin = (idx + 0.5f)/nbins;
-	return fbin*delta + vmin;
-}
-
-/**
-	@brief Gets the most probable "1" level for a digital waveform
- */
-float Filter::GetTopVoltage(AnalogWaveform* cap)
-{
-	float vmin = GetMinVoltage(cap);
-	float vmax = GetMaxVoltage(cap);
-	float delta = vmax - vmin;
-	const int nbins = 100;
-	auto hist = MakeHistogram(cap, vmin, vmax, nbins);
+	base = (idx + 0.5f)/nbins*delta + vmin;
 
 	//Find the highest peak in the third quarter of the histogram
-	size_t binval = 0;
-	int idx = 0;
+	binval = 0;
+	idx = 0;
 	for(int i=(nbins*3)/4; i<nbins; i++)
 	{
 		if(hist[i] > binval)
@@ -1107,15 +1859,21 @@ float Filter::GetTopVoltage(AnalogWaveform* cap)
 			idx = i;
 		}
 	}
+	top = (idx + 0.5f)/nbins*delta + vmin;
 
-	float fbin = (idx + 0.5f)/nbins;
-	return fbin*delta + vmin;
+	lock_guard<mutex> lock(m_cacheMutex);
+	m_baseTopCache[cap->m_serial] = pair<uint64_t, pair<float, float> >(cap->m_revision, pair<float, float>(base, top));
 }
 
 void Filter::ClearAnalysisCache()
 {
 	lock_guard<mutex> lock(m_cacheMutex);
 	m_zeroCrossingCache.clear();
+	m_clockEdgeCache.clear();
+	m_levelCrossingCache.clear();
+	m_baseTopCache.clear();
+
+	Statistic::ClearAnalysisCache();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1128,7 +1886,8 @@ void Filter::ClearAnalysisCache()
 
 	@param din			Input waveform
 	@param stream		Stream index
-	@param clear		True to clear an existing waveform, false to leave it as-is
+	@param clear		True to clear an existing waveform, false to leave it as-is (unless its buffers are shared
+						with another waveform, in which case it gets fresh empty ones)
 
 	@return	The ready-to-use output waveform
  */
@@ -1154,6 +1913,20 @@ AnalogWaveform* Filter::SetupEmptyOutputWaveform(WaveformBase* din, size_t strea
 		cap->m_durations.clear();
 	}
 
+	//If a view downstream still shares our old buffers, start from fresh ones rather than having the next resize
+	//copy data we're about to overwrite
+	if(cap->m_samples.IsShared())
+		cap->m_samples.clear();
+	if(cap->m_offsets.IsShared() || cap->m_durations.IsShared())
+	{
+		cap->m_offsets.clear();
+		cap->m_durations.clear();
+		cap->m_densePacked = false;
+	}
+
+	//We're about to overwrite the waveform, so anything cached from its old content is invalid
+	cap->MarkModified();
+
 	return cap;
 }
 
@@ -1182,9 +1955,7 @@ DigitalWaveform* Filter::SetupEmptyDigitalOutputWaveform(WaveformBase* din, size
 	cap->m_startFemtoseconds	= din->m_startFemtoseconds;
 
 	//Clear output
-	cap->m_samples.clear();
-	cap->m_offsets.clear();
-	cap->m_durations.clear();
+	cap->clear();
 
 	return cap;
 }
@@ -1252,6 +2023,42 @@ AnalogWaveform* Filter::SetupOutputWaveform(WaveformBase* din, size_t stream, si
 	return cap;
 }
 
+/**
+	@brief Sets up a dense packed analog output waveform of a given length.
+
+	A new output waveform is created if necessary, but when possible the existing one is reused, and timestamps are
+	only written if they're not already correct. The caller is responsible for setting the timescale and trigger phase.
+
+	@param din			Input waveform (start time is copied from this)
+	@param stream		Stream index
+	@param len			Number of output samples
+
+	@return	The ready-to-use output waveform
+ */
+AnalogWaveform* Filter::SetupDenseOutputWaveform(WaveformBase* din, size_t stream, size_t len)
+{
+	auto cap = SetupEmptyOutputWaveform(din, stream, false);
+
+	size_t curlen = cap->m_offsets.size();
+	cap->Resize(len);
+
+	//Existing output is not dense packed. Need to fill from zero
+	if(!cap->m_densePacked)
+	{
+		cap->m_densePacked = true;
+		curlen = 0;
+	}
+
+	//Fill any new spots. If we're the same size or smaller, timestamps are already correct.
+	for(size_t i=curlen; i<len; i++)
+	{
+		cap->m_offsets[i]	= i;
+		cap->m_durations[i]	= 1;
+	}
+
+	return cap;
+}
+
 /**
 	@brief Sets up a digital output waveform and copies timebase configuration from the input.
 
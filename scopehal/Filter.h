@@ -118,7 +118,7 @@ public:
 
 	virtual bool NeedsConfig() =0;	//false if we can automatically do the decode from the signal w/ no configuration
 
-	void RefreshIfDirty();
+	virtual void RefreshIfDirty();
 	void RefreshInputsIfDirty();
 
 	void SetDirty()
@@ -192,6 +192,7 @@ protected:
 	AnalogWaveform* SetupEmptyOutputWaveform(WaveformBase* din, size_t stream, bool clear=true);
 	DigitalWaveform* SetupEmptyDigitalOutputWaveform(WaveformBase* din, size_t stream);
 	AnalogWaveform* SetupOutputWaveform(WaveformBase* din, size_t stream, size_t skipstart, size_t skipend);
+	AnalogWaveform* SetupDenseOutputWaveform(WaveformBase* din, size_t stream, size_t len);
 	DigitalWaveform* SetupDigitalOutputWaveform(WaveformBase* din, size_t stream, size_t skipstart, size_t skipend);
 
 public:
@@ -208,10 +209,14 @@ public:
 	//TODO: create some process for caching this so we don't waste CPU time
 	static float GetMinVoltage(AnalogWaveform* cap);
 	static float GetMaxVoltage(AnalogWaveform* cap);
+	static void GetMinMaxVoltage(AnalogWaveform* cap, float& vmin, float& vmax);
 	static float GetBaseVoltage(AnalogWaveform* cap);
 	static float GetTopVoltage(AnalogWaveform* cap);
+	static void GetBaseAndTopVoltage(AnalogWaveform* cap, float& base, float& top);
 	static float GetAvgVoltage(AnalogWaveform* cap);
 	static std::vector<size_t> MakeHistogram(AnalogWaveform* cap, float low, float high, size_t bins);
+	static std::vector<size_t> MakeHistogram(
+		AnalogWaveform* cap, float low, float high, size_t bins, float& vmin, float& vmax);
 	static std::vector<size_t> MakeHistogramClipped(AnalogWaveform* cap, float low, float high, size_t bins);
 
 	//Samples a digital channel on the edges of another channel.
@@ -221,10 +226,64 @@ public:
 	static void SampleOnRisingEdges(DigitalWaveform* data, DigitalWaveform* clock, DigitalWaveform& samples);
 	static void SampleOnRisingEdges(DigitalBusWaveform* data, DigitalWaveform* clock, DigitalBusWaveform& samples);
 	static void SampleOnFallingEdges(DigitalWaveform* data, DigitalWaveform* clock, DigitalWaveform& samples);
+	static void SampleOnFallingEdges(DigitalBusWaveform* data, DigitalWaveform* clock, DigitalBusWaveform& samples);
+
+	//Bitmask of clock edges to sample on
+	enum ClockEdgeType
+	{
+		CLOCK_EDGE_RISING	= 1,
+		CLOCK_EDGE_FALLING	= 2,
+		CLOCK_EDGE_ANY		= 3		//CLOCK_EDGE_RISING | CLOCK_EDGE_FALLING
+	};
+
+	//Conversion between one-bool-per-sample digital waveforms and packed bit vectors (LSB first)
+	static void PackBits(DigitalWaveform* wfm, size_t start, size_t count, uint64_t* out);
+	static void UnpackBits(const uint64_t* in, size_t count, DigitalWaveform* wfm, size_t start);
+
+	//Immutable, shareable list of edge timestamps
+	typedef std::shared_ptr< const std::vector<int64_t> > EdgeListPtr;
 
 	//Find interpolated zero crossings of a signal
 	static void FindRisingEdges(AnalogWaveform* data, float threshold, std::vector<int64_t>& edges);
 	static void FindZeroCrossings(AnalogWaveform* data, float threshold, std::vector<int64_t>& edges);
+	static EdgeListPtr FindZeroCrossings(AnalogWaveform* data, float threshold);
+
+	/**
+		@brief Interpolated crossings of an analog waveform through one voltage level
+	 */
+	class LevelCrossings
+	{
+	public:
+		///@brief A single crossing between samples m_index-1 and m_index
+		class Crossing
+		{
+		public:
+			Crossing(size_t index, double time)
+				: m_index(index)
+				, m_time(time)
+			{}
+
+			///@brief Index of the first sample past the level
+			size_t m_index;
+
+			///@brief Interpolated time of the crossing, in femtoseconds (not including trigger phase)
+			double m_time;
+		};
+
+		///@brief Crossings where the previous sample was <= the level and this one is above it
+		std::vector<Crossing> m_rising;
+
+		///@brief Crossings where the previous sample was >= the level and this one is below it
+		std::vector<Crossing> m_falling;
+	};
+	typedef std::shared_ptr<const LevelCrossings> LevelCrossingsPtr;
+
+	//Find crossings of several levels at once (cached)
+	static std::vector<LevelCrossingsPtr> GetLevelCrossings(AnalogWaveform* data, const std::vector<float>& levels);
+
+	//Find timestamps of clock edges, at the start of the sample (cached)
+	static EdgeListPtr GetClockEdges(DigitalWaveform* clock, ClockEdgeType type);
+	static void SetClockEdges(DigitalWaveform* clock, ClockEdgeType type, EdgeListPtr edges);
 
 	//Find edges in a signal (discarding repeated samples)
 	static void FindZeroCrossings(DigitalWaveform* data, std::vector<int64_t>& edges);
@@ -248,6 +307,126 @@ protected:
 	//Common text formatting
 	virtual std::string GetTextForAsciiChannel(int i, size_t stream);
 
+	//Sampling backend
+	template<class T>
+	static void SampleOnEdges(T* data, DigitalWaveform* clock, ClockEdgeType type, T& samples);
+
+	static void FindClockEdgesBlock(
+		DigitalWaveform* clock, ClockEdgeType type, size_t istart, size_t iend, std::vector<int64_t>& edges);
+
+	/**
+		@brief Advances a waveform to the last sample starting strictly before a given timestamp.
+
+		Equivalent to a linear walk forward from sample i, but uses galloping (exponential then binary) search so
+		that large gaps between the current position and the target cost O(log n) rather than O(n).
+
+		@param wfm			The waveform to search
+		@param i			Current position. Never moves backwards.
+		@param len			Number of samples in the waveform
+		@param timestamp	Target timestamp, in femtoseconds (including trigger phase)
+	 */
+	static size_t GallopToTimestamp(WaveformBase* wfm, size_t i, size_t len, int64_t timestamp)
+	{
+		//Exponential search for an upper bound
+		size_t lo = i;
+		size_t hi = i + 1;
+		size_t step = 1;
+		while( (hi < len) && (wfm->m_offsets[hi] * wfm->m_timescale + wfm->m_triggerPhase < timestamp) )
+		{
+			lo = hi;
+			step *= 2;
+			hi = lo + step;
+		}
+		if(hi > len)
+			hi = len;
+
+		//Binary search within the bracket
+		while(hi - lo > 1)
+		{
+			size_t mid = lo + (hi - lo)/2;
+			if(wfm->m_offsets[mid] * wfm->m_timescale + wfm->m_triggerPhase < timestamp)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+
+	//Bit packing backends
+	static void PackBitsGeneric(DigitalWaveform* wfm, size_t start, size_t count, uint64_t* out);
+	static void PackBitsAVX2(DigitalWaveform* wfm, size_t start, size_t count, uint64_t* out);
+	static void UnpackBitsGeneric(const uint64_t* in, size_t count, DigitalWaveform* wfm, size_t start);
+	static void UnpackBitsAVX2(const uint64_t* in, size_t count, DigitalWaveform* wfm, size_t start);
+
+	//Min/max search backends
+	static void GetMinMaxVoltageGeneric(const float* samples, size_t len, float& vmin, float& vmax);
+	static void GetMinMaxVoltageAVX2(const float* samples, size_t len, float& vmin, float& vmax);
+
+	//Histogram backends
+	static std::vector<size_t> MakeHistogramInternal(
+		AnalogWaveform* cap, float low, float high, size_t bins, bool clip, float& vmin, float& vmax);
+	static void MakeHistogramGeneric(
+		const float* samples, size_t len, float low, float delta, size_t bins, bool clip, size_t* hist,
+		float& vmin, float& vmax);
+	static void MakeHistogramAVX2(
+		const float* samples, size_t len, float low, float delta, size_t bins, bool clip, size_t* hist,
+		float& vmin, float& vmax);
+
+	//Zero crossing search backends
+	static void FindZeroCrossingsBlock(
+		AnalogWaveform* data, float threshold, size_t istart, size_t iend, std::vector<int64_t>& edges);
+	static void FindZeroCrossingsGeneric(
+		AnalogWaveform* data, float threshold, size_t istart, size_t iend, std::vector<int64_t>& edges);
+	static void FindZeroCrossingsAVX2(
+		AnalogWaveform* data, float threshold, size_t istart, size_t iend, std::vector<int64_t>& edges);
+	static void FindZeroCrossingsAVX512F(
+		AnalogWaveform* data, float threshold, size_t istart, size_t iend, std::vector<int64_t>& edges);
+
+	//Level crossing search backends
+	static void FindLevelCrossingsBlock(
+		AnalogWaveform* data,
+		const std::vector<float>& levels,
+		size_t istart,
+		size_t iend,
+		std::vector<LevelCrossings>& crossings);
+	static void FindLevelCrossingsGeneric(
+		AnalogWaveform* data,
+		const std::vector<float>& levels,
+		size_t istart,
+		size_t iend,
+		std::vector<LevelCrossings>& crossings);
+	static void FindLevelCrossingsAVX2(
+		AnalogWaveform* data,
+		const std::vector<float>& levels,
+		size_t istart,
+		size_t iend,
+		std::vector<LevelCrossings>& crossings);
+
+	/**
+		@brief Adds a crossing of a level between samples i-1 and i to a table
+	 */
+	static void AddLevelCrossing(AnalogWaveform* data, float level, size_t i, bool rising, LevelCrossings& crossings)
+	{
+		double t = (double)data->m_timescale * data->m_offsets[i-1] +
+			(double)InterpolateTime(data, i-1, level) * data->m_timescale;
+		if(rising)
+			crossings.m_rising.push_back(LevelCrossings::Crossing(i, t));
+		else
+			crossings.m_falling.push_back(LevelCrossings::Crossing(i, t));
+	}
+
+	/**
+		@brief Calculates the interpolated timestamp of a threshold crossing between samples i and i+1
+	 */
+	static int64_t GetZeroCrossingTimestamp(AnalogWaveform* data, float threshold, size_t i)
+	{
+		int64_t tfrac = data->m_timescale * InterpolateTime(data, i, threshold);
+		if(data->m_densePacked)
+			return data->m_triggerPhase + data->m_timescale*i + tfrac;
+		else
+			return data->m_triggerPhase + data->m_timescale*data->m_offsets[i] + tfrac;
+	}
+
 #ifdef HAVE_OPENCL
 
 	//OpenCL state
@@ -272,8 +451,14 @@ protected:
 	static std::set<Filter*> m_filters;
 
 	//Caching
+	//Zero crossings are keyed by (waveform serial number, threshold) and tagged with the waveform revision
 	static std::mutex m_cacheMutex;
-	static std::map<std::pair<WaveformBase*, float>, std::vector<int64_t> > m_zeroCrossingCache;
+	static std::map<std::pair<uint64_t, float>, std::pair<uint64_t, EdgeListPtr> > m_zeroCrossingCache;
+	static std::map<std::pair<uint64_t, int>, std::pair<uint64_t, EdgeListPtr> > m_clockEdgeCache;
+	static std::map<std::pair<uint64_t, float>, std::pair<uint64_t, LevelCrossingsPtr> > m_levelCrossingCache;
+
+	//Base and top levels are keyed by waveform serial number and tagged with the revision
+	static std::map<uint64_t, std::pair<uint64_t, std::pair<float, float> > > m_baseTopCache;
 };
 
 #define PROTOCOL_DECODER_INITPROC(T) \
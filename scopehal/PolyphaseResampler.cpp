@@ -0,0 +1,507 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* libscopehal v0.1                                                                                                     *
+*                                                                                                                      *
+* Copyright (c) 2012-2021 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of PolyphaseResampler
+ */
+
+#ifdef _WIN32
+#define _USE_MATH_DEFINES
+#include <cmath>
+#endif
+
+#include "scopehal.h"
+#include "PolyphaseResampler.h"
+#include <immintrin.h>
+#include <omp.h>
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+PolyphaseResampler::PolyphaseResampler()
+	: m_interpolation(1)
+	, m_decimation(1)
+	, m_center(0)
+	, m_taps(0)
+	, m_phaseStride(0)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Filter setup
+
+/**
+	@brief Sets the resampling ratio and prototype filter
+
+	The phase banks are only regenerated if something changed since the last call.
+
+	@param interpolation	Upsampling factor (L)
+	@param decimation		Downsampling factor (M)
+	@param kernel			Prototype FIR filter, at the upsampled rate. Must include any gain needed for interpolation.
+	@param center			Index of the tap aligned with the current sample (filter delay)
+ */
+void PolyphaseResampler::SetFilter(
+	size_t interpolation,
+	size_t decimation,
+	const vector<float>& kernel,
+	size_t center)
+{
+	interpolation = max(interpolation, (size_t)1);
+	decimation = max(decimation, (size_t)1);
+	if( (interpolation == m_interpolation) && (decimation == m_decimation) && (center == m_center) &&
+		(kernel == m_kernel) && !m_banks.empty() )
+	{
+		return;
+	}
+
+	m_interpolation = interpolation;
+	m_decimation = decimation;
+	m_center = center;
+	m_kernel = kernel;
+
+	//Bank p holds taps p, p+L, p+2L... in reverse order, zero padded at the start
+	size_t len = kernel.size();
+	size_t rawtaps = (len + interpolation - 1) / interpolation;
+	m_taps = max((size_t)8, (rawtaps + 7) & ~(size_t)7);
+	m_banks.resize(m_taps * interpolation);
+	for(size_t p=0; p<interpolation; p++)
+	{
+		for(size_t t=0; t<m_taps; t++)
+		{
+			size_t k = p + (m_taps - 1 - t)*interpolation;
+			m_banks[p*m_taps + t] = (k < len) ? kernel[k] : 0;
+		}
+	}
+
+	m_phaseStride = (interpolation + 7) & ~(size_t)7;
+	m_banksTransposed.resize(m_taps * m_phaseStride);
+	for(size_t t=0; t<m_taps; t++)
+	{
+		for(size_t p=0; p<m_phaseStride; p++)
+			m_banksTransposed[t*m_phaseStride + p] = (p < interpolation) ? m_banks[p*m_taps + t] : 0;
+	}
+}
+
+/**
+	@brief Generates a Blackman windowed sinc interpolation filter
+
+	The filter is exactly 1 at the center and 0 at every other multiple of the interpolation factor, so the original
+	samples pass through unchanged. Its center tap is interpolation*radius.
+
+	@param interpolation	Upsampling factor
+	@param radius			Number of input samples on each side of the center to use
+	@param kernel			Output kernel (2*interpolation*radius + 1 taps)
+ */
+void PolyphaseResampler::MakeWindowedSincKernel(size_t interpolation, size_t radius, vector<float>& kernel)
+{
+	size_t center = interpolation * radius;
+	size_t len = 2*center + 1;
+	kernel.resize(len);
+	for(size_t i=0; i<len; i++)
+	{
+		float x = (static_cast<float>(i) - center) / interpolation;
+		float sinc = 1;
+		if(fabs(x) > 1e-7)
+			sinc = sin(M_PI * x) / (M_PI * x);
+
+		float w = 2.0f * M_PI * i / (len - 1);
+		float blackman = 0.42 - 0.5*cos(w) + 0.08*cos(2*w);
+
+		kernel[i] = sinc * blackman;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Resampling
+
+/**
+	@brief Resamples a uniformly sampled signal
+
+	Input samples outside the buffer are treated as zero.
+
+	@param in		Input samples
+	@param inlen	Number of input samples
+	@param out		Output buffer
+	@param outlen	Number of output samples to generate
+ */
+void PolyphaseResampler::Process(const float* in, size_t inlen, float* out, size_t outlen)
+{
+	if( (outlen == 0) || m_banks.empty() )
+		return;
+
+	//Divide large waveforms (>1M points) into blocks and multithread them
+	size_t numblocks = 1;
+	if(outlen > 1000000)
+		numblocks = omp_get_max_threads();
+	size_t lastblock = numblocks - 1;
+	size_t blocksize = outlen / numblocks;
+
+	#pragma omp parallel for
+	for(size_t i=0; i<numblocks; i++)
+	{
+		size_t istart = i*blocksize;
+		size_t iend = (i == lastblock) ? outlen : istart + blocksize;
+
+		//Pure interpolation: every input sample produces a run of outputs using the same input window, so vectorize
+		//across phases rather than taps
+		if( (m_decimation == 1) && (m_interpolation > 1) && g_hasAvx2)
+			InterpolateBlockAVX2(in, inlen, out, istart, iend);
+		else if(g_hasAvx512F)
+			ProcessBlockAVX512F(in, inlen, out, istart, iend);
+		else if(g_hasAvx2)
+			ProcessBlockAVX2(in, inlen, out, istart, iend);
+		else
+			ProcessBlock(in, inlen, out, istart, iend);
+	}
+}
+
+/**
+	@brief Calculates one output sample whose filter extends past either end of the input
+ */
+float PolyphaseResampler::ProcessEdgeSample(const float* in, size_t inlen, const float* bank, int64_t base)
+{
+	float f = 0;
+	for(size_t t=0; t<m_taps; t++)
+	{
+		int64_t pos = base + t;
+		if( (pos >= 0) && (pos < (int64_t)inlen) )
+			f += bank[t] * in[pos];
+	}
+	return f;
+}
+
+void PolyphaseResampler::ProcessBlock(const float* in, size_t inlen, float* out, size_t istart, size_t iend)
+{
+	//Position of the first output in the upsampled stream, including the filter delay
+	size_t u = istart*m_decimation + m_center;
+	size_t phase = u % m_interpolation;
+	int64_t base = (int64_t)(u / m_interpolation) - (int64_t)m_taps + 1;
+	size_t phasestep = m_decimation % m_interpolation;
+	size_t basestep = m_decimation / m_interpolation;
+	int64_t lastbase = (int64_t)inlen - (int64_t)m_taps;
+
+	for(size_t i=istart; i<iend; i++)
+	{
+		const float* bank = &m_banks[phase * m_taps];
+		if( (base < 0) || (base > lastbase) )
+			out[i] = ProcessEdgeSample(in, inlen, bank, base);
+		else
+		{
+			const float* src = in + base;
+			float f = 0;
+			for(size_t t=0; t<m_taps; t++)
+				f += bank[t] * src[t];
+			out[i] = f;
+		}
+
+		base += basestep;
+		phase += phasestep;
+		if(phase >= m_interpolation)
+		{
+			phase -= m_interpolation;
+			base ++;
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+void PolyphaseResampler::ProcessBlockAVX2(const float* in, size_t inlen, float* out, size_t istart, size_t iend)
+{
+	size_t u = istart*m_decimation + m_center;
+	size_t phase = u % m_interpolation;
+	int64_t base = (int64_t)(u / m_interpolation) - (int64_t)m_taps + 1;
+	size_t phasestep = m_decimation % m_interpolation;
+	size_t basestep = m_decimation / m_interpolation;
+	int64_t lastbase = (int64_t)inlen - (int64_t)m_taps;
+
+	for(size_t i=istart; i<iend; i++)
+	{
+		const float* bank = &m_banks[phase * m_taps];
+		if( (base < 0) || (base > lastbase) )
+			out[i] = ProcessEdgeSample(in, inlen, bank, base);
+		else
+		{
+			//Banks are always a multiple of 8 taps long
+			const float* src = in + base;
+			__m256 sum = _mm256_setzero_ps();
+			for(size_t t=0; t<m_taps; t += 8)
+				sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_load_ps(bank + t), _mm256_loadu_ps(src + t)));
+
+			//Horizontal sum
+			__m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+			sum4 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+			sum4 = _mm_add_ss(sum4, _mm_shuffle_ps(sum4, sum4, 1));
+			out[i] = _mm_cvtss_f32(sum4);
+		}
+
+		base += basestep;
+		phase += phasestep;
+		if(phase >= m_interpolation)
+		{
+			phase -= m_interpolation;
+			base ++;
+		}
+	}
+}
+
+__attribute__((target("avx512f")))
+void PolyphaseResampler::ProcessBlockAVX512F(const float* in, size_t inlen, float* out, size_t istart, size_t iend)
+{
+	size_t u = istart*m_decimation + m_center;
+	size_t phase = u % m_interpolation;
+	int64_t base = (int64_t)(u / m_interpolation) - (int64_t)m_taps + 1;
+	size_t phasestep = m_decimation % m_interpolation;
+	size_t basestep = m_decimation / m_interpolation;
+	int64_t lastbase = (int64_t)inlen - (int64_t)m_taps;
+
+	//Banks are a multiple of 8 taps, so there's at most one half-width block at the end
+	size_t end16 = m_taps - (m_taps % 16);
+	bool tail = (end16 != m_taps);
+
+	for(size_t i=istart; i<iend; i++)
+	{
+		const float* bank = &m_banks[phase * m_taps];
+		if( (base < 0) || (base > lastbase) )
+			out[i] = ProcessEdgeSample(in, inlen, bank, base);
+		else
+		{
+			const float* src = in + base;
+			__m512 sum = _mm512_setzero_ps();
+			for(size_t t=0; t<end16; t += 16)
+				sum = _mm512_fmadd_ps(_mm512_loadu_ps(bank + t), _mm512_loadu_ps(src + t), sum);
+			if(tail)
+			{
+				sum = _mm512_fmadd_ps(
+					_mm512_maskz_loadu_ps(0xff, bank + end16),
+					_mm512_maskz_loadu_ps(0xff, src + end16),
+					sum);
+			}
+			out[i] = _mm512_reduce_add_ps(sum);
+		}
+
+		base += basestep;
+		phase += phasestep;
+		if(phase >= m_interpolation)
+		{
+			phase -= m_interpolation;
+			base ++;
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+void PolyphaseResampler::InterpolateBlockAVX2(const float* in, size_t inlen, float* out, size_t istart, size_t iend)
+{
+	int64_t lastbase = (int64_t)inlen - (int64_t)m_taps;
+	vector<float, AlignedAllocator<float, 64> > phases(m_phaseStride);
+	size_t fullchunks = m_interpolation - (m_interpolation % 8);
+
+	size_t u = istart + m_center;
+	size_t phase = u % m_interpolation;
+	int64_t base = (int64_t)(u / m_interpolation) - (int64_t)m_taps + 1;
+
+	size_t i = istart;
+	while(i < iend)
+	{
+		//All outputs in this run share the same input window
+		size_t runlen = min(m_interpolation - phase, iend - i);
+
+		if( (base < 0) || (base > lastbase) )
+		{
+			for(size_t j=0; j<runlen; j++)
+				out[i+j] = ProcessEdgeSample(in, inlen, &m_banks[(phase+j) * m_taps], base);
+		}
+
+		//Complete run: calculate 8 phases at a time and write straight to the output
+		else if(runlen == m_interpolation)
+		{
+			const float* src = in + base;
+			for(size_t p=0; p<m_phaseStride; p += 8)
+			{
+				const float* bank = &m_banksTransposed[p];
+				__m256 sum = _mm256_setzero_ps();
+				for(size_t t=0; t<m_taps; t++)
+				{
+					sum = _mm256_add_ps(sum, _mm256_mul_ps(
+						_mm256_load_ps(bank + t*m_phaseStride),
+						_mm256_broadcast_ss(src + t)));
+				}
+
+				if(p < fullchunks)
+					_mm256_storeu_ps(out + i + p, sum);
+				else
+				{
+					_mm256_store_ps(&phases[0], sum);
+					for(size_t j=p; j<m_interpolation; j++)
+						out[i+j] = phases[j-p];
+				}
+			}
+		}
+
+		//Partial run at the start or end of the block
+		else
+		{
+			for(size_t j=0; j<runlen; j++)
+			{
+				const float* bank = &m_banks[(phase+j) * m_taps];
+				float f = 0;
+				for(size_t t=0; t<m_taps; t++)
+					f += bank[t] * in[base + t];
+				out[i+j] = f;
+			}
+		}
+
+		i += runlen;
+		phase = 0;
+		base ++;
+	}
+}
+
+/**
+	@brief Resamples an arbitrarily sampled signal onto a uniform grid, with linear interpolation
+
+	Grid points before the first or after the last input sample take the value of that sample.
+
+	@param din		Input waveform
+	@param tstart	Time of the first output sample, in femtoseconds from the start of the waveform
+	@param tstep	Output sample interval, in femtoseconds
+	@param out		Output buffer
+	@param outlen	Number of output samples to generate
+ */
+void PolyphaseResampler::ResampleLinear(AnalogWaveform* din, int64_t tstart, int64_t tstep, float* out, size_t outlen)
+{
+	size_t len = din->m_samples.size();
+	if( (len == 0) || (outlen == 0) )
+		return;
+	int64_t timescale = din->m_timescale;
+	const float* samples = (const float*)&din->m_samples[0];
+
+	//Divide large waveforms (>1M points) into blocks and multithread them
+	size_t numblocks = 1;
+	if(outlen > 1000000)
+		numblocks = omp_get_max_threads();
+	size_t lastblock = numblocks - 1;
+	size_t blocksize = outlen / numblocks;
+
+	#pragma omp parallel for
+	for(size_t i=0; i<numblocks; i++)
+	{
+		size_t istart = i*blocksize;
+		size_t iend = (i == lastblock) ? outlen : istart + blocksize;
+
+		//Find the first input sample after the start of the block
+		int64_t t = tstart + istart*tstep;
+		size_t j = upper_bound(
+			din->m_offsets.begin(),
+			din->m_offsets.end(),
+			t,
+			[timescale](int64_t a, int64_t b) { return a < b*timescale; }) - din->m_offsets.begin();
+
+		for(size_t k=istart; k<iend; k++, t += tstep)
+		{
+			while( (j < len) && (din->m_offsets[j] * timescale <= t) )
+				j ++;
+
+			if(j == 0)
+				out[k] = samples[0];
+			else if(j == len)
+				out[k] = samples[len-1];
+			else
+			{
+				int64_t tleft = din->m_offsets[j-1] * timescale;
+				int64_t tright = din->m_offsets[j] * timescale;
+				float frac = static_cast<float>(t - tleft) / (tright - tleft);
+				out[k] = samples[j-1] + frac*(samples[j] - samples[j-1]);
+			}
+		}
+	}
+}
+
+/**
+	@brief Linearly interpolates a sparse waveform onto a uniform grid suitable for Process()
+
+	The grid step is the median spacing between input samples, so a handful of long gaps don't force a fine grid
+	across the whole waveform. If the grid would still be more than 16 times the input length, the
+	step is widened to keep memory bounded.
+
+	@param din		Input waveform
+	@param out		Output buffer, resized to the grid length
+	@param tstart	Time of the first grid point, in femtoseconds from the start of the waveform
+	@param tstep	Grid interval, in femtoseconds
+
+	@return Number of grid points
+ */
+size_t PolyphaseResampler::MakeUniformGrid(
+	AnalogWaveform* din,
+	std::vector<float, AlignedAllocator<float, 64> >& out,
+	int64_t& tstart,
+	int64_t& tstep)
+{
+	size_t len = din->m_samples.size();
+	if(len == 0)
+	{
+		out.clear();
+		tstart = 0;
+		tstep = din->m_timescale;
+		return 0;
+	}
+	tstart = din->m_offsets[0] * din->m_timescale;
+	int64_t span = din->m_offsets[len-1] - din->m_offsets[0];
+
+	//Median sample spacing, estimated from an evenly spaced subset of the input for speed
+	const size_t maxprobes = 4096;
+	size_t nprobes = min(len - 1, maxprobes);
+	int64_t step = 1;
+	if(nprobes > 0)
+	{
+		size_t stride = (len - 1) / nprobes;
+		vector<int64_t> deltas(nprobes);
+		for(size_t i=0; i<nprobes; i++)
+			deltas[i] = din->m_offsets[i*stride + 1] - din->m_offsets[i*stride];
+		nth_element(deltas.begin(), deltas.begin() + nprobes/2, deltas.end());
+		step = max((int64_t)1, deltas[nprobes/2]);
+	}
+
+	//Don't let a few outliers blow up the grid
+	const size_t maxexpansion = 16;
+	int64_t maxlen = len * maxexpansion;
+	if(span / step + 1 > maxlen)
+		step = (span + maxlen - 2) / (maxlen - 1);
+
+	size_t outlen = span / step + 1;
+	tstep = step * din->m_timescale;
+	out.resize(outlen);
+	ResampleLinear(din, tstart, tstep, &out[0], outlen);
+	return outlen;
+}
@@ -0,0 +1,102 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* libscopehal v0.1                                                                                                     *
+*                                                                                                                      *
+* Copyright (c) 2012-2021 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of PolyphaseResampler
+ */
+
+#ifndef PolyphaseResampler_h
+#define PolyphaseResampler_h
+
+#include "AlignedAllocator.h"
+
+/**
+	@brief Rational (L/M) FIR resampler
+
+	Logically, the input is upsampled by L (inserting zeroes), convolved with a prototype FIR filter, and decimated
+	by M. The prototype filter is split into L phase banks so only the taps that land on real input samples are
+	computed, and only for outputs which are actually kept.
+
+	Each output sample n is aligned to input sample n*M/L, so the prototype filter's delay is compensated.
+ */
+class PolyphaseResampler
+{
+public:
+	PolyphaseResampler();
+
+	void SetFilter(size_t interpolation, size_t decimation, const std::vector<float>& kernel, size_t center);
+
+	void Process(const float* in, size_t inlen, float* out, size_t outlen);
+
+	static void ResampleLinear(AnalogWaveform* din, int64_t tstart, int64_t tstep, float* out, size_t outlen);
+	static size_t MakeUniformGrid(
+		AnalogWaveform* din,
+		std::vector<float, AlignedAllocator<float, 64> >& out,
+		int64_t& tstart,
+		int64_t& tstep);
+
+	size_t GetInterpolation()
+	{ return m_interpolation; }
+
+	size_t GetDecimation()
+	{ return m_decimation; }
+
+	static void MakeWindowedSincKernel(size_t interpolation, size_t radius, std::vector<float>& kernel);
+
+protected:
+	void ProcessBlock(const float* in, size_t inlen, float* out, size_t istart, size_t iend);
+	void ProcessBlockAVX2(const float* in, size_t inlen, float* out, size_t istart, size_t iend);
+	void ProcessBlockAVX512F(const float* in, size_t inlen, float* out, size_t istart, size_t iend);
+	void InterpolateBlockAVX2(const float* in, size_t inlen, float* out, size_t istart, size_t iend);
+	float ProcessEdgeSample(const float* in, size_t inlen, const float* bank, int64_t base);
+
+	size_t m_interpolation;
+	size_t m_decimation;
+	size_t m_center;
+
+	///@brief Prototype filter the banks were generated from
+	std::vector<float> m_kernel;
+
+	///@brief Number of taps in each phase bank (padded to a multiple of 8)
+	size_t m_taps;
+
+	///@brief Phase banks, each stored time reversed so it can be applied to the input in forward order
+	std::vector<float, AlignedAllocator<float, 64> > m_banks;
+
+	///@brief Number of phases in each row of m_banksTransposed (padded to a multiple of 8)
+	size_t m_phaseStride;
+
+	///@brief Phase banks with tap as the major index, for computing all phases of one input sample at once
+	std::vector<float, AlignedAllocator<float, 64> > m_banksTransposed;
+};
+
+#endif
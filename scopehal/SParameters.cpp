@@ -34,6 +34,7 @@
  */
 #include "scopehal.h"
 #include <math.h>
+#include <immintrin.h>
 
 using namespace std;
 
@@ -169,6 +170,178 @@ float SParameterVector::InterpolateAngle(float frequency) const
 	return InterpolatePoint(frequency).m_phase;
 }
 
+/**
+	@brief Interpolates the S-parameters at a whole set of frequencies at once
+
+	Equivalent to calling InterpolatePoint() for each frequency, but much faster for large point counts (such as
+	resampling onto an FFT bin grid). Since the requested frequencies are sorted, the straddling points are found
+	with a single linear merge pass rather than a binary search per point. The interpolation itself is then done on
+	a structure-of-arrays copy of the data points so it can be vectorized.
+
+	@param frequencies	Frequencies to sample at, in ascending order
+	@param count		Number of frequencies
+	@param amplitudes	Output magnitudes
+	@param phases		Output phase angles
+ */
+void SParameterVector::InterpolatePoints(
+	const float* frequencies,
+	size_t count,
+	float* amplitudes,
+	float* phases) const
+{
+	size_t len = m_points.size();
+	if(len == 0)
+	{
+		for(size_t i=0; i<count; i++)
+		{
+			amplitudes[i] = 0;
+			phases[i] = 0;
+		}
+		return;
+	}
+
+	//Below the first point: use insertion loss of the lowest point, but interpolate phase to zero at time zero
+	auto& first = m_points[0];
+	size_t istart = 0;
+	for(; (istart < count) && (frequencies[istart] < first.m_frequency); istart ++)
+	{
+		amplitudes[istart] = first.m_amplitude;
+		phases[istart] = InterpolatePhase(0, first.m_phase, frequencies[istart] / first.m_frequency);
+	}
+
+	//Above the last point: clip to zero
+	float fmax = m_points[len-1].m_frequency;
+	size_t iend = count;
+	for(; (iend > istart) && (frequencies[iend-1] > fmax); iend --)
+	{
+		amplitudes[iend-1] = 0;
+		phases[iend-1] = 0;
+	}
+
+	size_t n = iend - istart;
+	if(n == 0)
+		return;
+
+	//Convert to structure-of-arrays format
+	vector<float> freqs(len);
+	vector<float> amps(len);
+	vector<float> angles(len);
+	for(size_t i=0; i<len; i++)
+	{
+		freqs[i] = m_points[i].m_frequency;
+		amps[i] = m_points[i].m_amplitude;
+		angles[i] = m_points[i].m_phase;
+	}
+
+	//Merge pass to find the points straddling each frequency, and how far between them it is
+	vector<uint32_t> indexes(n);
+	vector<float> fracs(n);
+	size_t lastlo = (len > 1) ? len-2 : 0;
+	size_t lo = 0;
+	for(size_t i=0; i<n; i++)
+	{
+		float f = frequencies[istart + i];
+		while( (lo < lastlo) && (freqs[lo+1] <= f) )
+			lo ++;
+		indexes[i] = lo;
+
+		float dfreq = 0;
+		if(len > 1)
+			dfreq = freqs[lo+1] - freqs[lo];
+		if(dfreq > FLT_EPSILON)
+			fracs[i] = (f - freqs[lo]) / dfreq;
+		else
+			fracs[i] = 0;
+	}
+
+	//A single point has nothing to interpolate to, so duplicate it
+	if(len == 1)
+	{
+		amps.push_back(amps[0]);
+		angles.push_back(angles[0]);
+	}
+
+	if(g_hasAvx2)
+		InterpolatePointsAVX2(&indexes[0], &fracs[0], &amps[0], &angles[0], n, amplitudes + istart, phases + istart);
+	else
+		InterpolatePointsGeneric(&indexes[0], &fracs[0], &amps[0], &angles[0], n, amplitudes + istart, phases + istart);
+}
+
+void SParameterVector::InterpolatePointsGeneric(
+	const uint32_t* indexes,
+	const float* fracs,
+	const float* amps,
+	const float* angles,
+	size_t count,
+	float* amplitudes,
+	float* phases) const
+{
+	for(size_t i=0; i<count; i++)
+	{
+		size_t lo = indexes[i];
+		float frac = fracs[i];
+
+		amplitudes[i] = amps[lo] + (amps[lo+1] - amps[lo])*frac;
+		phases[i] = InterpolatePhase(angles[lo], angles[lo+1], frac);
+	}
+}
+
+__attribute__((target("avx2")))
+void SParameterVector::InterpolatePointsAVX2(
+	const uint32_t* indexes,
+	const float* fracs,
+	const float* amps,
+	const float* angles,
+	size_t count,
+	float* amplitudes,
+	float* phases) const
+{
+	size_t end = count - (count % 8);
+
+	__m256 pi = _mm256_set1_ps(M_PI);
+	__m256 twopi = _mm256_set1_ps(2*M_PI);
+	__m256 absmask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+	size_t i=0;
+	for(; i<end; i += 8)
+	{
+		__m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indexes + i));
+		__m256 frac = _mm256_loadu_ps(fracs + i);
+
+		//Interpolate amplitude
+		__m256 amp_lo = _mm256_i32gather_ps(amps, lo, 4);
+		__m256 amp_hi = _mm256_i32gather_ps(amps + 1, lo, 4);
+		__m256 amp = _mm256_add_ps(amp_lo, _mm256_mul_ps(_mm256_sub_ps(amp_hi, amp_lo), frac));
+		_mm256_storeu_ps(amplitudes + i, amp);
+
+		//Wrap phases so we have a well defined linear range to interpolate
+		__m256 phase_lo = _mm256_i32gather_ps(angles, lo, 4);
+		__m256 phase_hi = _mm256_i32gather_ps(angles + 1, lo, 4);
+		__m256 wrap = _mm256_cmp_ps(_mm256_and_ps(_mm256_sub_ps(phase_lo, phase_hi), absmask), pi, _CMP_GE_OQ);
+		__m256 lo_lt_hi = _mm256_cmp_ps(phase_lo, phase_hi, _CMP_LT_OQ);
+		__m256 wrap_lo = _mm256_and_ps(wrap, lo_lt_hi);
+		__m256 wrap_hi = _mm256_andnot_ps(lo_lt_hi, wrap);
+		phase_lo = _mm256_add_ps(phase_lo, _mm256_and_ps(wrap_lo, twopi));
+		phase_hi = _mm256_add_ps(phase_hi, _mm256_and_ps(wrap_hi, twopi));
+
+		//Interpolate, then rescale if we went out of range
+		__m256 phase = _mm256_add_ps(phase_lo, _mm256_mul_ps(_mm256_sub_ps(phase_hi, phase_lo), frac));
+		__m256 over = _mm256_cmp_ps(phase, twopi, _CMP_GE_OQ);
+		phase = _mm256_sub_ps(phase, _mm256_and_ps(over, twopi));
+		_mm256_storeu_ps(phases + i, phase);
+	}
+
+	//Catch any stragglers
+	for(; i<count; i++)
+	{
+		size_t lo = indexes[i];
+		float frac = fracs[i];
+
+		amplitudes[i] = amps[lo] + (amps[lo+1] - amps[lo])*frac;
+		phases[i] = InterpolatePhase(angles[lo], angles[lo+1], frac);
+	}
+}
+
 /**
 	@brief Multiplies this vector by another set of S-parameters.
 
@@ -176,21 +349,28 @@ float SParameterVector::InterpolateAngle(float frequency) const
  */
 SParameterVector& SParameterVector::operator *=(const SParameterVector& rhs)
 {
+	//Sample the incident parameters at all of our frequencies in one pass
 	size_t len = m_points.size();
+	vector<float> freqs(len);
+	vector<float> amps(len);
+	vector<float> phases(len);
+	for(size_t i=0; i<len; i++)
+		freqs[i] = m_points[i].m_frequency;
+	rhs.InterpolatePoints(&freqs[0], len, &amps[0], &phases[0]);
+
 	for(size_t i=0; i<len; i++)
 	{
 		auto& us = m_points[i];
-		auto point = rhs.InterpolatePoint(us.m_frequency);
 
 		//Phases add mod +/- pi
-		us.m_phase += point.m_phase;
+		us.m_phase += phases[i];
 		if(us.m_phase < -M_PI)
 			us.m_phase += 2*M_PI;
 		if(us.m_phase > M_PI)
 			us.m_phase -= 2*M_PI;
 
 		//Amplitudes get multiplied
-		us.m_amplitude *= point.m_amplitude;
+		us.m_amplitude *= amps[i];
 	}
 
 	return *this;
@@ -72,6 +72,8 @@ public:
 	float InterpolateMagnitude(float frequency) const;
 	float InterpolateAngle(float frequency) const;
 
+	void InterpolatePoints(const float* frequencies, size_t count, float* amplitudes, float* phases) const;
+
 	std::vector<SParameterPoint> m_points;
 
 	float GetGroupDelay(size_t bin) const;
@@ -86,6 +88,24 @@ public:
 
 protected:
 	float InterpolatePhase(float phase_lo, float phase_hi, float frac) const;
+
+	void InterpolatePointsGeneric(
+		const uint32_t* indexes,
+		const float* fracs,
+		const float* amps,
+		const float* angles,
+		size_t count,
+		float* amplitudes,
+		float* phases) const;
+
+	void InterpolatePointsAVX2(
+		const uint32_t* indexes,
+		const float* fracs,
+		const float* amps,
+		const float* angles,
+		size_t count,
+		float* amplitudes,
+		float* phases) const;
 };
 
 typedef std::pair<int, int> SPair;
@@ -0,0 +1,387 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* libscopehal v0.1                                                                                                     *
+*                                                                                                                      *
+* Copyright (c) 2012-2021 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of SampleStatistics and QuantileSketch
+ */
+
+#include "scopehal.h"
+#include <immintrin.h>
+#include <omp.h>
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// SampleStatistics
+
+void SampleStatistics::Clear()
+{
+	m_count = 0;
+	m_mean = 0;
+	m_m2 = 0;
+	m_min = FLT_MAX;
+	m_max = -FLT_MAX;
+}
+
+/**
+	@brief Combines another set of statistics into this one
+ */
+void SampleStatistics::Merge(const SampleStatistics& rhs)
+{
+	if(rhs.m_count == 0)
+		return;
+	if(m_count == 0)
+	{
+		*this = rhs;
+		return;
+	}
+
+	double n = m_count + rhs.m_count;
+	double delta = rhs.m_mean - m_mean;
+	m_mean += delta * rhs.m_count / n;
+	m_m2 += rhs.m_m2 + delta*delta * (static_cast<double>(m_count) * rhs.m_count / n);
+	m_count += rhs.m_count;
+	m_min = min(m_min, rhs.m_min);
+	m_max = max(m_max, rhs.m_max);
+}
+
+/**
+	@brief Adds a buffer of samples
+ */
+void SampleStatistics::Add(const float* samples, size_t len)
+{
+	//Work in blocks small enough to stay in L1 cache for the second pass
+	const size_t blocksize = 4096;
+	for(size_t i=0; i<len; i += blocksize)
+	{
+		size_t n = min(blocksize, len - i);
+		if(g_hasAvx2)
+			AddBlockAVX2(samples + i, n);
+		else
+			AddBlockGeneric(samples + i, n);
+	}
+}
+
+void SampleStatistics::AddBlockGeneric(const float* samples, size_t len)
+{
+	SampleStatistics block;
+	block.m_count = len;
+
+	double sum = 0;
+	for(size_t i=0; i<len; i++)
+	{
+		float f = samples[i];
+		sum += f;
+		block.m_min = min(block.m_min, f);
+		block.m_max = max(block.m_max, f);
+	}
+	block.m_mean = sum / len;
+
+	for(size_t i=0; i<len; i++)
+	{
+		double d = samples[i] - block.m_mean;
+		block.m_m2 += d*d;
+	}
+
+	Merge(block);
+}
+
+__attribute__((target("avx2")))
+void SampleStatistics::AddBlockAVX2(const float* samples, size_t len)
+{
+	size_t end = len - (len % 8);
+
+	//First pass: sum and range
+	__m256d sum_lo = _mm256_setzero_pd();
+	__m256d sum_hi = _mm256_setzero_pd();
+	__m256 vmin = _mm256_set1_ps(FLT_MAX);
+	__m256 vmax = _mm256_set1_ps(-FLT_MAX);
+	for(size_t i=0; i<end; i += 8)
+	{
+		__m256 v = _mm256_loadu_ps(samples + i);
+		vmin = _mm256_min_ps(vmin, v);
+		vmax = _mm256_max_ps(vmax, v);
+		sum_lo = _mm256_add_pd(sum_lo, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+		sum_hi = _mm256_add_pd(sum_hi, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+	}
+
+	SampleStatistics block;
+	block.m_count = len;
+
+	double sums[4] __attribute__((aligned(32)));
+	float mins[8] __attribute__((aligned(32)));
+	float maxes[8] __attribute__((aligned(32)));
+	_mm256_store_pd(sums, _mm256_add_pd(sum_lo, sum_hi));
+	_mm256_store_ps(mins, vmin);
+	_mm256_store_ps(maxes, vmax);
+	double sum = sums[0] + sums[1] + sums[2] + sums[3];
+	for(size_t i=0; i<8; i++)
+	{
+		block.m_min = min(block.m_min, mins[i]);
+		block.m_max = max(block.m_max, maxes[i]);
+	}
+
+	//Get any extras we didn't get in the SIMD loop
+	for(size_t i=end; i<len; i++)
+	{
+		float f = samples[i];
+		sum += f;
+		block.m_min = min(block.m_min, f);
+		block.m_max = max(block.m_max, f);
+	}
+	block.m_mean = sum / len;
+
+	//Second pass: squared differences from the block mean
+	__m256d vmean = _mm256_set1_pd(block.m_mean);
+	__m256d m2_lo = _mm256_setzero_pd();
+	__m256d m2_hi = _mm256_setzero_pd();
+	for(size_t i=0; i<end; i += 8)
+	{
+		__m256 v = _mm256_loadu_ps(samples + i);
+		__m256d d_lo = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(v)), vmean);
+		__m256d d_hi = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)), vmean);
+		m2_lo = _mm256_add_pd(m2_lo, _mm256_mul_pd(d_lo, d_lo));
+		m2_hi = _mm256_add_pd(m2_hi, _mm256_mul_pd(d_hi, d_hi));
+	}
+	_mm256_store_pd(sums, _mm256_add_pd(m2_lo, m2_hi));
+	block.m_m2 = sums[0] + sums[1] + sums[2] + sums[3];
+	for(size_t i=end; i<len; i++)
+	{
+		double d = samples[i] - block.m_mean;
+		block.m_m2 += d*d;
+	}
+
+	Merge(block);
+}
+
+/**
+	@brief Calculates statistics for an entire waveform in a single pass
+ */
+SampleStatistics SampleStatistics::Calculate(AnalogWaveform* data)
+{
+	SampleStatistics ret;
+	size_t len = data->m_samples.size();
+	if(len == 0)
+		return ret;
+	const float* samples = (const float*)&data->m_samples[0];
+
+	//Divide large waveforms (>1M points) into blocks and multithread them
+	size_t numblocks = 1;
+	if(len > 1000000)
+		numblocks = omp_get_max_threads();
+	size_t lastblock = numblocks - 1;
+	size_t blocksize = len / numblocks;
+
+	vector<SampleStatistics> blockstats(numblocks);
+
+	#pragma omp parallel for
+	for(size_t i=0; i<numblocks; i++)
+	{
+		size_t istart = i*blocksize;
+		size_t iend = (i == lastblock) ? len : istart + blocksize;
+		blockstats[i].Add(samples + istart, iend - istart);
+	}
+
+	//Merge in order so the result doesn't depend on thread scheduling
+	for(auto& b : blockstats)
+		ret.Merge(b);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// QuantileSketch
+
+/**
+	@brief Creates an empty sketch
+
+	@param compression	Controls the size/accuracy tradeoff. The sketch holds roughly this many centroids.
+ */
+QuantileSketch::QuantileSketch(double compression)
+	: m_compression(compression)
+{
+	Clear();
+}
+
+void QuantileSketch::Clear()
+{
+	m_centroids.clear();
+	m_unmerged.clear();
+	m_totalWeight = 0;
+	m_min = DBL_MAX;
+	m_max = -DBL_MAX;
+}
+
+void QuantileSketch::Add(double value, double weight)
+{
+	m_unmerged.push_back(Centroid(value, weight));
+	m_min = min(m_min, value);
+	m_max = max(m_max, value);
+
+	if(m_unmerged.size() >= 8*m_compression)
+		Compress();
+}
+
+void QuantileSketch::Merge(const QuantileSketch& rhs)
+{
+	m_unmerged.insert(m_unmerged.end(), rhs.m_centroids.begin(), rhs.m_centroids.end());
+	m_unmerged.insert(m_unmerged.end(), rhs.m_unmerged.begin(), rhs.m_unmerged.end());
+	m_min = min(m_min, rhs.m_min);
+	m_max = max(m_max, rhs.m_max);
+	Compress();
+}
+
+/**
+	@brief Merges all pending values into the centroid list
+
+	Adjacent centroids are combined as long as the result stays under the size limit for its position in the
+	distribution, which shrinks towards zero at the tails.
+ */
+void QuantileSketch::Compress()
+{
+	if(m_unmerged.empty())
+		return;
+
+	m_unmerged.insert(m_unmerged.end(), m_centroids.begin(), m_centroids.end());
+	sort(m_unmerged.begin(), m_unmerged.end());
+
+	double total = 0;
+	for(auto& c : m_unmerged)
+		total += c.m_weight;
+
+	m_centroids.clear();
+	Centroid cur = m_unmerged[0];
+	double before = 0;
+	for(size_t i=1; i<m_unmerged.size(); i++)
+	{
+		auto& c = m_unmerged[i];
+		double proposed = cur.m_weight + c.m_weight;
+		double q0 = before / total;
+		double q2 = (before + proposed) / total;
+		double limit = 4 * total * min(q0 * (1-q0), q2 * (1-q2)) / m_compression;
+
+		if(proposed <= limit)
+		{
+			cur.m_mean += (c.m_mean - cur.m_mean) * c.m_weight / proposed;
+			cur.m_weight = proposed;
+		}
+		else
+		{
+			m_centroids.push_back(cur);
+			before += cur.m_weight;
+			cur = c;
+		}
+	}
+	m_centroids.push_back(cur);
+
+	m_unmerged.clear();
+	m_totalWeight = total;
+}
+
+/**
+	@brief Estimates the value at a given quantile
+
+	@param q	Quantile (0 = minimum, 0.5 = median, 1 = maximum)
+ */
+double QuantileSketch::GetQuantile(double q)
+{
+	Compress();
+	if(m_centroids.empty())
+		return 0;
+	if(m_centroids.size() == 1)
+		return m_centroids[0].m_mean;
+
+	//Interpolate between centroid centers (and the exact min/max at the ends)
+	double target = q * m_totalWeight;
+	double cum = 0;
+	for(size_t i=0; i<m_centroids.size(); i++)
+	{
+		auto& c = m_centroids[i];
+		double center = cum + c.m_weight/2;
+		if(target < center)
+		{
+			if(i == 0)
+				return m_min + (c.m_mean - m_min) * target / center;
+
+			auto& prev = m_centroids[i-1];
+			double prevcenter = cum - prev.m_weight/2;
+			double frac = (target - prevcenter) / (center - prevcenter);
+			return prev.m_mean + frac * (c.m_mean - prev.m_mean);
+		}
+		cum += c.m_weight;
+	}
+
+	auto& last = m_centroids[m_centroids.size() - 1];
+	double lastcenter = m_totalWeight - last.m_weight/2;
+	double frac = min(1.0, (target - lastcenter) / (m_totalWeight - lastcenter));
+	return last.m_mean + frac * (m_max - last.m_mean);
+}
+
+/**
+	@brief Builds a sketch of a waveform
+
+	Rather than inserting every sample, the waveform is binned into a fine histogram (one fast vectorized pass) and
+	each bin is added as a weighted value. This limits error to half a bin on top of the sketch's own error.
+
+	@param data	The waveform
+	@param vmin	Lowest value in the waveform
+	@param vmax	Highest value in the waveform
+ */
+QuantileSketch QuantileSketch::Calculate(AnalogWaveform* data, float vmin, float vmax)
+{
+	QuantileSketch ret;
+	size_t len = data->m_samples.size();
+	if(len == 0)
+		return ret;
+
+	//Constant signal
+	if(vmax <= vmin)
+	{
+		ret.Add(vmin, len);
+		ret.Compress();
+		return ret;
+	}
+
+	const size_t nbins = 4096;
+	auto hist = Filter::MakeHistogram(data, vmin, vmax, nbins);
+	float binsize = (vmax - vmin) / nbins;
+	for(size_t i=0; i<nbins; i++)
+	{
+		if(hist[i])
+			ret.Add(vmin + (i + 0.5f)*binsize, hist[i]);
+	}
+	ret.Compress();
+
+	//Ends are exact, not bin centers
+	ret.m_min = vmin;
+	ret.m_max = vmax;
+	return ret;
+}
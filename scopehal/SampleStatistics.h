@@ -0,0 +1,147 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* libscopehal v0.1                                                                                                     *
+*                                                                                                                      *
+* Copyright (c) 2012-2021 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of SampleStatistics and QuantileSketch
+ */
+
+#ifndef SampleStatistics_h
+#define SampleStatistics_h
+
+/**
+	@brief Count, mean, variance, and range of a set of samples
+
+	Each block of samples is reduced with a two-pass mean/variance while it's still in cache, and partial results
+	(from other blocks, threads, or waveforms) are combined with Chan's parallel form of Welford's update. Unlike a
+	running sum of squares this doesn't lose precision on deep captures or signals with a large DC offset.
+ */
+class SampleStatistics
+{
+public:
+	SampleStatistics()
+	{ Clear(); }
+
+	void Clear();
+	void Add(const float* samples, size_t len);
+	void Merge(const SampleStatistics& rhs);
+
+	static SampleStatistics Calculate(AnalogWaveform* data);
+
+	size_t GetCount() const
+	{ return m_count; }
+
+	double GetMean() const
+	{ return m_mean; }
+
+	///@brief Population variance
+	double GetVariance() const
+	{ return (m_count > 0) ? m_m2 / m_count : 0; }
+
+	double GetStdDev() const
+	{ return sqrt(GetVariance()); }
+
+	float GetMin() const
+	{ return m_min; }
+
+	float GetMax() const
+	{ return m_max; }
+
+protected:
+	void AddBlockGeneric(const float* samples, size_t len);
+	void AddBlockAVX2(const float* samples, size_t len);
+
+	size_t m_count;
+	double m_mean;
+
+	///@brief Sum of squared differences from the mean
+	double m_m2;
+
+	float m_min;
+	float m_max;
+};
+
+/**
+	@brief Approximate quantiles of a large data set (merging t-digest)
+
+	Values are clustered into a bounded number of weighted centroids, which are kept small near the tails so extreme
+	percentiles stay accurate. Sketches can be merged, so results can be accumulated across waveforms.
+ */
+class QuantileSketch
+{
+public:
+	QuantileSketch(double compression = 200);
+
+	void Clear();
+	void Add(double value, double weight = 1);
+	void Merge(const QuantileSketch& rhs);
+
+	double GetQuantile(double q);
+
+	double GetTotalWeight()
+	{
+		Compress();
+		return m_totalWeight;
+	}
+
+	static QuantileSketch Calculate(AnalogWaveform* data, float vmin, float vmax);
+
+protected:
+	void Compress();
+
+	class Centroid
+	{
+	public:
+		Centroid(double mean, double weight)
+		: m_mean(mean)
+		, m_weight(weight)
+		{}
+
+		bool operator<(const Centroid& rhs) const
+		{ return m_mean < rhs.m_mean; }
+
+		double m_mean;
+		double m_weight;
+	};
+
+	///@brief Merged centroids, sorted by mean
+	std::vector<Centroid> m_centroids;
+
+	///@brief Values added since the last Compress()
+	std::vector<Centroid> m_unmerged;
+
+	double m_compression;
+	double m_totalWeight;
+	double m_min;
+	double m_max;
+};
+
+#endif
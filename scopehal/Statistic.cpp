@@ -32,6 +32,8 @@
 using namespace std;
 
 Statistic::CreateMapType Statistic::m_createprocs;
+mutex Statistic::m_cacheMutex;
+map<uint64_t, Statistic::CacheEntry> Statistic::m_cache;
 
 Statistic::Statistic()
 {
@@ -60,3 +62,68 @@ Statistic* Statistic::CreateStatistic(string protocol)
 	LogError("Invalid statistic name\n");
 	return NULL;
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Shared analysis
+
+/**
+	@brief Gets count, mean, variance, and range of a waveform
+
+	The result is cached until the waveform is modified or ClearAnalysisCache() is called, so any number of statistics
+	on the same waveform only cost one pass over the sample data.
+ */
+SampleStatistics Statistic::GetSampleStatistics(AnalogWaveform* data)
+{
+	//Check cache
+	{
+		lock_guard<mutex> lock(m_cacheMutex);
+		auto it = m_cache.find(data->m_serial);
+		if( (it != m_cache.end()) && (it->second.m_revision == data->m_revision) )
+			return it->second.m_stats;
+	}
+
+	auto stats = SampleStatistics::Calculate(data);
+
+	//Add to cache, replacing any stale result from a previous revision
+	lock_guard<mutex> lock(m_cacheMutex);
+	auto& entry = m_cache[data->m_serial];
+	entry.m_revision = data->m_revision;
+	entry.m_stats = stats;
+	entry.m_hasSketch = false;
+	entry.m_sketch.Clear();
+	return stats;
+}
+
+/**
+	@brief Gets an approximate quantile sketch of a waveform
+
+	This needs the range of the waveform, so it also fills in the SampleStatistics cache entry. Cached the same way.
+ */
+QuantileSketch Statistic::GetQuantileSketch(AnalogWaveform* data)
+{
+	//Check cache
+	{
+		lock_guard<mutex> lock(m_cacheMutex);
+		auto it = m_cache.find(data->m_serial);
+		if( (it != m_cache.end()) && (it->second.m_revision == data->m_revision) && it->second.m_hasSketch)
+			return it->second.m_sketch;
+	}
+
+	auto stats = GetSampleStatistics(data);
+	auto sketch = QuantileSketch::Calculate(data, stats.GetMin(), stats.GetMax());
+
+	lock_guard<mutex> lock(m_cacheMutex);
+	auto it = m_cache.find(data->m_serial);
+	if( (it != m_cache.end()) && (it->second.m_revision == data->m_revision) )
+	{
+		it->second.m_hasSketch = true;
+		it->second.m_sketch = sketch;
+	}
+	return sketch;
+}
+
+void Statistic::ClearAnalysisCache()
+{
+	lock_guard<mutex> lock(m_cacheMutex);
+	m_cache.clear();
+}
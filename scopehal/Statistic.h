@@ -56,10 +56,30 @@ public:
 	static void EnumStatistics(std::vector<std::string>& names);
 	static Statistic* CreateStatistic(std::string measurement);
 
+	static void ClearAnalysisCache();
+
 protected:
+	//Shared per-waveform analysis, so several statistics on one stream only scan it once
+	static SampleStatistics GetSampleStatistics(AnalogWaveform* data);
+	static QuantileSketch GetQuantileSketch(AnalogWaveform* data);
+
 	//Class enumeration
 	typedef std::map< std::string, CreateProcType > CreateMapType;
 	static CreateMapType m_createprocs;
+
+	class CacheEntry
+	{
+	public:
+		uint64_t m_revision;
+		SampleStatistics m_stats;
+		bool m_hasSketch;
+		QuantileSketch m_sketch;
+	};
+
+	//Caching
+	//Results are keyed by waveform serial number and tagged with the waveform revision
+	static std::mutex m_cacheMutex;
+	static std::map<uint64_t, CacheEntry> m_cache;
 };
 
 #define STATISTIC_INITPROC(T) \
@@ -43,9 +43,6 @@ using namespace std;
 TestWaveformSource::TestWaveformSource(minstd_rand& rng)
 	: m_rng(rng)
 {
-	m_forwardPlan = NULL;
-	m_reversePlan = NULL;
-
 	m_cachedNumPoints = 0;
 	m_cachedRawSize = 0;
 
@@ -56,17 +53,10 @@ TestWaveformSource::TestWaveformSource(minstd_rand& rng)
 
 TestWaveformSource::~TestWaveformSource()
 {
-	if(m_forwardPlan)
-		ffts_free(m_forwardPlan);
-	if(m_reversePlan)
-		ffts_free(m_reversePlan);
-
 	m_allocator.deallocate(m_forwardInBuf);
 	m_allocator.deallocate(m_forwardOutBuf);
 	m_allocator.deallocate(m_reverseOutBuf);
 
-	m_forwardPlan = NULL;
-	m_reversePlan = NULL;
 	m_forwardInBuf = NULL;
 	m_forwardOutBuf = NULL;
 	m_reverseOutBuf = NULL;
@@ -320,13 +310,8 @@ void TestWaveformSource::DegradeSerialData(
 	size_t nouts = npoints/2 + 1;
 	if(m_cachedNumPoints != npoints)
 	{
-		if(m_forwardPlan)
-			ffts_free(m_forwardPlan);
-		m_forwardPlan = ffts_init_1d_real(npoints, FFTS_FORWARD);
-
-		if(m_reversePlan)
-			ffts_free(m_reversePlan);
-		m_reversePlan = ffts_init_1d_real(npoints, FFTS_BACKWARD);
+		m_forwardPlan.Reset(npoints, FFTS_FORWARD);
+		m_reversePlan.Reset(npoints, FFTS_BACKWARD);
 
 		m_forwardInBuf = m_allocator.allocate(npoints);
 		m_forwardOutBuf = m_allocator.allocate(2*nouts);
@@ -344,7 +329,7 @@ void TestWaveformSource::DegradeSerialData(
 			m_forwardInBuf[i] = 0;
 
 		//Do the forward FFT
-		ffts_execute(m_forwardPlan, &m_forwardInBuf[0], &m_forwardOutBuf[0]);
+		ffts_execute(m_forwardPlan.Get(), &m_forwardInBuf[0], &m_forwardOutBuf[0]);
 
 		//Simple channel response model
 		double sample_ghz = 1e6 / sampleperiod;
@@ -362,7 +347,7 @@ void TestWaveformSource::DegradeSerialData(
 		}
 
 		//Calculate the inverse FFT
-		ffts_execute(m_reversePlan, &m_forwardOutBuf[0], &m_reverseOutBuf[0]);
+		ffts_execute(m_reversePlan.Get(), &m_forwardOutBuf[0], &m_reverseOutBuf[0]);
 
 		//Rescale the FFT output and copy to the output, then add noise
 		float fftscale = 1.0f / npoints;
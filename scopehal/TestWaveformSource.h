@@ -37,7 +37,7 @@
 #define TestWaveformSource_h
 
 #include "../scopehal/AlignedAllocator.h"
-#include <ffts.h>
+#include "../scopehal/FFTPlanCache.h"
 #include <random>
 
 /**
@@ -101,8 +101,8 @@ protected:
 
 	//FFT stuff
 	AlignedAllocator<float, 32> m_allocator;
-	ffts_plan_t* m_forwardPlan;
-	ffts_plan_t* m_reversePlan;
+	FFTPlan m_forwardPlan;
+	FFTPlan m_reversePlan;
 	size_t m_cachedNumPoints;
 	size_t m_cachedRawSize;
 
@@ -37,6 +37,8 @@
 #define Waveform_h
 
 #include <vector>
+#include <atomic>
+#include <memory>
 #include <AlignedAllocator.h>
 
 /**
@@ -68,6 +70,134 @@ public:
 	T m_value;
 };
 
+/**
+	@brief A std::vector lookalike whose storage can be shared between waveforms
+
+	Copying a SharedVector copies the data, but Share() makes two vectors reference the same buffer in O(1). Anything
+	which can reallocate or change the size (resize, push_back, clear, etc.) first gives the vector its own copy of
+	the buffer if it's shared, so the other vector never sees the change.
+
+	Element access does NOT do this check, so that reading through a non-const waveform pointer stays as cheap as
+	with a plain std::vector. Code which overwrites samples in place without resizing first (and then calls
+	MarkModified()) changes the data seen by every waveform sharing the buffer. In practice this is what a view of
+	a waveform wants: it's refreshed after its source anyway.
+ */
+template<class T>
+class SharedVector
+{
+public:
+	typedef std::vector< T, AlignedAllocator<T, 64> > vector_type;
+	typedef typename vector_type::value_type value_type;
+	typedef typename vector_type::iterator iterator;
+	typedef typename vector_type::const_iterator const_iterator;
+
+	SharedVector()
+		: m_data(std::make_shared<vector_type>())
+	{}
+
+	SharedVector(const SharedVector& rhs)
+		: m_data(std::make_shared<vector_type>(*rhs.m_data))
+	{}
+
+	SharedVector& operator=(const SharedVector& rhs)
+	{
+		if(this != &rhs)
+			m_data = std::make_shared<vector_type>(*rhs.m_data);
+		return *this;
+	}
+
+	///@brief Makes this vector reference the same buffer as rhs, without copying
+	void Share(const SharedVector& rhs)
+	{ m_data = rhs.m_data; }
+
+	///@brief Returns true if another vector references the same buffer
+	bool IsShared() const
+	{ return m_data.use_count() > 1; }
+
+	operator const vector_type&() const
+	{ return *m_data; }
+
+	//Element access (never copies)
+	T& operator[](size_t i)
+	{ return (*m_data)[i]; }
+
+	const T& operator[](size_t i) const
+	{ return (*m_data)[i]; }
+
+	T* data()
+	{ return m_data->data(); }
+
+	const T* data() const
+	{ return m_data->data(); }
+
+	iterator begin()
+	{ return m_data->begin(); }
+
+	iterator end()
+	{ return m_data->end(); }
+
+	const_iterator begin() const
+	{ return m_data->begin(); }
+
+	const_iterator end() const
+	{ return m_data->end(); }
+
+	size_t size() const
+	{ return m_data->size(); }
+
+	bool empty() const
+	{ return m_data->empty(); }
+
+	//Modifiers (copy the buffer first if it's shared)
+	void resize(size_t size)
+	{
+		Detach();
+		m_data->resize(size);
+	}
+
+	void reserve(size_t size)
+	{
+		Detach();
+		m_data->reserve(size);
+	}
+
+	void push_back(const T& value)
+	{
+		Detach();
+		m_data->push_back(value);
+	}
+
+	void pop_back()
+	{
+		Detach();
+		m_data->pop_back();
+	}
+
+	void shrink_to_fit()
+	{
+		Detach();
+		m_data->shrink_to_fit();
+	}
+
+	void clear()
+	{
+		//No point copying data we're about to throw away
+		if(IsShared())
+			m_data = std::make_shared<vector_type>();
+		else
+			m_data->clear();
+	}
+
+protected:
+	void Detach()
+	{
+		if(IsShared())
+			m_data = std::make_shared<vector_type>(*m_data);
+	}
+
+	std::shared_ptr<vector_type> m_data;
+};
+
 /**
 	@brief Base class for all Waveform specializations
 
@@ -85,6 +215,8 @@ public:
 		, m_startFemtoseconds(0)
 		, m_triggerPhase(0)
 		, m_densePacked(false)
+		, m_serial(m_nextSerial ++)
+		, m_revision(0)
 	{}
 
 	//empty virtual destructor in case any derived classes need one
@@ -128,27 +260,48 @@ public:
 	bool m_densePacked;
 
 	///@brief Start timestamps of each sample
-	std::vector<
-		EmptyConstructorWrapper<int64_t>,
-		AlignedAllocator< EmptyConstructorWrapper<int64_t>, 64 >
-		> m_offsets;
+	SharedVector< EmptyConstructorWrapper<int64_t> > m_offsets;
 
 	///@brief Durations of each sample
-	std::vector<
-		EmptyConstructorWrapper<int64_t>,
-		AlignedAllocator< EmptyConstructorWrapper<int64_t>, 64 >
-		> m_durations;
+	SharedVector< EmptyConstructorWrapper<int64_t> > m_durations;
+
+	/**
+		@brief Unique identifier for this waveform object.
+
+		Unlike the object's address, serial numbers are never reused after a waveform is deleted, so they can safely
+		be used as keys in caches of derived data.
+	 */
+	const uint64_t m_serial;
+
+	/**
+		@brief Revision number of the waveform content.
+
+		Incremented every time the waveform is cleared, resized, or otherwise marked as modified. Code which caches
+		data derived from a waveform should store the revision it was computed from and discard the cached value if
+		the revision has changed.
+	 */
+	uint64_t m_revision;
+
+	/**
+		@brief Marks the waveform content as having changed, invalidating any cached analysis results.
+
+		Must be called by anything which modifies sample data in place without calling clear() or Resize().
+	 */
+	void MarkModified()
+	{ m_revision ++; }
 
 	virtual void clear()
 	{
 		m_offsets.clear();
 		m_durations.clear();
+		MarkModified();
 	}
 
 	virtual void Resize(size_t size)
 	{
 		m_offsets.resize(size);
 		m_durations.resize(size);
+		MarkModified();
 	}
 
 	/**
@@ -162,6 +315,24 @@ public:
 		memcpy((void*)&m_offsets[0], (void*)&rhs->m_offsets[0], len);
 		memcpy((void*)&m_durations[0], (void*)&rhs->m_durations[0], len);
 	}
+
+	/**
+		@brief Makes this waveform reference the timestamps of another one, without copying them.
+
+		The timescale and dense packing flag are copied too, since the timestamps are meaningless without them.
+	 */
+	void ShareTimestamps(const WaveformBase* rhs)
+	{
+		m_offsets.Share(rhs->m_offsets);
+		m_durations.Share(rhs->m_durations);
+		m_timescale = rhs->m_timescale;
+		m_densePacked = rhs->m_densePacked;
+		MarkModified();
+	}
+
+protected:
+	///@brief Next serial number to be allocated
+	static std::atomic<uint64_t> m_nextSerial;
 };
 
 /**
@@ -173,13 +344,29 @@ class Waveform : public WaveformBase
 public:
 
 	///@brief Sample data
-	std::vector< S, AlignedAllocator<S, 64> > m_samples;
+	SharedVector<S> m_samples;
+
+	/**
+		@brief Makes this waveform a view of another one, referencing its samples and timestamps without copying.
+
+		Only metadata (timescale, start time, trigger phase) is copied. The buffers stay shared until either
+		waveform resizes or clears them.
+	 */
+	void ShareFrom(const Waveform<S>* rhs)
+	{
+		m_samples.Share(rhs->m_samples);
+		ShareTimestamps(rhs);
+		m_startTimestamp = rhs->m_startTimestamp;
+		m_startFemtoseconds = rhs->m_startFemtoseconds;
+		m_triggerPhase = rhs->m_triggerPhase;
+	}
 
 	virtual void Resize(size_t size)
 	{
 		m_offsets.resize(size);
 		m_durations.resize(size);
 		m_samples.resize(size);
+		MarkModified();
 	}
 
 	virtual void clear()
@@ -187,6 +374,7 @@ public:
 		m_offsets.clear();
 		m_durations.clear();
 		m_samples.clear();
+		MarkModified();
 	}
 };
 
@@ -89,6 +89,8 @@ size_t g_maxClLocalSizeX = 0;
 
 AlignedAllocator<float, 32> g_floatVectorAllocator;
 
+atomic<uint64_t> WaveformBase::m_nextSerial(1);
+
 /**
 	@brief Static initialization for SCPI transports
  */
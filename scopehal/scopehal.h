@@ -41,6 +41,7 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <memory>
 #include <stdint.h>
 #include <chrono>
 #include <thread>
@@ -101,11 +102,13 @@
 #include "TouchstoneParser.h"
 #include "IBISParser.h"
 
+#include "SampleStatistics.h"
 #include "Statistic.h"
 #include "FilterParameter.h"
 #include "Filter.h"
 #include "ImportFilter.h"
 #include "PeakDetectionFilter.h"
+#include "ElementwiseFilter.h"
 #include "SpectrumChannel.h"
 #include "SParameterSourceFilter.h"
 #include "SParameterFilter.h"
@@ -136,8 +136,9 @@ void AutocorrelationFilter::Refresh()
 	}
 
 	//Calculate range of the output waveform
-	float x = GetMaxVoltage(cap);
-	float n = GetMinVoltage(cap);
+	float x;
+	float n;
+	GetMinMaxVoltage(cap, n, x);
 	m_range = x - n;
 	m_offset = (x+n)/2;
 
@@ -33,8 +33,7 @@ using namespace std;
 
 void AverageStatistic::Clear()
 {
-	m_pastSums.clear();
-	m_pastCounts.clear();
+	m_pastStats.clear();
 }
 
 string AverageStatistic::GetStatisticName()
@@ -49,25 +48,12 @@ bool AverageStatistic::Calculate(StreamDescriptor stream, double& value)
 	if(!data)
 		return false;
 
-	//Start integrating from the past value, if we have one
-	value = 0;
-	size_t count = 0;
-	if(m_pastSums.find(stream) != m_pastSums.end())
-	{
-		value = m_pastSums[stream];
-		count = m_pastCounts[stream];
-	}
-
-	//Add new sample data
-	for(auto sample : data->m_samples)
-		value += (float)sample;
-	count += data->m_samples.size();
-
-	//Average and save
-	m_pastCounts[stream] = count;
-	m_pastSums[stream] = value;
-
-	value /= count;
+	//Merge new sample data into the past values, if we have any
+	auto& stats = m_pastStats[stream];
+	stats.Merge(GetSampleStatistics(data));
+	if(stats.GetCount() == 0)
+		return false;
 
+	value = stats.GetMean();
 	return true;
 }
@@ -46,8 +46,7 @@ public:
 	STATISTIC_INITPROC(AverageStatistic)
 
 protected:
-	std::map<StreamDescriptor, double> m_pastSums;
-	std::map<StreamDescriptor, size_t> m_pastCounts;
+	std::map<StreamDescriptor, SampleStatistics> m_pastStats;
 };
 
 #endif
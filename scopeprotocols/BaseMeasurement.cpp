@@ -106,8 +106,9 @@ void BaseMeasurement::Refresh()
 	size_t len = din->m_samples.size();
 
 	//Make a histogram of the waveform
-	float vmin = GetMinVoltage(din);
-	float vmax = GetMaxVoltage(din);
+	float vmin;
+	float vmax;
+	GetMinMaxVoltage(din, vmin, vmax);
 	size_t nbins = 64;
 	vector<size_t> hist = MakeHistogram(din, vmin, vmax, nbins);
 
@@ -153,7 +153,7 @@ void CTLEFilter::Refresh()
 		(pole2 != m_cachedPole2Freq) )
 	{
 		//force re-interpolation of S-parameters
-		m_cachedBinSize = 0;
+		m_sparamVersion ++;
 
 		m_cachedDcGain = dcgain_db;
 		m_cachedZeroFreq = zfreq;
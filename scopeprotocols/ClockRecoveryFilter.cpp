@@ -29,6 +29,7 @@
 
 #include "../scopehal/scopehal.h"
 #include "scopeprotocols.h"
+#include <omp.h>
 
 using namespace std;
 
@@ -49,6 +50,20 @@ ClockRecoveryFilter::ClockRecoveryFilter(const string& color)
 	m_threshname = "Threshold";
 	m_parameters[m_threshname] = FilterParameter(FilterParameter::TYPE_FLOAT, Unit(Unit::UNIT_VOLTS));
 	m_parameters[m_threshname].SetFloatVal(0);
+
+	m_modename = "Parallel Mode";
+	m_parameters[m_modename] = FilterParameter(FilterParameter::TYPE_ENUM, Unit(Unit::UNIT_COUNTS));
+	m_parameters[m_modename].AddEnumValue("Serial", MODE_SERIAL);
+	m_parameters[m_modename].AddEnumValue("Segmented", MODE_SEGMENTED);
+	m_parameters[m_modename].SetIntVal(MODE_SERIAL);
+
+	m_overlapname = "Segment Overlap";
+	m_parameters[m_overlapname] = FilterParameter(FilterParameter::TYPE_INT, Unit(Unit::UNIT_COUNTS));
+	m_parameters[m_overlapname].SetIntVal(10000);
+
+	m_tolerancename = "Stitch Tolerance";
+	m_parameters[m_tolerancename] = FilterParameter(FilterParameter::TYPE_FLOAT, Unit(Unit::UNIT_UI));
+	m_parameters[m_tolerancename].SetFloatVal(0.01);
 }
 
 ClockRecoveryFilter::~ClockRecoveryFilter()
@@ -119,11 +134,16 @@ void ClockRecoveryFilter::Refresh()
 	auto gate = GetDigitalInputWaveform(1);
 
 	//Timestamps of the edges
-	vector<int64_t> edges;
+	EdgeListPtr pedges;
 	if(adin)
-		FindZeroCrossings(adin, m_parameters[m_threshname].GetFloatVal(), edges);
+		pedges = FindZeroCrossings(adin, m_parameters[m_threshname].GetFloatVal());
 	else
-		FindZeroCrossings(ddin, edges);
+	{
+		auto dedges = make_shared<vector<int64_t> >();
+		FindZeroCrossings(ddin, *dedges);
+		pedges = dedges;
+	}
+	auto& edges = *pedges;
 	if(edges.empty())
 	{
 		SetData(NULL, 0);
@@ -155,16 +175,60 @@ void ClockRecoveryFilter::Refresh()
 		tend = adin->m_offsets[adin->m_offsets.size() - 1] * adin->m_timescale;
 	else
 		tend = ddin->m_offsets[ddin->m_offsets.size() - 1] * ddin->m_timescale;
-	size_t nedge = 1;
-	//LogDebug("n, delta, period, freq_ghz\n");
-	int64_t edgepos = edges[0];
-	bool value = false;
 	int64_t total_error = 0;
-	cap->m_samples.reserve(edges.size());
+
+	//Gated clocks have to be recovered serially since the gate state depends on the full history
+	bool done = false;
+	if( (gate == NULL) && (m_parameters[m_modename].GetIntVal() == MODE_SEGMENTED) )
+		done = RunPLLSegmented(edges, tend, period, cap, total_error);
+	if(!done)
+	{
+		cap->m_offsets.reserve(edges.size());
+		cap->m_durations.reserve(edges.size());
+		RunPLL(edges, 0, edges.size(), tend, period, gate, *cap, total_error);
+	}
+
+	//Output is a square wave toggling on every recovered edge
+	size_t len = cap->m_offsets.size();
+	cap->m_samples.resize(len);
+	for(size_t i=0; i<len; i++)
+		cap->m_samples[i] = ((i & 1) == 0);
+
+	total_error /= edges.size();
+	LogTrace("average phase error %zu\n", total_error);
+
+	SetData(cap, 0);
+}
+
+/**
+	@brief Runs the PLL over a range of edges
+
+	@param edges		Timestamps of all input edges
+	@param nstart		Index of the edge to start the NCO at
+	@param nend			One past the index of the last edge to track
+	@param tend			Timestamp of the end of the input waveform
+	@param period		Initial NCO period
+	@param gate			Gating signal (may be NULL)
+	@param out			Waveform to append recovered clock edges to (offsets and durations only)
+	@param total_error	Accumulator for phase error
+ */
+void ClockRecoveryFilter::RunPLL(
+	const vector<int64_t>& edges,
+	size_t nstart,
+	size_t nend,
+	int64_t tend,
+	int64_t period,
+	DigitalWaveform* gate,
+	WaveformBase& out,
+	int64_t& total_error)
+{
+	size_t nedge = nstart + 1;
+	//LogDebug("n, delta, period, freq_ghz\n");
+	int64_t edgepos = edges[nstart];
 	size_t igate = 0;
 	bool gating = false;
 	int cycles_open_loop = 0;
-	for(; (edgepos < tend) && (nedge < edges.size()-1); edgepos += period)
+	for(; (edgepos < tend) && (nedge < nend-1); edgepos += period)
 	{
 		float center = period/2;
 
@@ -202,7 +266,7 @@ void ClockRecoveryFilter::Refresh()
 		//Allow multiple edges in the UI if the frequency is way off.
 		int64_t tnext = edges[nedge];
 		cycles_open_loop ++;
-		while( (tnext + center < edgepos) && (nedge+1 < edges.size()) )
+		while( (tnext + center < edgepos) && (nedge+1 < nend) )
 		{
 			//Find phase error
 			int64_t delta = (edgepos - tnext) - period;
@@ -238,16 +302,146 @@ void ClockRecoveryFilter::Refresh()
 		//Add the sample
 		if(!gating)
 		{
-			value = !value;
+			out.m_offsets.push_back(edgepos + period/2);
+			out.m_durations.push_back(period);
+		}
+	}
+}
 
-			cap->m_offsets.push_back(edgepos + period/2);
-			cap->m_durations.push_back(period);
-			cap->m_samples.push_back(value);
+/**
+	@brief Runs the PLL on independent segments of the edge list in parallel, then stitches the results together.
+
+	Each segment after the first starts its NCO "Segment Overlap" edges before its nominal start, so it has time to
+	lock while the previous segment is still producing output. Within this overlap, the last recovered edge of the
+	previous segment which agrees in phase with an edge of the new segment (to within "Stitch Tolerance" UI) is
+	used as the splice point.
+
+	@return True on success, false if the capture is too short to segment or no splice point could be found (in
+			which case the caller should fall back to serial recovery)
+ */
+bool ClockRecoveryFilter::RunPLLSegmented(
+	const vector<int64_t>& edges,
+	int64_t tend,
+	int64_t period,
+	DigitalWaveform* cap,
+	int64_t& total_error)
+{
+	size_t nedges = edges.size();
+	size_t overlap = max((int64_t)1, m_parameters[m_overlapname].GetIntVal());
+	int64_t tolerance = m_parameters[m_tolerancename].GetFloatVal() * period;
+
+	//Don't bother segmenting unless each segment is much larger than the overlap
+	size_t numsegs = min((size_t)omp_get_max_threads(), nedges / (4*overlap));
+	if(numsegs < 2)
+		return false;
+	size_t segsize = nedges / numsegs;
+
+	//Run each segment independently
+	vector<DigitalWaveform> segments(numsegs);
+	vector<int64_t> errors(numsegs, 0);
+	#pragma omp parallel for
+	for(size_t i=0; i<numsegs; i++)
+	{
+		//First segment starts from the beginning, the rest start early to lock during the overlap.
+		//All but the last segment stop just after the nominal start of the next segment.
+		size_t nstart = 0;
+		if(i > 0)
+			nstart = i*segsize - overlap;
+		size_t nend = nedges;
+		int64_t segend = tend;
+		if(i+1 < numsegs)
+		{
+			nend = (i+1)*segsize + 1;
+			segend = INT64_MAX;
 		}
+
+		RunPLL(edges, nstart, nend, segend, period, NULL, segments[i], errors[i]);
 	}
 
-	total_error /= edges.size();
-	LogTrace("average phase error %zu\n", total_error);
+	//Find splice points. Segment i contributes edges [firsts[i], lasts[i]) to the output.
+	vector<size_t> firsts(numsegs, 0);
+	vector<size_t> lasts(numsegs, 0);
+	lasts[numsegs-1] = segments[numsegs-1].m_offsets.size();
+	for(size_t i=1; i<numsegs; i++)
+	{
+		auto& prev = segments[i-1].m_offsets;
+		auto& next = segments[i].m_offsets;
 
-	SetData(cap, 0);
+		if(prev.empty() || next.empty())
+			return false;
+
+		//Walk both edge lists backwards from the end of the overlap, looking for pairs of edges that agree in phase.
+		//Don't go back past where the previous segment's contribution starts.
+		//If both loops reached exactly the same NCO state, everything after that point is bit-identical to a serial
+		//run, so take the latest such point. Otherwise use the latest pair with the closest NCO period.
+		auto& prevdur = segments[i-1].m_durations;
+		auto& nextdur = segments[i].m_durations;
+		size_t iprev = prev.size();
+		size_t inext = upper_bound(next.begin(), next.end(), prev[iprev-1] + tolerance) - next.begin();
+		size_t bestprev = 0;
+		size_t bestnext = 0;
+		int64_t bestdelta = INT64_MAX;
+		while( (iprev > firsts[i-1]) && (inext > 0) )
+		{
+			int64_t tprev = prev[iprev-1];
+			int64_t tnext = next[inext-1];
+			if(llabs(tprev - tnext) <= tolerance)
+			{
+				int64_t pdelta = llabs(prevdur[iprev-1] - nextdur[inext-1]);
+				if(pdelta < bestdelta)
+				{
+					bestprev = iprev;
+					bestnext = inext;
+					bestdelta = pdelta;
+				}
+
+				//Identical state, can't do any better than this
+				if( (tprev == tnext) && (pdelta == 0) )
+					break;
+			}
+
+			//Step back whichever list is later
+			if(tprev > tnext)
+				iprev --;
+			else
+				inext --;
+		}
+		if(bestdelta == INT64_MAX)
+		{
+			LogTrace("ClockRecoveryFilter: no splice point found between segments %zu and %zu\n", i-1, i);
+			return false;
+		}
+		iprev = bestprev;
+		inext = bestnext;
+
+		//Keep the previous segment's edge at the splice point, and start the new segment after it
+		lasts[i-1] = iprev;
+		firsts[i] = inext;
+	}
+
+	//Concatenate the segments
+	vector<size_t> outstarts(numsegs, 0);
+	size_t len = 0;
+	for(size_t i=0; i<numsegs; i++)
+	{
+		//Splice points crossed over (segment too short to lock), give up
+		if(lasts[i] < firsts[i])
+			return false;
+
+		outstarts[i] = len;
+		len += lasts[i] - firsts[i];
+	}
+	cap->Resize(len);
+	for(auto e : errors)
+		total_error += e;
+
+	#pragma omp parallel for
+	for(size_t i=0; i<numsegs; i++)
+	{
+		size_t n = lasts[i] - firsts[i];
+		memcpy(&cap->m_offsets[outstarts[i]], &segments[i].m_offsets[firsts[i]], n*sizeof(int64_t));
+		memcpy(&cap->m_durations[outstarts[i]], &segments[i].m_durations[firsts[i]], n*sizeof(int64_t));
+	}
+
+	return true;
 }
@@ -50,11 +50,37 @@ public:
 
 	virtual bool ValidateChannel(size_t i, StreamDescriptor stream);
 
+	enum ParallelMode
+	{
+		MODE_SERIAL,
+		MODE_SEGMENTED
+	};
+
 	PROTOCOL_DECODER_INITPROC(ClockRecoveryFilter)
 
 protected:
+	void RunPLL(
+		const std::vector<int64_t>& edges,
+		size_t nstart,
+		size_t nend,
+		int64_t tend,
+		int64_t period,
+		DigitalWaveform* gate,
+		WaveformBase& out,
+		int64_t& total_error);
+
+	bool RunPLLSegmented(
+		const std::vector<int64_t>& edges,
+		int64_t tend,
+		int64_t period,
+		DigitalWaveform* cap,
+		int64_t& total_error);
+
 	std::string m_baudname;
 	std::string m_threshname;
+	std::string m_modename;
+	std::string m_overlapname;
+	std::string m_tolerancename;
 };
 
 #endif
@@ -35,13 +35,11 @@
 #ifndef DCOffsetFilter_h
 #define DCOffsetFilter_h
 
-class DCOffsetFilter : public Filter
+class DCOffsetFilter : public ElementwiseFilter
 {
 public:
 	DCOffsetFilter(const std::string& color);
 
-	virtual void Refresh();
-
 	virtual bool NeedsConfig();
 
 	static std::string GetProtocolName();
@@ -54,7 +52,11 @@ public:
 	PROTOCOL_DECODER_INITPROC(DCOffsetFilter)
 
 protected:
+	virtual bool PrepareElementwise();
+	virtual void ProcessElementwise(float* out, const float* const* in, size_t len);
+
 	std::string m_offsetname;
+	float m_dcOffset;
 };
 
 #endif
@@ -66,13 +66,18 @@ DeEmbedFilter::DeEmbedFilter(const string& color)
 	m_max = -FLT_MAX;
 	m_cachedBinSize = 0;
 
-	m_forwardPlan = NULL;
-	m_reversePlan = NULL;
-
 	m_cachedNumPoints = 0;
 	m_cachedMaxGain = 0;
-	m_cachedMag = nullptr;
-	m_cachedAngle = nullptr;
+	m_cachedMagSerial = 0;
+	m_cachedAngleSerial = 0;
+	m_cachedMagRevision = 0;
+	m_cachedAngleRevision = 0;
+
+	m_sparamVersion = 1;
+	m_cachedGroupDelayVersion = 0;
+	m_cachedTruncMode = TRUNC_AUTO;
+	m_cachedTruncValue = 0;
+	m_cachedGroupDelay = 0;
 
 	m_magStartFemtoseconds = 0;
 	m_magStartTimestamp = 0;
@@ -184,14 +189,6 @@ DeEmbedFilter::~DeEmbedFilter()
 	m_fftoutbuf = NULL;
 	m_windowbuf = NULL;
 #endif
-
-	if(m_forwardPlan)
-		ffts_free(m_forwardPlan);
-	if(m_reversePlan)
-		ffts_free(m_reversePlan);
-
-	m_forwardPlan = NULL;
-	m_reversePlan = NULL;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -309,13 +306,8 @@ void DeEmbedFilter::DoRefresh(bool invert)
 	bool sizechange = false;
 	if(m_cachedNumPoints != npoints)
 	{
-		if(m_forwardPlan)
-			ffts_free(m_forwardPlan);
-		m_forwardPlan = ffts_init_1d_real(npoints, FFTS_FORWARD);
-
-		if(m_reversePlan)
-			ffts_free(m_reversePlan);
-		m_reversePlan = ffts_init_1d_real(npoints, FFTS_BACKWARD);
+		m_forwardPlan.Reset(npoints, FFTS_FORWARD);
+		m_reversePlan.Reset(npoints, FFTS_BACKWARD);
 
 		m_forwardInBuf.resize(npoints);
 		m_forwardOutBuf.resize(2 * nouts);
@@ -399,40 +391,38 @@ void DeEmbedFilter::DoRefresh(bool invert)
 	}
 
 	//Calculate size of each bin
-	double fs = din->m_timescale * (din->m_offsets[1] - din->m_offsets[0]);
+	int64_t sample_period = din->m_timescale * (din->m_offsets[1] - din->m_offsets[0]);
+	double fs = sample_period;
 	double sample_ghz = 1e6 / fs;
 	double bin_hz = round((0.5f * sample_ghz * 1e9f) / nouts);
 
 	//Did we change the max gain?
-	bool clipchange = false;
 	float maxgain = m_parameters[m_maxGainName].GetFloatVal();
 	if(maxgain != m_cachedMaxGain)
 	{
 		m_cachedMaxGain = maxgain;
-		clipchange = true;
 		ClearSweeps();
 	}
 
 	//Waveform object changed? Input parameters are no longer valid
 	//We need check for input count because CTLE filter generates S-params internally (and deletes the mag/angle inputs)
 	//TODO: would it be cleaner to generate filter response then channel-emulate it?
-	bool inchange = false;
 	if(GetInputCount() > 1)
 	{
+		bool inchange = false;
 		auto dmag = GetInput(1).GetData();
 		auto dang = GetInput(2).GetData();
-		if( (dmag != m_cachedMag) ||
-			(dang != m_cachedAngle) )
+		if( (dmag->m_serial != m_cachedMagSerial) ||
+			(dang->m_serial != m_cachedAngleSerial) ||
+			(dmag->m_revision != m_cachedMagRevision) ||
+			(dang->m_revision != m_cachedAngleRevision) )
 		{
 			inchange = true;
 
-			m_cachedMag = dmag;
-			m_cachedAngle = dang;
-
-			m_magStartTimestamp = dmag->m_startTimestamp;
-			m_magStartFemtoseconds = dmag->m_startFemtoseconds;
-			m_angleStartTimestamp = dang->m_startTimestamp;
-			m_angleStartFemtoseconds = dang->m_startFemtoseconds;
+			m_cachedMagSerial = dmag->m_serial;
+			m_cachedAngleSerial = dang->m_serial;
+			m_cachedMagRevision = dmag->m_revision;
+			m_cachedAngleRevision = dang->m_revision;
 		}
 
 		//Timestamp changed? Input parameters are no longer valid
@@ -442,13 +432,31 @@ void DeEmbedFilter::DoRefresh(bool invert)
 			(dang->m_startTimestamp != m_angleStartTimestamp))
 		{
 			inchange = true;
+
+			m_magStartTimestamp = dmag->m_startTimestamp;
+			m_magStartFemtoseconds = dmag->m_startFemtoseconds;
+			m_angleStartTimestamp = dang->m_startTimestamp;
+			m_angleStartFemtoseconds = dang->m_startFemtoseconds;
 		}
+
+		if(inchange)
+			m_sparamVersion ++;
 	}
 
-	//Resample our parameter to our FFT bin size if needed.
+	//Resample our parameter to our FFT bin size if anything it depends on changed.
+	//With a fixed sample rate and record length this only happens once, so the per-trigger work is just
+	//forward FFT, complex multiply, inverse FFT.
 	//Cache trig function output because there's no AVX instructions for this.
-	if( (fabs(m_cachedBinSize - bin_hz) > FLT_EPSILON) || sizechange || clipchange || inchange)
+	TransferFunctionKey key;
+	key.m_sparamVersion = m_sparamVersion;
+	key.m_npoints = npoints;
+	key.m_samplePeriod = sample_period;
+	key.m_maxGain = maxgain;
+	key.m_invert = invert;
+	if( (key != m_cachedTransferKey) || sizechange)
 	{
+		m_cachedTransferKey = key;
+
 		m_resampledSparamCosines.clear();
 		m_resampledSparamSines.clear();
 		InterpolateSparameters(bin_hz, invert, nouts);
@@ -538,7 +546,7 @@ void DeEmbedFilter::DoRefresh(bool invert)
 			m_forwardInBuf[i] = 0;
 
 		//Do the forward FFT
-		ffts_execute(m_forwardPlan, &m_forwardInBuf[0], &m_forwardOutBuf[0]);
+		ffts_execute(m_forwardPlan.Get(), &m_forwardInBuf[0], &m_forwardOutBuf[0]);
 
 		//Do the actual filter operation
 		if(g_hasAvx2)
@@ -547,16 +555,29 @@ void DeEmbedFilter::DoRefresh(bool invert)
 			MainLoop(nouts);
 
 		//Calculate the inverse FFT
-		ffts_execute(m_reversePlan, &m_forwardOutBuf[0], &m_reverseOutBuf[0]);
+		ffts_execute(m_reversePlan.Get(), &m_forwardOutBuf[0], &m_reverseOutBuf[0]);
 
 	#ifdef HAVE_CLFFT
 		}
 	#endif
 
 	//Calculate maximum group delay for the first few S-parameter bins (approx propagation delay of the channel)
-	int64_t groupdelay_fs = GetGroupDelay();
-	if(m_parameters[m_groupDelayTruncModeName].GetIntVal() == TRUNC_MANUAL)
-		groupdelay_fs = m_parameters[m_groupDelayTruncName].GetIntVal();
+	int truncmode = m_parameters[m_groupDelayTruncModeName].GetIntVal();
+	int64_t truncval = m_parameters[m_groupDelayTruncName].GetIntVal();
+	if( (m_cachedGroupDelayVersion != m_sparamVersion) ||
+		(m_cachedTruncMode != truncmode) ||
+		(m_cachedTruncValue != truncval) )
+	{
+		if(truncmode == TRUNC_MANUAL)
+			m_cachedGroupDelay = truncval;
+		else
+			m_cachedGroupDelay = GetGroupDelay();
+
+		m_cachedGroupDelayVersion = m_sparamVersion;
+		m_cachedTruncMode = truncmode;
+		m_cachedTruncValue = truncval;
+	}
+	int64_t groupdelay_fs = m_cachedGroupDelay;
 
 	int64_t groupdelay_samples = ceil( groupdelay_fs / din->m_timescale );
 
@@ -644,12 +665,18 @@ void DeEmbedFilter::InterpolateSparameters(float bin_hz, bool invert, size_t nou
 		dynamic_cast<AnalogWaveform*>(GetInput(1).GetData()),
 		dynamic_cast<AnalogWaveform*>(GetInput(2).GetData()));
 
+	//Resample onto the FFT bin grid
+	vector<float> freqs(nouts);
+	vector<float> mags(nouts);
+	vector<float> angles(nouts);
 	for(size_t i=0; i<nouts; i++)
-	{
-		float freq = bin_hz * i;
+		freqs[i] = bin_hz * i;
+	m_cachedSparams.InterpolatePoints(&freqs[0], nouts, &mags[0], &angles[0]);
 
-		float mag = m_cachedSparams.InterpolateMagnitude(freq);
-		float ang = m_cachedSparams.InterpolateAngle(freq);
+	for(size_t i=0; i<nouts; i++)
+	{
+		float mag = mags[i];
+		float ang = angles[i];
 
 		//De-embedding
 		if(invert)
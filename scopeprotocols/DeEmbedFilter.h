@@ -36,7 +36,7 @@
 #define DeEmbedFilter_h
 
 #include "../scopehal/AlignedAllocator.h"
-#include <ffts.h>
+#include "../scopehal/FFTPlanCache.h"
 
 #ifdef HAVE_CLFFT
 #include <clFFT.h>
@@ -78,20 +78,69 @@ protected:
 		TRUNC_MANUAL
 	};
 
+	/**
+		@brief Everything the resampled transfer function depends on
+
+		If none of these change between triggers, the per-bin multipliers can be reused as is.
+	 */
+	class TransferFunctionKey
+	{
+	public:
+		TransferFunctionKey()
+		: m_sparamVersion(0)
+		, m_npoints(0)
+		, m_samplePeriod(0)
+		, m_maxGain(0)
+		, m_invert(false)
+		{}
+
+		uint64_t m_sparamVersion;
+		size_t m_npoints;
+		int64_t m_samplePeriod;
+		float m_maxGain;
+		bool m_invert;
+
+		bool operator==(const TransferFunctionKey& rhs) const
+		{
+			return
+				(m_sparamVersion == rhs.m_sparamVersion) &&
+				(m_npoints == rhs.m_npoints) &&
+				(m_samplePeriod == rhs.m_samplePeriod) &&
+				(m_maxGain == rhs.m_maxGain) &&
+				(m_invert == rhs.m_invert);
+		}
+
+		bool operator!=(const TransferFunctionKey& rhs) const
+		{ return !(*this == rhs); }
+	};
+
 	float m_min;
 	float m_max;
 	float m_range;
 	float m_offset;
 	float m_cachedMaxGain;
-	WaveformBase* m_cachedMag;
-	WaveformBase* m_cachedAngle;
+	uint64_t m_cachedMagSerial;
+	uint64_t m_cachedAngleSerial;
+	uint64_t m_cachedMagRevision;
+	uint64_t m_cachedAngleRevision;
+
+	///Incremented whenever the S-parameters (or the response generated in their place) change
+	uint64_t m_sparamVersion;
+
+	TransferFunctionKey m_cachedTransferKey;
+
+	//Group delay is only recalculated when the S-parameters or truncation settings change
+	uint64_t m_cachedGroupDelayVersion;
+	int m_cachedTruncMode;
+	int64_t m_cachedTruncValue;
+	int64_t m_cachedGroupDelay;
 
 	double m_cachedBinSize;
 	std::vector<float, AlignedAllocator<float, 64> > m_resampledSparamSines;
 	std::vector<float, AlignedAllocator<float, 64> > m_resampledSparamCosines;
 
-	ffts_plan_t* m_forwardPlan;
-	ffts_plan_t* m_reversePlan;
+	FFTPlan m_forwardPlan;
+	FFTPlan m_reversePlan;
 	size_t m_cachedNumPoints;
 
 	std::vector<float, AlignedAllocator<float, 64> > m_forwardInBuf;
@@ -37,6 +37,8 @@ using namespace std;
 
 DeskewFilter::DeskewFilter(const string& color)
 	: Filter(OscilloscopeChannel::CHANNEL_TYPE_ANALOG, color, CAT_MATH)
+	, m_lastInputSerial(0)
+	, m_lastInputRevision(0)
 {
 	//Set up channels
 	CreateInput("din");
@@ -124,29 +126,28 @@ void DeskewFilter::Refresh()
 
 	//Get the input data
 	auto din = GetAnalogInputWaveform(0);
-	size_t len = din->m_samples.size();
 
-	//convert offset to time ticks
-	float offset = m_parameters[m_skewname].GetFloatVal();
-	int64_t toff = round(offset / din->m_timescale);
-
-	//Shift all of our samples
-	auto cap = new AnalogWaveform;
-	cap->Resize(len);
-	float* out = (float*)__builtin_assume_aligned(&cap->m_samples[0], 16);
-	float* a = (float*)__builtin_assume_aligned(&din->m_samples[0], 16);
-	int64_t* tout = (int64_t*)__builtin_assume_aligned(&cap->m_offsets[0], 16);
-	int64_t* ta = (int64_t*)__builtin_assume_aligned(&din->m_offsets[0], 16);
-	memcpy((void*)&cap->m_durations[0], (void*)&din->m_durations[0], len * sizeof(int64_t));
-	for(size_t i=0; i<len; i++)
+	//Shift the waveform by moving its trigger phase, rather than rewriting every timestamp.
+	//This also keeps sub-sample skew values instead of rounding to the nearest sample.
+	int64_t phase = din->m_triggerPhase + llround(m_parameters[m_skewname].GetFloatVal());
+
+	//If the input hasn't changed since we last looked at it, only the skew did
+	auto cap = dynamic_cast<AnalogWaveform*>(GetData(0));
+	if(cap && (din->m_serial == m_lastInputSerial) && (din->m_revision == m_lastInputRevision) )
 	{
-		out[i] 		= a[i];
-		tout[i]		= ta[i] + toff;
+		if(cap->m_triggerPhase != phase)
+		{
+			cap->m_triggerPhase = phase;
+			cap->MarkModified();
+		}
+		return;
 	}
-	SetData(cap, 0);
 
-	//Copy our time scales from the input
-	cap->m_timescale = din->m_timescale;
-	cap->m_startTimestamp = din->m_startTimestamp;
-	cap->m_startFemtoseconds = din->m_startFemtoseconds;
+	//Make the output a view of the input. Samples and timestamps are shared, not copied.
+	cap = SetupEmptyOutputWaveform(din, 0, false);
+	cap->ShareFrom(din);
+	cap->m_triggerPhase = phase;
+
+	m_lastInputSerial = din->m_serial;
+	m_lastInputRevision = din->m_revision;
 }
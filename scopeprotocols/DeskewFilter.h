@@ -55,6 +55,12 @@ public:
 
 protected:
 	std::string m_skewname;
+
+	///@brief Serial number of the input waveform our current output is a view of
+	uint64_t m_lastInputSerial;
+
+	///@brief Revision of the input waveform our current output is a view of
+	uint64_t m_lastInputRevision;
 };
 
 #endif
@@ -36,7 +36,8 @@ using namespace std;
 // Construction / destruction
 
 DivideFilter::DivideFilter(const string& color)
-	: Filter(OscilloscopeChannel::CHANNEL_TYPE_ANALOG, color, CAT_MATH)
+	: ElementwiseFilter(color, CAT_MATH)
+	, m_format(FORMAT_RATIO)
 	, m_formatName("Output Format")
 {
 	//Set up channels
@@ -113,50 +114,52 @@ void DivideFilter::ClearSweeps()
 	m_max = -FLT_MAX;
 }
 
-void DivideFilter::Refresh()
+bool DivideFilter::PrepareElementwise()
 {
-	//Make sure we've got valid inputs
-	if(!VerifyAllInputsOKAndAnalog())
-	{
-		SetData(NULL, 0);
-		return;
-	}
-
-	//Get the input data
-	auto a = GetAnalogInputWaveform(0);
-	auto b = GetAnalogInputWaveform(1);
-	auto len = min(a->m_samples.size(), b->m_samples.size());
-
-	//Set up the output waveform
-	auto cap = SetupOutputWaveform(a, 0, 0, 0);
+	m_format = static_cast<OutputFormat>(m_parameters[m_formatName].GetIntVal());
 
-	float* fa = (float*)__builtin_assume_aligned(&a->m_samples[0], 16);
-	float* fb = (float*)__builtin_assume_aligned(&b->m_samples[0], 16);
-	float* fdst = (float*)__builtin_assume_aligned(&cap->m_samples[0], 16);
-
-	auto format = m_parameters[m_formatName].GetIntVal();
-
-	if(format == FORMAT_RATIO)
+	if(m_format == FORMAT_RATIO)
 	{
 		SetYAxisUnits(Unit(Unit::UNIT_COUNTS), 0);
 
 		//Divide the units
 		//m_yAxisUnit = m_inputs[0].m_channel->GetYAxisUnits() / m_inputs[1].m_channel->GetYAxisUnits();
+	}
+	else
+		SetYAxisUnits(Unit(Unit::UNIT_DB), 0);
 
+	return true;
+}
+
+void DivideFilter::ProcessElementwise(float* out, const float* const* in, size_t len)
+{
+	const float* fa = (const float*)__builtin_assume_aligned(in[0], 64);
+	const float* fb = (const float*)__builtin_assume_aligned(in[1], 64);
+	float* fdst = (float*)__builtin_assume_aligned(out, 64);
+
+	if(m_format == FORMAT_RATIO)
+	{
 		for(size_t i=0; i<len; i++)
 			fdst[i] = fa[i] / fb[i];
 	}
-	else /*if(format == FORMAT_DB) */
+	else /*if(m_format == FORMAT_DB) */
 	{
-		SetYAxisUnits(Unit(Unit::UNIT_DB), 0);
-
 		for(size_t i=0; i<len; i++)
 			fdst[i] = 20 * log10(fa[i] / fb[i]);
 	}
+}
+
+void DivideFilter::Refresh()
+{
+	ElementwiseFilter::Refresh();
 
 	//Calculate range of the output waveform
-	float vmax = GetMaxVoltage(cap);
-	float vmin = GetMinVoltage(cap);
+	auto cap = dynamic_cast<AnalogWaveform*>(GetData(0));
+	if(!cap)
+		return;
+	float vmin;
+	float vmax;
+	GetMinMaxVoltage(cap, vmin, vmax);
 
 	//Calculate bounds
 	m_max = max(m_max, vmax);
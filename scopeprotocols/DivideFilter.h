@@ -35,7 +35,7 @@
 #ifndef DivideFilter_h
 #define DivideFilter_h
 
-class DivideFilter : public Filter
+class DivideFilter : public ElementwiseFilter
 {
 public:
 	DivideFilter(const std::string& color);
@@ -62,6 +62,11 @@ public:
 	};
 
 protected:
+	virtual bool PrepareElementwise();
+	virtual void ProcessElementwise(float* out, const float* const* in, size_t len);
+
+	OutputFormat m_format;
+
 	float m_min;
 	float m_max;
 	float m_range;
@@ -113,16 +113,15 @@ void DownsampleFilter::Refresh()
 	auto din = GetAnalogInputWaveform(0);
 	size_t len = din->m_samples.size();
 
-	//Set up output waveform and get configuration
-	int64_t factor = m_parameters[m_factorname].GetIntVal();
-	size_t outlen = len / factor;
-	auto cap = SetupEmptyOutputWaveform(din, 0, false);
+	//Get configuration
+	int64_t factor = max((int64_t)1, m_parameters[m_factorname].GetIntVal());
+	AnalogWaveform* cap = NULL;
+	int64_t tstart = 0;
+	int64_t tstep = din->m_timescale;
 
 	//Default path with antialiasing filter
 	if(m_parameters[m_aaname].GetBoolVal())
 	{
-		cap->Resize(outlen);
-
 		//Cut off all frequencies shorter than our decimation factor
 		float cutoff_period = factor;
 		float sigma = cutoff_period / sqrt(2 * log(2));
@@ -143,69 +142,32 @@ void DownsampleFilter::Refresh()
 			sum += k;
 		for(int i=0; i<kernel_size; i++)
 			kernel[i] /= sum;
+		m_resampler.SetFilter(1, factor, kernel, kernel_radius);
 
-		//Do the actual downsampling.
-		//For now, assume uniform sample rate
-		for(size_t i=0; i<outlen; i++)
+		//The filter needs uniformly spaced samples.
+		//If we don't have them, linearly interpolate onto a grid at the typical input sample spacing first.
+		const float* samples = (const float*)&din->m_samples[0];
+		if(!din->m_densePacked && (len > 0) )
 		{
-			//Copy timestamps
-			cap->m_offsets[i]	= din->m_offsets[i*factor] / factor;
-			cap->m_durations[i]	= din->m_durations[i*factor] / factor;
-
-			//Do the convolution
-			float conv = 0;
-			ssize_t base = i*factor;
-			for(ssize_t delta = -kernel_radius; delta <= kernel_radius; delta ++)
-			{
-				ssize_t pos = base + delta;
-				if( (pos < 0) || (pos >= (ssize_t)len) )
-					continue;
-
-				conv += din->m_samples[pos] * kernel[delta + kernel_radius];
-			}
-
-			//Do the actual decimation
-			cap->m_samples[i] 	= conv;
+			len = PolyphaseResampler::MakeUniformGrid(din, m_uniformSamples, tstart, tstep);
+			samples = &m_uniformSamples[0];
 		}
+
+		//Filter and decimate in one pass, only calculating the outputs we keep
+		size_t outlen = len / factor;
+		cap = SetupDenseOutputWaveform(din, 0, outlen);
+		m_resampler.Process(samples, len, (float*)&cap->m_samples[0], outlen);
 	}
 
 	//Optimized path with no AA if the input is known to not contain any higher frequency content
 	else
 	{
-		size_t oldlen = cap->m_samples.size();
-		cap->Resize(outlen);
+		size_t outlen = len / factor;
 
 		//Dense packed, optimize a bit.
-		//Timestamp stuff based on Filter::SetupOutputWaveform()
 		if(din->m_densePacked)
 		{
-			//Existing output is not dense packed. Need to fill from zero
-			if(!cap->m_densePacked)
-			{
-				cap->m_densePacked = true;
-				for(size_t i=0; i<outlen; i++)
-				{
-					cap->m_offsets[i]	= i;
-					cap->m_durations[i]	= 1;
-				}
-			}
-
-			//Both dense packed, but bigger? Fill extra spots
-			else if(outlen > oldlen)
-			{
-				for(size_t i=oldlen; i<outlen; i++)
-				{
-					cap->m_offsets[i]	= i;
-					cap->m_durations[i]	= 1;
-				}
-			}
-
-			//Same size or smaller than what we had before. Don't touch timestamps.
-			else
-			{
-			}
-
-			//Copy the output
+			cap = SetupDenseOutputWaveform(din, 0, outlen);
 			for(size_t i=0; i<outlen; i++)
 				cap->m_samples[i]	= din->m_samples[i*factor];
 		}
@@ -213,6 +175,9 @@ void DownsampleFilter::Refresh()
 		//Not dense packed, just copy stuff
 		else
 		{
+			cap = SetupEmptyOutputWaveform(din, 0, false);
+			cap->Resize(outlen);
+			cap->m_densePacked = false;
 			for(size_t i=0; i<outlen; i++)
 			{
 				cap->m_offsets[i]	= din->m_offsets[i*factor] / factor;
@@ -223,7 +188,8 @@ void DownsampleFilter::Refresh()
 	}
 
 	//Copy our time scales from the input
-	cap->m_timescale = din->m_timescale * factor;
+	cap->m_timescale = tstep * factor;
+	cap->m_triggerPhase = din->m_triggerPhase + tstart;
 	cap->m_startTimestamp = din->m_startTimestamp;
 	cap->m_startFemtoseconds = din->m_startFemtoseconds;
 }
@@ -35,6 +35,8 @@
 #ifndef DownsampleFilter_h
 #define DownsampleFilter_h
 
+#include "../scopehal/PolyphaseResampler.h"
+
 /**
 	@brief Downsample - low-pass filter and decimate a signal
  */
@@ -59,6 +61,9 @@ public:
 protected:
 	std::string m_factorname;
 	std::string m_aaname;
+
+	PolyphaseResampler m_resampler;
+	std::vector<float, AlignedAllocator<float, 64> > m_uniformSamples;
 };
 
 #endif
@@ -121,9 +121,9 @@ void DramClockFilter::Refresh()
 
 	//Find edges in the DQS signal (double rate so we want both polarity)
 	//TODO: support differential DQS for DDR2/3
-	vector<int64_t> edges;
 	float thresh = m_parameters[m_dqsthreshname].GetFloatVal();
-	FindZeroCrossings(dqs, thresh, edges);
+	auto pedges = FindZeroCrossings(dqs, thresh);
+	auto& edges = *pedges;
 
 	//Find edges in the CLK signal
 	//TODO: support analog clock too?
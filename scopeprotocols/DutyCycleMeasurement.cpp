@@ -122,8 +122,8 @@ void DutyCycleMeasurement::Refresh()
 	float midpoint = GetAvgVoltage(din);
 
 	//Timestamps of the edges
-	vector<int64_t> edges;
-	FindZeroCrossings(din, midpoint, edges);
+	auto pedges = FindZeroCrossings(din, midpoint);
+	auto& edges = *pedges;
 	if(edges.size() < 2)
 	{
 		SetData(NULL, 0);
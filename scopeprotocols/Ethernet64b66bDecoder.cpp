@@ -35,6 +35,7 @@
 
 #include "../scopehal/scopehal.h"
 #include "Ethernet64b66bDecoder.h"
+#include <omp.h>
 
 using namespace std;
 
@@ -96,98 +97,165 @@ void Ethernet64b66bDecoder::Refresh()
 	auto din = GetDigitalInputWaveform(0);
 	auto clkin = GetDigitalInputWaveform(1);
 
-	//Create the capture
-	auto cap = new Ethernet64b66bWaveform;
-	cap->m_timescale = 1;
-	cap->m_startTimestamp = din->m_startTimestamp;
-	cap->m_startFemtoseconds = din->m_startFemtoseconds;
-
 	//Record the value of the data stream at each clock edge
 	DigitalWaveform data;
 	SampleOnAnyEdges(din, clkin, data);
 
-	//Look at each phase and figure out block alignment
-	size_t end = data.m_offsets.size() - 66;
-	size_t best_offset = 0;
-	size_t best_errors = end;
-	for(size_t offset=0; offset < 66; offset ++)
+	//Need at least two blocks (one to prime the scrambler and one to decode)
+	size_t len = data.m_offsets.size();
+	if(len < 3*66)
 	{
-		size_t errors = 0;
-		for(size_t i=offset; i<end; i+= 66)
-		{
-			if(data.m_samples[i] == data.m_samples[i+1])
-				errors ++;
-		}
-
-		if(errors < best_errors)
-		{
-			best_offset = offset;
-			best_errors = errors;
-		}
+		SetData(NULL, 0);
+		return;
 	}
 
+	//Pack the sampled bits into words (with a zero word of padding at the end for unaligned extraction)
+	size_t nwords = (len + 63) / 64;
+	vector<uint64_t> bits(nwords + 1, 0);
+	PackBits(&data, 0, len, &bits[0]);
+
+	//Figure out block alignment
+	size_t end = len - 66;
+	size_t best_offset = FindBlockAlignment(bits, end);
 
-	//Decode the actual data
-	bool first		= true;
-	uint64_t lfsr	= 0;
+	//Create the capture
+	auto cap = new Ethernet64b66bWaveform;
+	cap->m_timescale = 1;
+	cap->m_startTimestamp = din->m_startTimestamp;
+	cap->m_startFemtoseconds = din->m_startFemtoseconds;
 
-	for(size_t i=best_offset; i<end; i += 66)
+	//Extract 64 bits starting at an arbitrary bit position (first bit in the LSB)
+	auto extract = [&bits](size_t pos)
 	{
+		size_t q = pos >> 6;
+		size_t r = pos & 63;
+		if(r == 0)
+			return bits[q];
+		return (bits[q] >> r) | (bits[q+1] << (64 - r));
+	};
+
+	//The first block just primes the scrambler, we can't decode it
+	size_t nblocks = (end - best_offset + 65) / 66;
+	size_t nsymbols = nblocks - 1;
+	cap->Resize(nsymbols);
+
+	//Decode the actual data.
+	//The descrambler is self-synchronizing (x^58 + x^39 + 1) so each output bit depends only on the current and
+	//previous 58 scrambled bits. This means each block can be descrambled 64 bits at a time using only its own
+	//payload and that of the previous block, with no serial dependency between blocks.
+	#pragma omp parallel for
+	for(size_t n=0; n<nsymbols; n++)
+	{
+		size_t i = best_offset + (n+1)*66;
+
 		//Extract the header bits
-		uint8_t header =
-			(data.m_samples[i] ? 2 : 0) |
-			(data.m_samples[i+1] ? 1 : 0);
+		uint64_t raw = extract(i);
+		uint8_t header = ((raw & 1) << 1) | ((raw >> 1) & 1);
 
 		//Extract the data bits and descramble them.
-		uint64_t codeword = 0;
-		for(size_t j=0; j<64; j++)
-		{
-			bool b = data.m_samples[i + 2 + j];
+		uint64_t prev = extract(i - 64);
+		uint64_t cur = extract(i + 2);
+		uint64_t codeword = cur ^ ( (cur << 39) | (prev >> 25) ) ^ ( (cur << 58) | (prev >> 6) );
+
+		//Need to swap bit/byte ordering around a bunch.
+		codeword = __builtin_bswap64(codeword);
 
-			codeword >>= 1;
-			if(b ^ ( (lfsr >> 38) & 1) ^ ( (lfsr >> 57) & 1) )
-				codeword |= 0x8000000000000000L;
+		//Process descrambled data
+		cap->m_offsets[n] = data.m_offsets[i] - data.m_durations[i]/2;
+		cap->m_durations[n] = data.m_offsets[i+66] - data.m_offsets[i];
+		cap->m_samples[n] = Ethernet64b66bSymbol(header, codeword);
+	}
+
+	SetData(cap, 0);
+}
+
+/**
+	@brief Finds the offset (0-65) of block boundaries in the data stream
+
+	Every valid block starts with a 01 or 10 sync header, so the correct alignment is the one with the fewest pairs of
+	identical adjacent bits at block boundaries.
+
+	All 66 alignments are checked at once: XORing the data stream with itself shifted by one bit gives a word with a
+	bit set at every sync error candidate. Since 33 words span exactly 32 blocks, each bit of each word in a group of 33
+	always maps to the same alignment, so the errors are tallied using bit-sliced vertical counters (one per word slot)
+	and only mapped back to alignments once at the end.
+
+	@param bits		Packed data, with at least one word of padding at the end
+	@param end		Number of candidate header positions to check
+ */
+size_t Ethernet64b66bDecoder::FindBlockAlignment(const vector<uint64_t>& bits, size_t end)
+{
+	const size_t slots = 33;
+	const size_t planes = 32;
+
+	size_t nwords = (end + 63) / 64;
+	size_t ngroups = (nwords + slots - 1) / slots;
+
+	size_t errors[66] = {0};
+	#pragma omp parallel
+	{
+		uint64_t counters[slots][planes] = {{0}};
 
-			lfsr = (lfsr << 1) | b;
+		#pragma omp for nowait
+		for(size_t g=0; g<ngroups; g++)
+		{
+			for(size_t w=0; w<slots; w++)
+			{
+				size_t q = g*slots + w;
+				if(q >= nwords)
+					break;
+
+				//Bit j is set if bits j and j+1 are identical
+				uint64_t next = (bits[q] >> 1) | (bits[q+1] << 63);
+				uint64_t err = ~(bits[q] ^ next);
+
+				//Ignore anything past the end of the search window
+				size_t base = q*64;
+				if(base + 64 > end)
+					err &= (1ULL << (end - base)) - 1;
+
+				//Ripple-carry add into the counter for this slot
+				uint64_t carry = err;
+				for(size_t k=0; (k<planes) && carry; k++)
+				{
+					uint64_t t = counters[w][k] & carry;
+					counters[w][k] ^= carry;
+					carry = t;
+				}
+			}
 		}
 
-		//Need to swap bit/byte ordering around a bunch.
-		uint64_t bytes[8] =
+		//Convert the counters back to per-alignment totals
+		size_t localerrors[66] = {0};
+		for(size_t w=0; w<slots; w++)
 		{
-			(codeword >> 56) & 0xff,
-			(codeword >> 48) & 0xff,
-			(codeword >> 40) & 0xff,
-			(codeword >> 32) & 0xff,
-			(codeword >> 24) & 0xff,
-			(codeword >> 16) & 0xff,
-			(codeword >> 8) & 0xff,
-			(codeword >> 0) & 0xff,
-		};
-
-		codeword =
-			(bytes[7] << 56) |
-			(bytes[6] << 48) |
-			(bytes[5] << 40) |
-			(bytes[4] << 32) |
-			(bytes[3] << 24) |
-			(bytes[2] << 16) |
-			(bytes[1] << 8) |
-			bytes[0];
-
-		//Just prime the scrambler, we can't decode yet
-		if(first)
-			first = false;
+			for(size_t j=0; j<64; j++)
+			{
+				size_t count = 0;
+				for(size_t k=0; k<planes; k++)
+					count |= ((counters[w][k] >> j) & 1) << k;
+				localerrors[(w*64 + j) % 66] += count;
+			}
+		}
 
-		//Process descrambled data
-		else
+		#pragma omp critical
 		{
-			cap->m_offsets.push_back(data.m_offsets[i] - data.m_durations[i]/2);
-			cap->m_durations.push_back(data.m_offsets[i+66] - data.m_offsets[i]);
-			cap->m_samples.push_back(Ethernet64b66bSymbol(header, codeword));
+			for(size_t i=0; i<66; i++)
+				errors[i] += localerrors[i];
 		}
 	}
 
-	SetData(cap, 0);
+	size_t best_offset = 0;
+	size_t best_errors = end;
+	for(size_t offset=0; offset < 66; offset ++)
+	{
+		if(errors[offset] < best_errors)
+		{
+			best_offset = offset;
+			best_errors = errors[offset];
+		}
+	}
+	return best_offset;
 }
 
 Gdk::Color Ethernet64b66bDecoder::GetColor(int i)
@@ -77,6 +77,7 @@ public:
 	PROTOCOL_DECODER_INITPROC(Ethernet64b66bDecoder)
 
 protected:
+	static size_t FindBlockAlignment(const std::vector<uint64_t>& bits, size_t end);
 };
 
 #endif
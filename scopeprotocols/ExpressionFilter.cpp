@@ -0,0 +1,711 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* libscopeprotocols                                                                                                    *
+*                                                                                                                      *
+* Copyright (c) 2012-2021 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+#include "../scopehal/scopehal.h"
+#include "../scopehal/avx_mathfun.h"
+#include "ExpressionFilter.h"
+#include <omp.h>
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+ExpressionFilter::ExpressionFilter(const string& color)
+	: ElementwiseFilter(color, CAT_MATH)
+	, m_expressionName("Expression")
+	, m_inputCountName("Inputs")
+	, m_compiledInputCount(0)
+	, m_compileOK(false)
+	, m_stackDepth(0)
+	, m_parsePos(0)
+	, m_parseInputs(0)
+	, m_parseError(false)
+	, m_range(1)
+	, m_offset(0)
+{
+	m_parameters[m_inputCountName] = FilterParameter(FilterParameter::TYPE_INT, Unit(Unit::UNIT_COUNTS));
+	m_parameters[m_inputCountName].SetIntVal(2);
+	m_parameters[m_inputCountName].signal_changed().connect(
+		sigc::mem_fun(*this, &ExpressionFilter::OnInputCountChanged));
+
+	m_parameters[m_expressionName] = FilterParameter(FilterParameter::TYPE_STRING, Unit(Unit::UNIT_COUNTS));
+	m_parameters[m_expressionName].ParseString("a - b", false);
+
+	OnInputCountChanged();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Factory methods
+
+bool ExpressionFilter::ValidateChannel(size_t i, StreamDescriptor stream)
+{
+	if(stream.m_channel == NULL)
+		return false;
+
+	if( (i < m_inputs.size()) && (stream.m_channel->GetType() == OscilloscopeChannel::CHANNEL_TYPE_ANALOG) )
+		return true;
+
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Accessors
+
+float ExpressionFilter::GetVoltageRange(size_t /*stream*/)
+{
+	return m_range;
+}
+
+float ExpressionFilter::GetOffset(size_t /*stream*/)
+{
+	return -m_offset;
+}
+
+string ExpressionFilter::GetProtocolName()
+{
+	return "Expression";
+}
+
+bool ExpressionFilter::NeedsConfig()
+{
+	return true;
+}
+
+void ExpressionFilter::SetDefaultName()
+{
+	m_hwname = m_parameters[m_expressionName].ToString(false);
+	m_displayname = m_hwname;
+}
+
+/**
+	@brief Creates or deletes inputs to match the input count parameter
+ */
+void ExpressionFilter::OnInputCountChanged()
+{
+	//Inputs are named a...z
+	size_t nin = m_parameters[m_inputCountName].GetIntVal();
+	nin = max((size_t)1, min(nin, (size_t)26));
+
+	for(size_t i=m_inputs.size(); i<nin; i++)
+		CreateInput(string(1, 'a' + i));
+
+	for(size_t i=nin; i<m_inputs.size(); i++)
+		SetInput(i, NULL, true);
+	m_inputs.resize(nin);
+	m_signalNames.resize(nin);
+
+	m_inputsChangedSignal.emit();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Expression parsing
+
+/**
+	@brief Parses an expression and converts it to bytecode
+
+	@return True on success
+ */
+bool ExpressionFilter::Compile(const string& expression, size_t ninputs)
+{
+	m_program.clear();
+	m_stackDepth = 0;
+
+	m_parseText = expression;
+	m_parsePos = 0;
+	m_parseInputs = ninputs;
+	m_parseError = false;
+
+	auto root = ParseComparison();
+	SkipWhitespace();
+	if(!root || m_parseError || (m_parsePos != m_parseText.length()) )
+		return false;
+
+	Emit(root);
+
+	//Figure out how deep the stack gets
+	size_t depth = 0;
+	for(auto& insn : m_program)
+	{
+		if( (insn.m_op == OP_INPUT) || (insn.m_op == OP_CONST) )
+			depth ++;
+		else if(insn.m_op >= OP_ADD)
+			depth --;
+		m_stackDepth = max(m_stackDepth, depth);
+	}
+
+	return true;
+}
+
+void ExpressionFilter::SkipWhitespace()
+{
+	while( (m_parsePos < m_parseText.length()) && isspace(m_parseText[m_parsePos]) )
+		m_parsePos ++;
+}
+
+/**
+	@brief Consumes the given token if it's next in the input
+ */
+bool ExpressionFilter::Accept(const char* token)
+{
+	SkipWhitespace();
+
+	size_t len = strlen(token);
+	if(m_parseText.compare(m_parsePos, len, token) != 0)
+		return false;
+
+	m_parsePos += len;
+	return true;
+}
+
+/**
+	@brief Creates an operator node, folding it to a constant if all of its arguments are constant
+
+	Returns NULL if any argument failed to parse.
+ */
+ExpressionFilter::NodePtr ExpressionFilter::MakeNode(Opcode op, NodePtr a, NodePtr b)
+{
+	bool binary = (op >= OP_ADD);
+	if(!a || (binary && !b) )
+	{
+		m_parseError = true;
+		return NULL;
+	}
+
+	if( (a->m_op == OP_CONST) && (!binary || (b->m_op == OP_CONST)) )
+		return make_shared<Node>(OP_CONST, 0, EvaluateConstant(op, a->m_value, binary ? b->m_value : 0));
+
+	auto node = make_shared<Node>(op);
+	node->m_children.push_back(a);
+	if(binary)
+		node->m_children.push_back(b);
+	return node;
+}
+
+ExpressionFilter::NodePtr ExpressionFilter::ParseComparison()
+{
+	auto node = ParseSum();
+	while(!m_parseError)
+	{
+		//Check two-character operators first so "<=" isn't read as "<"
+		if(Accept("<="))
+			node = MakeNode(OP_LE, node, ParseSum());
+		else if(Accept(">="))
+			node = MakeNode(OP_GE, node, ParseSum());
+		else if(Accept("=="))
+			node = MakeNode(OP_EQ, node, ParseSum());
+		else if(Accept("!="))
+			node = MakeNode(OP_NE, node, ParseSum());
+		else if(Accept("<"))
+			node = MakeNode(OP_LT, node, ParseSum());
+		else if(Accept(">"))
+			node = MakeNode(OP_GT, node, ParseSum());
+		else
+			break;
+	}
+	return node;
+}
+
+ExpressionFilter::NodePtr ExpressionFilter::ParseSum()
+{
+	auto node = ParseProduct();
+	while(!m_parseError)
+	{
+		if(Accept("+"))
+			node = MakeNode(OP_ADD, node, ParseProduct());
+		else if(Accept("-"))
+			node = MakeNode(OP_SUB, node, ParseProduct());
+		else
+			break;
+	}
+	return node;
+}
+
+ExpressionFilter::NodePtr ExpressionFilter::ParseProduct()
+{
+	auto node = ParseUnary();
+	while(!m_parseError)
+	{
+		if(Accept("*"))
+			node = MakeNode(OP_MUL, node, ParseUnary());
+		else if(Accept("/"))
+			node = MakeNode(OP_DIV, node, ParseUnary());
+		else
+			break;
+	}
+	return node;
+}
+
+ExpressionFilter::NodePtr ExpressionFilter::ParseUnary()
+{
+	if(Accept("-"))
+		return MakeNode(OP_NEG, ParseUnary());
+	if(Accept("+"))
+		return ParseUnary();
+	return ParsePrimary();
+}
+
+ExpressionFilter::NodePtr ExpressionFilter::ParsePrimary()
+{
+	SkipWhitespace();
+	if(m_parseError || (m_parsePos >= m_parseText.length()) )
+	{
+		m_parseError = true;
+		return NULL;
+	}
+
+	//Parenthesized subexpression
+	if(Accept("("))
+	{
+		auto node = ParseComparison();
+		if(!Accept(")"))
+		{
+			m_parseError = true;
+			return NULL;
+		}
+		return node;
+	}
+
+	//Numeric constant
+	char c = m_parseText[m_parsePos];
+	if(isdigit(c) || (c == '.') )
+	{
+		const char* start = m_parseText.c_str() + m_parsePos;
+		char* end = NULL;
+		float value = strtof(start, &end);
+		if(end == start)
+		{
+			m_parseError = true;
+			return NULL;
+		}
+		m_parsePos += (end - start);
+		return make_shared<Node>(OP_CONST, 0, value);
+	}
+
+	if(!isalpha(c))
+	{
+		m_parseError = true;
+		return NULL;
+	}
+
+	//Identifier
+	size_t start = m_parsePos;
+	while( (m_parsePos < m_parseText.length()) && (isalnum(m_parseText[m_parsePos]) || (m_parseText[m_parsePos] == '_')) )
+		m_parsePos ++;
+	string name = m_parseText.substr(start, m_parsePos - start);
+
+	//Input
+	if( (name.length() == 1) && (name[0] >= 'a') && ((size_t)(name[0] - 'a') < m_parseInputs) )
+		return make_shared<Node>(OP_INPUT, name[0] - 'a');
+
+	if(name == "pi")
+		return make_shared<Node>(OP_CONST, 0, M_PI);
+
+	//Function call
+	static const map<string, Opcode> functions =
+	{
+		{ "abs",	OP_ABS },
+		{ "sqrt",	OP_SQRT },
+		{ "sin",	OP_SIN },
+		{ "cos",	OP_COS },
+		{ "exp",	OP_EXP },
+		{ "log",	OP_LOG },
+		{ "min",	OP_MIN },
+		{ "max",	OP_MAX }
+	};
+	auto it = functions.find(name);
+	if( (it == functions.end()) || !Accept("(") )
+	{
+		m_parseError = true;
+		return NULL;
+	}
+
+	auto op = it->second;
+	auto a = ParseComparison();
+	NodePtr b;
+	if(op >= OP_ADD)
+	{
+		if(!Accept(","))
+		{
+			m_parseError = true;
+			return NULL;
+		}
+		b = ParseComparison();
+	}
+	if(!Accept(")"))
+	{
+		m_parseError = true;
+		return NULL;
+	}
+
+	return MakeNode(op, a, b);
+}
+
+/**
+	@brief Appends bytecode for a node (arguments first, then the operator itself)
+ */
+void ExpressionFilter::Emit(NodePtr node)
+{
+	for(auto& child : node->m_children)
+		Emit(child);
+
+	m_program.push_back(Instruction(node->m_op, node->m_input, node->m_value));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Evaluation
+
+float ExpressionFilter::EvaluateConstant(Opcode op, float a, float b)
+{
+	switch(op)
+	{
+		case OP_NEG:	return -a;
+		case OP_ABS:	return fabs(a);
+		case OP_SQRT:	return sqrt(a);
+		case OP_SIN:	return sin(a);
+		case OP_COS:	return cos(a);
+		case OP_EXP:	return exp(a);
+		case OP_LOG:	return log(a);
+
+		case OP_ADD:	return a + b;
+		case OP_SUB:	return a - b;
+		case OP_MUL:	return a * b;
+		case OP_DIV:	return a / b;
+		case OP_MIN:	return min(a, b);
+		case OP_MAX:	return max(a, b);
+		case OP_LT:		return (a < b) ? 1 : 0;
+		case OP_LE:		return (a <= b) ? 1 : 0;
+		case OP_GT:		return (a > b) ? 1 : 0;
+		case OP_GE:		return (a >= b) ? 1 : 0;
+		case OP_EQ:		return (a == b) ? 1 : 0;
+		case OP_NE:		return (a != b) ? 1 : 0;
+
+		default:		return 0;
+	}
+}
+
+void ExpressionFilter::EvaluateUnary(Opcode op, float* out, const float* a, size_t len)
+{
+	switch(op)
+	{
+		case OP_NEG:
+			for(size_t i=0; i<len; i++)
+				out[i] = -a[i];
+			break;
+
+		case OP_ABS:
+			for(size_t i=0; i<len; i++)
+				out[i] = fabs(a[i]);
+			break;
+
+		case OP_SQRT:
+			for(size_t i=0; i<len; i++)
+				out[i] = sqrt(a[i]);
+			break;
+
+		case OP_SIN:
+			for(size_t i=0; i<len; i++)
+				out[i] = sin(a[i]);
+			break;
+
+		case OP_COS:
+			for(size_t i=0; i<len; i++)
+				out[i] = cos(a[i]);
+			break;
+
+		case OP_EXP:
+			for(size_t i=0; i<len; i++)
+				out[i] = exp(a[i]);
+			break;
+
+		case OP_LOG:
+			for(size_t i=0; i<len; i++)
+				out[i] = log(a[i]);
+			break;
+
+		default:
+			break;
+	}
+}
+
+/**
+	@brief AVX2 versions of the transcendental functions (everything else vectorizes fine on its own)
+ */
+__attribute__((target("avx2")))
+void ExpressionFilter::EvaluateUnaryAVX2(Opcode op, float* out, const float* a, size_t len)
+{
+	size_t end = len - (len % 8);
+
+	switch(op)
+	{
+		case OP_SIN:
+			for(size_t i=0; i<end; i+=8)
+				_mm256_storeu_ps(out + i, _mm256_sin_ps(_mm256_loadu_ps(a + i)));
+			break;
+
+		case OP_COS:
+			for(size_t i=0; i<end; i+=8)
+				_mm256_storeu_ps(out + i, _mm256_cos_ps(_mm256_loadu_ps(a + i)));
+			break;
+
+		case OP_EXP:
+			for(size_t i=0; i<end; i+=8)
+				_mm256_storeu_ps(out + i, exp256_ps(_mm256_loadu_ps(a + i)));
+			break;
+
+		case OP_LOG:
+			for(size_t i=0; i<end; i+=8)
+				_mm256_storeu_ps(out + i, _mm256_log_ps(_mm256_loadu_ps(a + i)));
+			break;
+
+		default:
+			end = 0;
+			break;
+	}
+
+	//Get any extras we didn't get in the SIMD loop
+	EvaluateUnary(op, out + end, a + end, len - end);
+}
+
+void ExpressionFilter::EvaluateBinary(Opcode op, float* out, const float* a, const float* b, size_t len)
+{
+	switch(op)
+	{
+		case OP_ADD:
+			for(size_t i=0; i<len; i++)
+				out[i] = a[i] + b[i];
+			break;
+
+		case OP_SUB:
+			for(size_t i=0; i<len; i++)
+				out[i] = a[i] - b[i];
+			break;
+
+		case OP_MUL:
+			for(size_t i=0; i<len; i++)
+				out[i] = a[i] * b[i];
+			break;
+
+		case OP_DIV:
+			for(size_t i=0; i<len; i++)
+				out[i] = a[i] / b[i];
+			break;
+
+		case OP_MIN:
+			for(size_t i=0; i<len; i++)
+				out[i] = (b[i] < a[i]) ? b[i] : a[i];
+			break;
+
+		case OP_MAX:
+			for(size_t i=0; i<len; i++)
+				out[i] = (a[i] < b[i]) ? b[i] : a[i];
+			break;
+
+		case OP_LT:
+			for(size_t i=0; i<len; i++)
+				out[i] = (a[i] < b[i]) ? 1 : 0;
+			break;
+
+		case OP_LE:
+			for(size_t i=0; i<len; i++)
+				out[i] = (a[i] <= b[i]) ? 1 : 0;
+			break;
+
+		case OP_GT:
+			for(size_t i=0; i<len; i++)
+				out[i] = (a[i] > b[i]) ? 1 : 0;
+			break;
+
+		case OP_GE:
+			for(size_t i=0; i<len; i++)
+				out[i] = (a[i] >= b[i]) ? 1 : 0;
+			break;
+
+		case OP_EQ:
+			for(size_t i=0; i<len; i++)
+				out[i] = (a[i] == b[i]) ? 1 : 0;
+			break;
+
+		case OP_NE:
+			for(size_t i=0; i<len; i++)
+				out[i] = (a[i] != b[i]) ? 1 : 0;
+			break;
+
+		default:
+			break;
+	}
+}
+
+/**
+	@brief Verifies that all of our inputs are sampled at the same points in time
+
+	Fused inputs don't have a waveform yet, and take their timebase from their own inputs.
+ */
+bool ExpressionFilter::CheckTimebases()
+{
+	WaveformBase* ref = NULL;
+	for(size_t i=0; i<m_inputs.size(); i++)
+	{
+		if(GetFusedInput(i))
+			continue;
+
+		auto w = GetInputWaveform(i);
+		if(!ref)
+		{
+			ref = w;
+			continue;
+		}
+
+		if( (w->m_timescale != ref->m_timescale) ||
+			(w->m_triggerPhase != ref->m_triggerPhase) ||
+			(w->m_densePacked != ref->m_densePacked) )
+		{
+			return false;
+		}
+
+		//Sparse waveforms: check the endpoints rather than every sample
+		if(!w->m_densePacked)
+		{
+			size_t len = min(w->m_offsets.size(), ref->m_offsets.size());
+			if(len == 0)
+				continue;
+			if( (w->m_offsets[0] != ref->m_offsets[0]) || (w->m_offsets[len-1] != ref->m_offsets[len-1]) )
+				return false;
+		}
+	}
+
+	return true;
+}
+
+bool ExpressionFilter::PrepareElementwise()
+{
+	//Recompile if the expression or input count changed
+	auto expression = m_parameters[m_expressionName].ToString(false);
+	if( (expression != m_compiledExpression) || (m_inputs.size() != m_compiledInputCount) )
+	{
+		m_compiledExpression = expression;
+		m_compiledInputCount = m_inputs.size();
+		m_compileOK = Compile(expression, m_inputs.size());
+		if(!m_compileOK)
+			LogError("Expression filter: couldn't parse \"%s\"\n", expression.c_str());
+	}
+	if(!m_compileOK)
+		return false;
+
+	//All inputs must be on the same X axis
+	m_xAxisUnit = m_inputs[0].m_channel->GetXAxisUnits();
+	for(size_t i=1; i<m_inputs.size(); i++)
+	{
+		if(m_inputs[i].m_channel->GetXAxisUnits() != m_xAxisUnit)
+			return false;
+	}
+
+	//We have no way of knowing what the expression does to the units, so assume they're unchanged
+	SetYAxisUnits(m_inputs[0].GetYAxisUnits(), 0);
+
+	//Allocate scratch space for every worker up front, so ProcessElementwise never allocates
+	m_threadState.resize(omp_get_max_threads());
+	for(auto& state : m_threadState)
+	{
+		state.m_scratch.resize(m_stackDepth * BLOCK_SIZE);
+		state.m_stack.reserve(m_stackDepth);
+	}
+
+	return CheckTimebases();
+}
+
+void ExpressionFilter::ProcessElementwise(float* out, const float* const* in, size_t len)
+{
+	//Each stack slot has a BLOCK_SIZE scratch buffer, but inputs are referenced in place rather than copied.
+	//The last instruction writes straight to the output.
+	auto& state = m_threadState[omp_get_thread_num()];
+	float* scratch = state.m_scratch.data();
+	auto& stack = state.m_stack;
+	stack.clear();
+
+	size_t last = m_program.size() - 1;
+	for(size_t pc=0; pc<m_program.size(); pc++)
+	{
+		auto& insn = m_program[pc];
+		auto op = insn.m_op;
+
+		if(op == OP_INPUT)
+		{
+			if(pc == last)
+				memcpy(out, in[insn.m_input], len * sizeof(float));
+			else
+				stack.push_back(in[insn.m_input]);
+		}
+
+		else if(op == OP_CONST)
+		{
+			float* dst = (pc == last) ? out : &scratch[stack.size() * BLOCK_SIZE];
+			for(size_t i=0; i<len; i++)
+				dst[i] = insn.m_value;
+			stack.push_back(dst);
+		}
+
+		else if(op < OP_ADD)
+		{
+			size_t slot = stack.size() - 1;
+			float* dst = (pc == last) ? out : &scratch[slot * BLOCK_SIZE];
+
+			if(g_hasAvx2 && (op >= OP_SIN) )
+				EvaluateUnaryAVX2(op, dst, stack[slot], len);
+			else
+				EvaluateUnary(op, dst, stack[slot], len);
+			stack[slot] = dst;
+		}
+
+		else
+		{
+			size_t slot = stack.size() - 2;
+			float* dst = (pc == last) ? out : &scratch[slot * BLOCK_SIZE];
+
+			EvaluateBinary(op, dst, stack[slot], stack[slot+1], len);
+			stack.pop_back();
+			stack[slot] = dst;
+		}
+	}
+}
+
+void ExpressionFilter::Refresh()
+{
+	ElementwiseFilter::Refresh();
+
+	//Calculate range of the output waveform
+	auto cap = dynamic_cast<AnalogWaveform*>(GetData(0));
+	if(!cap)
+		return;
+	float x;
+	float n;
+	GetMinMaxVoltage(cap, n, x);
+	m_range = x - n;
+	m_offset = (x+n)/2;
+}
@@ -0,0 +1,197 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* libscopeprotocols                                                                                                    *
+*                                                                                                                      *
+* Copyright (c) 2012-2021 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of ExpressionFilter
+ */
+#ifndef ExpressionFilter_h
+#define ExpressionFilter_h
+
+/**
+	@brief Evaluates an arbitrary math expression on each sample of one or more analog inputs
+
+	Inputs are named a, b, c... in the expression. Supported syntax:
+	* Arithmetic: + - * / and unary minus, with parentheses
+	* Comparisons: < <= > >= == != (result is 1 if true, 0 if false)
+	* Functions: abs(x), sqrt(x), sin(x), cos(x), exp(x), log(x), min(x, y), max(x, y)
+	* Constants: decimal numbers, pi
+
+	The expression is compiled once into bytecode for a small stack machine. Each instruction then operates on a
+	whole block of samples at a time, so the per-instruction dispatch overhead is amortized and the inner loops are
+	vectorized.
+ */
+class ExpressionFilter : public ElementwiseFilter
+{
+public:
+	ExpressionFilter(const std::string& color);
+
+	virtual void Refresh();
+
+	virtual bool NeedsConfig();
+
+	static std::string GetProtocolName();
+	virtual void SetDefaultName();
+
+	virtual float GetVoltageRange(size_t stream);
+	virtual float GetOffset(size_t stream);
+	virtual bool ValidateChannel(size_t i, StreamDescriptor stream);
+
+	PROTOCOL_DECODER_INITPROC(ExpressionFilter)
+
+protected:
+	virtual bool PrepareElementwise();
+	virtual void ProcessElementwise(float* out, const float* const* in, size_t len);
+
+	void OnInputCountChanged();
+	bool CheckTimebases();
+
+	enum Opcode
+	{
+		//Push a value onto the stack
+		OP_INPUT,
+		OP_CONST,
+
+		//Replace the top of the stack
+		OP_NEG,
+		OP_ABS,
+		OP_SQRT,
+		OP_SIN,
+		OP_COS,
+		OP_EXP,
+		OP_LOG,
+
+		//Pop two values and push the result
+		OP_ADD,
+		OP_SUB,
+		OP_MUL,
+		OP_DIV,
+		OP_MIN,
+		OP_MAX,
+		OP_LT,
+		OP_LE,
+		OP_GT,
+		OP_GE,
+		OP_EQ,
+		OP_NE
+	};
+
+	///@brief A single bytecode instruction
+	class Instruction
+	{
+	public:
+		Instruction(Opcode op, size_t input = 0, float value = 0)
+			: m_op(op)
+			, m_input(input)
+			, m_value(value)
+		{}
+
+		Opcode m_op;
+
+		///@brief Input index for OP_INPUT
+		size_t m_input;
+
+		///@brief Value for OP_CONST
+		float m_value;
+	};
+
+	///@brief Node of the parsed expression tree
+	class Node
+	{
+	public:
+		Node(Opcode op, size_t input = 0, float value = 0)
+			: m_op(op)
+			, m_input(input)
+			, m_value(value)
+		{}
+
+		Opcode m_op;
+		size_t m_input;
+		float m_value;
+		std::vector<std::shared_ptr<Node> > m_children;
+	};
+	typedef std::shared_ptr<Node> NodePtr;
+
+	//Parser
+	bool Compile(const std::string& expression, size_t ninputs);
+	NodePtr ParseComparison();
+	NodePtr ParseSum();
+	NodePtr ParseProduct();
+	NodePtr ParseUnary();
+	NodePtr ParsePrimary();
+	void SkipWhitespace();
+	bool Accept(const char* token);
+	NodePtr MakeNode(Opcode op, NodePtr a, NodePtr b = NULL);
+	void Emit(NodePtr node);
+
+	static float EvaluateConstant(Opcode op, float a, float b);
+	static void EvaluateUnary(Opcode op, float* out, const float* a, size_t len);
+	static void EvaluateUnaryAVX2(Opcode op, float* out, const float* a, size_t len);
+	static void EvaluateBinary(Opcode op, float* out, const float* a, const float* b, size_t len);
+
+	std::string m_expressionName;
+	std::string m_inputCountName;
+
+	///@brief The expression we last compiled
+	std::string m_compiledExpression;
+
+	///@brief Input count the last compile was done with
+	size_t m_compiledInputCount;
+
+	///@brief True if the last compile succeeded
+	bool m_compileOK;
+
+	///@brief Compiled bytecode
+	std::vector<Instruction> m_program;
+
+	///@brief Maximum stack depth needed by the program
+	size_t m_stackDepth;
+
+	///@brief Evaluation buffers for one worker thread
+	struct ThreadState
+	{
+		std::vector<float, AlignedAllocator<float, 64> > m_scratch;
+		std::vector<const float*> m_stack;
+	};
+
+	///@brief Evaluation buffers, indexed by OpenMP thread number so blocks can be processed concurrently
+	std::vector<ThreadState> m_threadState;
+
+	//Parser state
+	std::string m_parseText;
+	size_t m_parsePos;
+	size_t m_parseInputs;
+	bool m_parseError;
+
+	float m_range;
+	float m_offset;
+};
+
+#endif
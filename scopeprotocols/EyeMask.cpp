@@ -35,6 +35,7 @@
 
 #include "scopeprotocols.h"
 #include "EyeMask.h"
+#include <immintrin.h>
 
 using namespace std;
 
@@ -44,6 +45,14 @@ using namespace std;
 EyeMask::EyeMask()
 	: m_hitrate(0)
 	, m_timebaseIsRelative(false)
+	, m_bitmapWords(0)
+	, m_bitmapWidth(0)
+	, m_bitmapHeight(0)
+	, m_bitmapUIWidth(0)
+	, m_bitmapXScale(0)
+	, m_bitmapXOff(0)
+	, m_bitmapYScale(0)
+	, m_bitmapYOff(0)
 {
 }
 
@@ -84,6 +93,8 @@ bool EyeMask::Load(const YAML::Node& node)
 {
 	//Clear out any previous state
 	m_polygons.clear();
+	m_bitmap.clear();
+	m_bitmapWidth = 0;
 	m_hitrate = 0;
 	m_timebaseIsRelative = false;
 	m_maskname = "";
@@ -226,3 +237,211 @@ void EyeMask::RenderInternal(
 		cr->fill();
 	}
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Hit testing
+
+/**
+	@brief Calculates the fraction of an eye pattern's samples which fall inside the mask
+
+	The mask is rasterized to a bitmap the first time it's needed at a given eye geometry, so a refresh only has to
+	sum the accumulated eye under the set bits.
+ */
+float EyeMask::CalculateHitRate(
+	EyeWaveform* cap,
+	size_t width,
+	size_t height,
+	float xscale,
+	float xoff,
+	float yscale,
+	float yoff)
+{
+	//Re-rasterize if anything changed since last time
+	float uiwidth = m_timebaseIsRelative ? cap->GetUIWidth() : 1;
+	if( (width != m_bitmapWidth) ||
+		(height != m_bitmapHeight) ||
+		(uiwidth != m_bitmapUIWidth) ||
+		(xscale != m_bitmapXScale) ||
+		(xoff != m_bitmapXOff) ||
+		(yscale != m_bitmapYScale) ||
+		(yoff != m_bitmapYOff) )
+	{
+		Rasterize(width, height, uiwidth, xscale, xoff, yscale, yoff);
+	}
+
+	int64_t hits;
+	int64_t total;
+	if(g_hasAvx2)
+		CountHitsAVX2(cap->GetAccumData(), hits, total);
+	else
+		CountHits(cap->GetAccumData(), hits, total);
+
+	return hits * 1.0f / total;
+}
+
+/**
+	@brief Rasterizes the mask polygons into m_bitmap
+
+	Uses the same coordinate transform as RenderForAnalysis(). A pixel is considered inside the mask if any part of
+	it is covered (matching what an antialiased renderer would mark as nonzero), approximated by sampling four
+	scanlines within each row.
+ */
+void EyeMask::Rasterize(
+	size_t width,
+	size_t height,
+	float uiwidth,
+	float xscale,
+	float xoff,
+	float yscale,
+	float yoff)
+{
+	m_bitmapWidth = width;
+	m_bitmapHeight = height;
+	m_bitmapUIWidth = uiwidth;
+	m_bitmapXScale = xscale;
+	m_bitmapXOff = xoff;
+	m_bitmapYScale = yscale;
+	m_bitmapYOff = yoff;
+
+	m_bitmapWords = (width + 63) / 64;
+	m_bitmap.resize(m_bitmapWords * height);
+	memset(&m_bitmap[0], 0, m_bitmap.size() * sizeof(uint64_t));
+
+	for(size_t y=0; y<height; y++)
+	{
+		uint64_t* row = &m_bitmap[y * m_bitmapWords];
+		for(int sub=0; sub<4; sub++)
+			RasterizeSpans(row, width, y + 0.125f + 0.25f*sub, uiwidth, xscale, xoff, yscale, yoff, height);
+	}
+}
+
+/**
+	@brief Sets the bits for every pixel touched by the mask along a single horizontal line
+
+	Polygons are filled with the nonzero winding rule, as Cairo does by default.
+ */
+void EyeMask::RasterizeSpans(
+	uint64_t* row,
+	size_t width,
+	float sy,
+	float uiwidth,
+	float xscale,
+	float xoff,
+	float yscale,
+	float yoff,
+	float height) const
+{
+	vector< pair<float, int> > crossings;
+	for(auto& poly : m_polygons)
+	{
+		crossings.clear();
+
+		//Find every edge (including the closing one) crossing this line, and which way it goes
+		size_t npoints = poly.m_points.size();
+		for(size_t i=0; i<npoints; i++)
+		{
+			auto& a = poly.m_points[i];
+			auto& b = poly.m_points[(i+1) % npoints];
+
+			float ax = (a.m_time*uiwidth - xoff) * xscale;
+			float ay = height/2 - ( (a.m_voltage + yoff) * yscale );
+			float bx = (b.m_time*uiwidth - xoff) * xscale;
+			float by = height/2 - ( (b.m_voltage + yoff) * yscale );
+
+			if( (ay <= sy) && (by > sy) )
+				crossings.push_back(pair<float, int>(ax + (sy - ay) * (bx - ax) / (by - ay), 1));
+			else if( (by <= sy) && (ay > sy) )
+				crossings.push_back(pair<float, int>(ax + (sy - ay) * (bx - ax) / (by - ay), -1));
+		}
+		sort(crossings.begin(), crossings.end());
+
+		//Fill every pixel overlapping a span with nonzero winding number
+		int winding = 0;
+		for(size_t i=0; i+1<crossings.size(); i++)
+		{
+			winding += crossings[i].second;
+			if(winding == 0)
+				continue;
+
+			float left = max(0.0f, floorf(crossings[i].first));
+			float right = min((float)width, ceilf(crossings[i+1].first));
+			for(size_t x=left; x<right; x++)
+				row[x / 64] |= (1ULL << (x % 64));
+		}
+	}
+}
+
+/**
+	@brief Sums the eye pattern inside the mask, and overall (unoptimized C++ implementation)
+ */
+void EyeMask::CountHits(const int64_t* accum, int64_t& hits, int64_t& total) const
+{
+	hits = 0;
+	total = 0;
+	for(size_t y=0; y<m_bitmapHeight; y++)
+	{
+		const int64_t* eyerow = accum + y*m_bitmapWidth;
+		const uint64_t* row = &m_bitmap[y * m_bitmapWords];
+
+		for(size_t x=0; x<m_bitmapWidth; x++)
+			total += eyerow[x];
+
+		//Only visit pixels that are actually in the mask
+		for(size_t w=0; w<m_bitmapWords; w++)
+		{
+			uint64_t bits = row[w];
+			while(bits)
+			{
+				size_t x = w*64 + __builtin_ctzll(bits);
+				hits += eyerow[x];
+				bits &= bits - 1;
+			}
+		}
+	}
+}
+
+/**
+	@brief Sums the eye pattern inside the mask, and overall (optimized AVX2 implementation)
+ */
+__attribute__((target("avx2")))
+void EyeMask::CountHitsAVX2(const int64_t* accum, int64_t& hits, int64_t& total) const
+{
+	__m256i vhits = _mm256_setzero_si256();
+	__m256i vtotal = _mm256_setzero_si256();
+	__m256i vlanes = _mm256_set_epi64x(8, 4, 2, 1);
+
+	hits = 0;
+	total = 0;
+	size_t end = m_bitmapWidth - (m_bitmapWidth % 4);
+	for(size_t y=0; y<m_bitmapHeight; y++)
+	{
+		const int64_t* eyerow = accum + y*m_bitmapWidth;
+		const uint64_t* row = &m_bitmap[y * m_bitmapWords];
+
+		//Expand each group of four mask bits to a full lane mask, then AND with the eye
+		size_t x = 0;
+		for(; x<end; x += 4)
+		{
+			__m256i veye = _mm256_loadu_si256((const __m256i*)(eyerow + x));
+			__m256i vbits = _mm256_set1_epi64x( (row[x / 64] >> (x % 64)) & 0xf );
+			__m256i vmask = _mm256_cmpeq_epi64(_mm256_and_si256(vbits, vlanes), vlanes);
+
+			vtotal = _mm256_add_epi64(vtotal, veye);
+			vhits = _mm256_add_epi64(vhits, _mm256_and_si256(veye, vmask));
+		}
+
+		//Get any extras we didn't get in the SIMD loop
+		for(; x<m_bitmapWidth; x++)
+		{
+			total += eyerow[x];
+			if(row[x / 64] & (1ULL << (x % 64)))
+				hits += eyerow[x];
+		}
+	}
+
+	int64_t lanes[4] __attribute__((aligned(32)));
+	_mm256_store_si256((__m256i*)lanes, vhits);
+	hits += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm256_store_si256((__m256i*)lanes, vtotal);
+	total += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
@@ -104,6 +104,15 @@ public:
 		float yoff,
 		float height) const;
 
+	float CalculateHitRate(
+		EyeWaveform* cap,
+		size_t width,
+		size_t height,
+		float xscale,
+		float xoff,
+		float yscale,
+		float yoff);
+
 protected:
 	void RenderInternal(
 		Cairo::RefPtr<Cairo::Context> cr,
@@ -124,6 +133,30 @@ protected:
 	bool m_timebaseIsRelative;
 
 	std::string m_maskname;
+
+	void Rasterize(size_t width, size_t height, float uiwidth, float xscale, float xoff, float yscale, float yoff);
+	void RasterizeSpans(uint64_t* row, size_t width, float sy, float uiwidth, float xscale, float xoff, float yscale,
+		float yoff, float height) const;
+
+	void CountHits(const int64_t* accum, int64_t& hits, int64_t& total) const;
+	void CountHitsAVX2(const int64_t* accum, int64_t& hits, int64_t& total) const;
+
+	/**
+		@brief The mask rasterized at the current eye resolution, one bit per pixel (set = inside mask)
+
+		Each row is padded to a whole number of 64-bit words. Only regenerated when the eye geometry changes.
+	 */
+	std::vector<uint64_t> m_bitmap;
+	size_t m_bitmapWords;
+
+	//Geometry the bitmap was rasterized for
+	size_t m_bitmapWidth;
+	size_t m_bitmapHeight;
+	float m_bitmapUIWidth;
+	float m_bitmapXScale;
+	float m_bitmapXOff;
+	float m_bitmapYScale;
+	float m_bitmapYOff;
 };
 
 #endif
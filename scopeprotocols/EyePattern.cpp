@@ -31,6 +31,7 @@
 #include "EyePattern.h"
 #include <algorithm>
 #include <immintrin.h>
+#include <omp.h>
 
 using namespace std;
 
@@ -471,19 +472,82 @@ void EyePattern::Refresh()
 	int32_t xmax = m_width - 1;
 	if(m_xscale > FLT_EPSILON)
 	{
-		//Optimized inner loop for dense packed waveforms
-		//We can assume m_offsets[i] = i and m_durations[i] = 0 for all input
-		if(waveform->m_densePacked)
+		//Divide large waveforms (>1M points) into blocks and multithread them.
+		//The first block accumulates directly into the output, the rest get their own partial histograms which
+		//are summed at the end (so no atomics are needed in the inner loops).
+		//Every extra block costs a full-size histogram merge, so only split if each block has at least a few
+		//samples per pixel to amortize it over.
+		size_t npix = m_width * m_height;
+		size_t numblocks = 1;
+		if( (wend > 1000000) && (npix > 0) )
+			numblocks = max((size_t)1, min((size_t)omp_get_max_threads(), wend / (4*npix)));
+		size_t lastblock = numblocks - 1;
+		size_t blocksize = wend / numblocks;
+		blocksize = blocksize - (blocksize % 64);
+
+		//Partial histograms are kept zeroed between refreshes (the merge clears them), so they only need to be
+		//initialized when first created or when the eye is resized
+		m_partialAccumulators.resize(lastblock);
+
+		#pragma omp parallel for
+		for(size_t i=0; i<numblocks; i++)
 		{
-			if(g_hasAvx2)
-				DensePackedInnerLoopAVX2(waveform, clock_edges, data, wend, cend, xmax, ymax, xtimescale, yscale, yoff);
+			size_t istart = i*blocksize;
+			size_t iend = (i == lastblock) ? wend : istart + blocksize;
+
+			int64_t* bdata = data;
+			if(i > 0)
+			{
+				auto& partial = m_partialAccumulators[i-1];
+				if(partial.size() != npix)
+					partial.assign(npix, 0);
+				bdata = &partial[0];
+			}
+
+			//Optimized inner loop for dense packed waveforms
+			//We can assume m_offsets[i] = i and m_durations[i] = 0 for all input
+			if(waveform->m_densePacked)
+			{
+				if(g_hasAvx512F)
+				{
+					DensePackedInnerLoopAVX512F(
+						waveform, clock_edges, bdata, istart, iend, cend, xmax, ymax, xtimescale, yscale, yoff);
+				}
+				else if(g_hasAvx2)
+				{
+					DensePackedInnerLoopAVX2(
+						waveform, clock_edges, bdata, istart, iend, cend, xmax, ymax, xtimescale, yscale, yoff);
+				}
+				else
+				{
+					DensePackedInnerLoop(
+						waveform, clock_edges, bdata, istart, iend, cend, xmax, ymax, xtimescale, yscale, yoff);
+				}
+			}
+
+			//Normal main loop
 			else
-				DensePackedInnerLoop(waveform, clock_edges, data, wend, cend, xmax, ymax, xtimescale, yscale, yoff);
+			{
+				SparsePackedInnerLoop(
+					waveform, clock_edges, bdata, istart, iend, cend, xmax, ymax, xtimescale, yscale, yoff);
+			}
 		}
 
-		//Normal main loop
-		else
-			SparsePackedInnerLoop(waveform, clock_edges, data, wend, cend, xmax, ymax, xtimescale, yscale, yoff);
+		//Merge the partial histograms, and zero them for the next refresh
+		if(numblocks > 1)
+		{
+			#pragma omp parallel for
+			for(size_t j=0; j<npix; j++)
+			{
+				int64_t sum = 0;
+				for(auto& partial : m_partialAccumulators)
+				{
+					sum += partial[j];
+					partial[j] = 0;
+				}
+				data[j] += sum;
+			}
+		}
 	}
 
 	//Rightmost column of the eye has some rounding artifacts.
@@ -501,6 +565,7 @@ void EyePattern::Refresh()
 	//Count total number of UIs we've integrated
 	cap->IntegrateUIs(clock_edges.size());
 	cap->Normalize();
+	cap->MarkModified();
 
 	//If we have an eye mask, prepare it for processing
 	if(m_mask.GetFileName() != "")
@@ -512,12 +577,26 @@ void EyePattern::Refresh()
 	LogTrace("Refresh took %.3f ms (avg %.3f)\n", dt * 1000, (total_time * 1000) / total_frames);
 }
 
+/**
+	@brief Finds the clock edge a block of samples starting at the given time should start integrating from
+
+	This is the last edge at or before tstart (or the first edge, if there's none before tstart).
+ */
+size_t EyePattern::GetStartingClockEdge(const vector<int64_t>& clock_edges, int64_t tstart)
+{
+	auto it = upper_bound(clock_edges.begin(), clock_edges.end(), tstart);
+	if(it == clock_edges.begin())
+		return 0;
+	return (it - clock_edges.begin()) - 1;
+}
+
 __attribute__((target("avx2")))
 void EyePattern::DensePackedInnerLoopAVX2(
 	AnalogWaveform* waveform,
 	vector<int64_t>& clock_edges,
 	int64_t* data,
-	size_t wend,
+	size_t istart,
+	size_t iend,
 	size_t cend,
 	int32_t xmax,
 	int32_t ymax,
@@ -530,9 +609,9 @@ void EyePattern::DensePackedInnerLoopAVX2(
 	int64_t width = cap->GetUIWidth();
 	int64_t halfwidth = width/2;
 
-	size_t iclock = 0;
+	size_t iclock = GetStartingClockEdge(clock_edges, istart * waveform->m_timescale + waveform->m_triggerPhase);
 
-	size_t wend_rounded = wend - (wend % 8);
+	size_t iend_rounded = iend - ((iend - istart) % 8);
 
 	//Splat some constants into vector regs
 	__m256i vxoff 		= _mm256_set1_epi32((int)m_xoff);
@@ -546,9 +625,9 @@ void EyePattern::DensePackedInnerLoopAVX2(
 	float* samples = (float*)&waveform->m_samples[0];
 
 	//Main unrolled loop, 8 samples per iteration
-	size_t i = 0;
+	size_t i = istart;
 	uint32_t bufmax = m_width * (m_height - 1);
-	for(; i<wend_rounded && iclock < cend; i+= 8)
+	for(; i<iend_rounded && iclock < cend; i+= 8)
 	{
 		//Figure out timestamp of this sample within the UI.
 		//This doesn't vectorize well, but it's pretty fast.
@@ -638,7 +717,7 @@ void EyePattern::DensePackedInnerLoopAVX2(
 	}
 
 	//Catch any stragglers
-	for(; i<wend && iclock < cend; i++)
+	for(; i<iend && iclock < cend; i++)
 	{
 		//Find time of this sample.
 		//If it's past the end of the current UI, move to the next clock edge
@@ -694,11 +773,141 @@ void EyePattern::DensePackedInnerLoopAVX2(
 	}
 }
 
+__attribute__((target("avx512f")))
+void EyePattern::DensePackedInnerLoopAVX512F(
+	AnalogWaveform* waveform,
+	vector<int64_t>& clock_edges,
+	int64_t* data,
+	size_t istart,
+	size_t iend,
+	size_t cend,
+	int32_t xmax,
+	int32_t ymax,
+	float xtimescale,
+	float yscale,
+	float yoff
+	)
+{
+	EyeWaveform* cap = dynamic_cast<EyeWaveform*>(GetData(0));
+	int64_t width = cap->GetUIWidth();
+	int64_t halfwidth = width/2;
+
+	size_t iclock = GetStartingClockEdge(clock_edges, istart * waveform->m_timescale + waveform->m_triggerPhase);
+
+	size_t iend_rounded = iend - ((iend - istart) % 16);
+
+	//Splat some constants into vector regs
+	__m512i vxoff 		= _mm512_set1_epi32((int)m_xoff);
+	__m512 vxscale 		= _mm512_set1_ps(m_xscale);
+	__m512 vxtimescale	= _mm512_set1_ps(xtimescale);
+	__m512 vyoff 		= _mm512_set1_ps(yoff);
+	__m512 vyscale 		= _mm512_set1_ps(yscale);
+	__m512 v64			= _mm512_set1_ps(64);
+	__m512i vwidth		= _mm512_set1_epi32(m_width);
+
+	float* samples = (float*)&waveform->m_samples[0];
+
+	//Main unrolled loop, 16 samples per iteration
+	size_t i = istart;
+	uint32_t bufmax = m_width * (m_height - 1);
+	for(; i<iend_rounded && iclock < cend; i+= 16)
+	{
+		//Figure out timestamp of this sample within the UI.
+		//This doesn't vectorize well, but it's pretty fast.
+		int32_t offset[16] __attribute__((aligned(64))) = {0};
+		for(size_t j=0; j<16; j++)
+		{
+			size_t k = i+j;
+
+			//Find time of this sample.
+			//If it's past the end of the current UI, move to the next clock edge
+			int64_t tstart = k * waveform->m_timescale + waveform->m_triggerPhase;
+			offset[j] = tstart - clock_edges[iclock];
+			if(offset[j] < 0)
+				continue;
+			size_t nextclk = iclock + 1;
+			int64_t tnext = clock_edges[nextclk];
+			if(tstart >= tnext)
+			{
+				//Move to the next clock edge
+				iclock ++;
+				if(iclock >= cend)
+					break;
+
+				//Figure out the offset to the next edge
+				offset[j] = tstart - tnext;
+			}
+
+			//Drop anything past half a UI if the next clock edge is a long ways out
+			//(this is needed for irregularly sampled data like DDR RAM)
+			int64_t ttnext = tnext - tstart;
+			if( (offset[j] > halfwidth) && (ttnext > width) )
+				offset[j] = -INT_MAX;
+		}
+
+		//Interpolate X position
+		__m512i voffset		= _mm512_load_si512((__m512i*)offset);
+		voffset 			= _mm512_sub_epi32(voffset, vxoff);
+		__m512 foffset		= _mm512_cvtepi32_ps(voffset);
+		foffset				= _mm512_mul_ps(foffset, vxscale);
+		__m512 fround		= _mm512_roundscale_ps(foffset, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		__m512 fdx			= _mm512_sub_ps(foffset, fround);
+		fdx					= _mm512_div_ps(fdx, vxtimescale);
+		__m512 vxfloor		= _mm512_roundscale_ps(foffset, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+		__m512i vxfloori	= _mm512_cvtps_epi32(vxfloor);
+
+		//Load waveform data
+		__m512 vcur			= _mm512_loadu_ps(samples + i);
+		__m512 vnext		= _mm512_loadu_ps(samples + i + 1);
+
+		//Interpolate voltage
+		__m512 vdv			= _mm512_sub_ps(vnext, vcur);
+		__m512 ynom			= _mm512_fmadd_ps(vdv, fdx, vcur);
+		ynom				= _mm512_fmadd_ps(ynom, vyscale, vyoff);
+		__m512 vyfloor		= _mm512_roundscale_ps(ynom, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+		__m512 vyfrac		= _mm512_sub_ps(ynom, vyfloor);
+		__m512i vyfloori	= _mm512_cvtps_epi32(vyfloor);
+
+		//Calculate how much of the pixel's intensity to put in each row
+		__m512 vbin2f		= _mm512_mul_ps(vyfrac, v64);
+		__m512i vbin2i		= _mm512_cvtps_epi32(vbin2f);
+
+		//Final address calculation
+		__m512i voff		= _mm512_mullo_epi32(vyfloori, vwidth);
+		voff				= _mm512_add_epi32(voff, vxfloori);
+
+		//Save stuff for output loop
+		int32_t pixel_x_round[16]	__attribute__((aligned(64)));
+		int32_t bin2[16]			__attribute__((aligned(64)));
+		uint32_t off[16]			__attribute__((aligned(64)));
+		_mm512_store_si512((__m512i*)pixel_x_round, vxfloori);
+		_mm512_store_si512((__m512i*)bin2, vbin2i);
+		_mm512_store_si512((__m512i*)off, voff);
+
+		//Final output loop. Doesn't vectorize well
+		for(size_t j=0; j<16; j++)
+		{
+			//Abort if this pixel is out of bounds
+			if( (pixel_x_round[j] > xmax) || (off[j] >= bufmax) )
+				continue;
+
+			//Plot each point (this only draws the right half of the eye, we copy to the left later)
+			data[off[j]]	 		+= 64 - bin2[j];
+			data[off[j] + m_width]	+= bin2[j];
+		}
+	}
+
+	//Catch any stragglers
+	if(i < iend)
+		DensePackedInnerLoop(waveform, clock_edges, data, i, iend, cend, xmax, ymax, xtimescale, yscale, yoff);
+}
+
 void EyePattern::DensePackedInnerLoop(
 	AnalogWaveform* waveform,
 	vector<int64_t>& clock_edges,
 	int64_t* data,
-	size_t wend,
+	size_t istart,
+	size_t iend,
 	size_t cend,
 	int32_t xmax,
 	int32_t ymax,
@@ -711,8 +920,8 @@ void EyePattern::DensePackedInnerLoop(
 	int64_t width = cap->GetUIWidth();
 	int64_t halfwidth = width/2;
 
-	size_t iclock = 0;
-	for(size_t i=0; i<wend && iclock < cend; i++)
+	size_t iclock = GetStartingClockEdge(clock_edges, istart * waveform->m_timescale + waveform->m_triggerPhase);
+	for(size_t i=istart; i<iend && iclock < cend; i++)
 	{
 		//Find time of this sample.
 		//If it's past the end of the current UI, move to the next clock edge
@@ -754,7 +963,7 @@ void EyePattern::DensePackedInnerLoop(
 		float nominal_voltage = waveform->m_samples[i] + dv*dx_frac;
 		float nominal_pixel_y = nominal_voltage*yscale + yoff;
 		int32_t y1 = static_cast<int32_t>(nominal_pixel_y);
-		if(y1 >= ymax)
+		if( (y1 >= ymax) || (y1 < 0) )
 			continue;
 
 		//Calculate how much of the pixel's intensity to put in each row
@@ -772,7 +981,8 @@ void EyePattern::SparsePackedInnerLoop(
 	AnalogWaveform* waveform,
 	vector<int64_t>& clock_edges,
 	int64_t* data,
-	size_t wend,
+	size_t istart,
+	size_t iend,
 	size_t cend,
 	int32_t xmax,
 	int32_t ymax,
@@ -785,8 +995,9 @@ void EyePattern::SparsePackedInnerLoop(
 	int64_t width = cap->GetUIWidth();
 	int64_t halfwidth = width/2;
 
-	size_t iclock = 0;
-	for(size_t i=0; i<wend && iclock < cend; i++)
+	size_t iclock = GetStartingClockEdge(
+		clock_edges, waveform->m_offsets[istart] * waveform->m_timescale + waveform->m_triggerPhase);
+	for(size_t i=istart; i<iend && iclock < cend; i++)
 	{
 		//Find time of this sample.
 		//If it's past the end of the current UI, move to the next clock edge
@@ -917,56 +1128,7 @@ void EyePattern::RecalculateUIWidth()
  */
 void EyePattern::DoMaskTest(EyeWaveform* cap)
 {
-	//TODO: performance optimization, don't re-render mask every waveform, only when we resize
-
-	//Create the Cairo surface we're drawing on
-	Cairo::RefPtr< Cairo::ImageSurface > surface =
-		Cairo::ImageSurface::create(Cairo::FORMAT_ARGB32, m_width, m_height);
-	Cairo::RefPtr< Cairo::Context > cr = Cairo::Context::create(surface);
-
-	//Set up transformation to match GL's bottom-left origin
-	//cr->translate(0, m_height);
-	//cr->scale(1, -1);
-
-	//Clear to a blank background
-	cr->set_source_rgba(0, 0, 0, 1);
-	cr->rectangle(0, 0, m_width, m_height);
-	cr->fill();
-
-	//Software rendering
+	//The mask is only re-rasterized when the eye geometry changes
 	float yscale = m_height / GetVoltageRange(0);
-	m_mask.RenderForAnalysis(
-		cr,
-		cap,
-		m_xscale,
-		m_xoff,
-		yscale,
-		0,
-		m_height);
-
-	auto accum = cap->GetAccumData();
-
-	//Test each pixel of the eye pattern against the mask
-	uint32_t* data = reinterpret_cast<uint32_t*>(surface->get_data());
-	int stride = surface->get_stride() / sizeof(uint32_t);
-	size_t total = 0;
-	size_t hits = 0;
-	for(size_t y=0; y<m_height; y++)
-	{
-		auto row = data + (y*stride);
-		auto eyerow = accum + (y*m_width);
-		for(size_t x=0; x<m_width; x++)
-		{
-			//Look up the eye pattern pixel
-			auto bin = eyerow[x];
-			total += bin;
-
-			//If mask pixel isn't black, count violations
-			uint32_t pix = row[x];
-			if( (pix & 0xff) != 0)
-				hits += bin;
-		}
-	}
-
-	cap->SetMaskHitRate(hits * 1.0f / total);
+	cap->SetMaskHitRate(m_mask.CalculateHitRate(cap, m_width, m_height, m_xscale, m_xoff, yscale, 0));
 }
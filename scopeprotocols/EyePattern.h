@@ -186,7 +186,8 @@ protected:
 		AnalogWaveform* waveform,
 		std::vector<int64_t>& clock_edges,
 		int64_t* data,
-		size_t wend,
+		size_t istart,
+		size_t iend,
 		size_t cend,
 		int32_t xmax,
 		int32_t ymax,
@@ -199,7 +200,8 @@ protected:
 		AnalogWaveform* waveform,
 		std::vector<int64_t>& clock_edges,
 		int64_t* data,
-		size_t wend,
+		size_t istart,
+		size_t iend,
 		size_t cend,
 		int32_t xmax,
 		int32_t ymax,
@@ -212,7 +214,8 @@ protected:
 		AnalogWaveform* waveform,
 		std::vector<int64_t>& clock_edges,
 		int64_t* data,
-		size_t wend,
+		size_t istart,
+		size_t iend,
 		size_t cend,
 		int32_t xmax,
 		int32_t ymax,
@@ -221,6 +224,22 @@ protected:
 		float yoff
 		);
 
+	void DensePackedInnerLoopAVX512F(
+		AnalogWaveform* waveform,
+		std::vector<int64_t>& clock_edges,
+		int64_t* data,
+		size_t istart,
+		size_t iend,
+		size_t cend,
+		int32_t xmax,
+		int32_t ymax,
+		float xtimescale,
+		float yscale,
+		float yoff
+		);
+
+	static size_t GetStartingClockEdge(const std::vector<int64_t>& clock_edges, int64_t tstart);
+
 	size_t m_height;
 	size_t m_width;
 
@@ -239,6 +258,9 @@ protected:
 	std::string m_rateName;
 
 	EyeMask m_mask;
+
+	///Partial histograms for all but the first block of a multithreaded integration (all zero between refreshes)
+	std::vector< std::vector<int64_t> > m_partialAccumulators;
 };
 
 #endif
@@ -32,6 +32,7 @@
 #include "FFTFilter.h"
 #include <immintrin.h>
 #include "../scopehal/avx_mathfun.h"
+#include <omp.h>
 
 using namespace std;
 
@@ -42,6 +43,9 @@ FFTFilter::FFTFilter(const string& color)
 	: PeakDetectionFilter(OscilloscopeChannel::CHANNEL_TYPE_ANALOG, color, CAT_RF)
 	, m_windowName("Window")
 	, m_roundingName("Length Rounding")
+	, m_modeName("Mode")
+	, m_segmentLengthName("Segment Length")
+	, m_overlapName("Overlap")
 {
 	m_xAxisUnit = Unit(Unit::UNIT_HZ);
 	SetYAxisUnits(Unit(Unit::UNIT_DBM), 0);
@@ -51,7 +55,10 @@ FFTFilter::FFTFilter(const string& color)
 
 	m_cachedNumPoints = 0;
 	m_cachedNumPointsFFT = 0;
-	m_plan = NULL;
+	m_parallelLen1 = 0;
+	m_parallelLen2 = 0;
+	m_cachedWelchLength = 0;
+	m_cachedWelchWindow = WINDOW_RECTANGULAR;
 
 	//Default config
 	m_range = 70;
@@ -69,6 +76,23 @@ FFTFilter::FFTFilter(const string& color)
 	m_parameters[m_roundingName].AddEnumValue("Up (Zero Pad)", ROUND_ZERO_PAD);
 	m_parameters[m_roundingName].SetIntVal(ROUND_TRUNCATE);
 
+	m_parameters[m_modeName] = FilterParameter(FilterParameter::TYPE_ENUM, Unit(Unit::UNIT_COUNTS));
+	m_parameters[m_modeName].AddEnumValue("Single FFT", MODE_SINGLE);
+	m_parameters[m_modeName].AddEnumValue("Averaged (Welch)", MODE_WELCH);
+	m_parameters[m_modeName].SetIntVal(MODE_SINGLE);
+
+	m_parameters[m_segmentLengthName] = FilterParameter(FilterParameter::TYPE_ENUM, Unit(Unit::UNIT_SAMPLEDEPTH));
+	m_parameters[m_segmentLengthName].AddEnumValue("1024", 1024);
+	m_parameters[m_segmentLengthName].AddEnumValue("4096", 4096);
+	m_parameters[m_segmentLengthName].AddEnumValue("16384", 16384);
+	m_parameters[m_segmentLengthName].AddEnumValue("65536", 65536);
+	m_parameters[m_segmentLengthName].AddEnumValue("262144", 262144);
+	m_parameters[m_segmentLengthName].AddEnumValue("1048576", 1048576);
+	m_parameters[m_segmentLengthName].SetIntVal(65536);
+
+	m_parameters[m_overlapName] = FilterParameter(FilterParameter::TYPE_FLOAT, Unit(Unit::UNIT_PERCENT));
+	m_parameters[m_overlapName].SetFloatVal(0.5);
+
 	#ifdef HAVE_CLFFT
 
 		m_clfftPlan = 0;
@@ -166,9 +190,6 @@ FFTFilter::FFTFilter(const string& color)
 
 FFTFilter::~FFTFilter()
 {
-	if(m_plan)
-		ffts_free(m_plan);
-
 	#ifdef HAVE_CLFFT
 		if(m_clfftPlan != 0)
 			clfftDestroyPlan(&m_clfftPlan);
@@ -258,17 +279,33 @@ void FFTFilter::ReallocateBuffers(size_t npoints_raw, size_t npoints, size_t nou
 	{
 		m_cachedNumPointsFFT = npoints;
 
-		if(m_plan)
-		{
-			ffts_free(m_plan);
+		#ifdef HAVE_CLFFT
+			if(!m_plan.empty() && (m_clfftPlan != 0) )
+				clfftDestroyPlan(&m_clfftPlan);
+		#endif
 
-			#ifdef HAVE_CLFFT
-				if(m_clfftPlan != 0)
-					clfftDestroyPlan(&m_clfftPlan);
-			#endif
-		}
+		m_plan.Reset(npoints, FFTS_FORWARD);
 
-		m_plan = ffts_init_1d_real(npoints, FFTS_FORWARD);
+		//Big transforms get split up so we can use all of our cores.
+		//Make the two passes as close to the same size as possible.
+		if(npoints >= PARALLEL_FFT_MIN_POINTS)
+		{
+			size_t m = npoints / 2;
+			m_parallelLen1 = 1;
+			while(m_parallelLen1 * m_parallelLen1 < m)
+				m_parallelLen1 *= 2;
+			m_parallelLen2 = m / m_parallelLen1;
+
+			m_parallelPlan1.Reset(m_parallelLen1, FFTS_FORWARD, FFTPlanCache::TRANSFORM_COMPLEX);
+			m_parallelPlan2.Reset(m_parallelLen2, FFTS_FORWARD, FFTPlanCache::TRANSFORM_COMPLEX);
+		}
+		else
+		{
+			m_parallelLen1 = 0;
+			m_parallelLen2 = 0;
+			m_parallelPlan1.Clear();
+			m_parallelPlan2.Clear();
+		}
 
 		//This must be the last block since we return on error
 		#ifdef HAVE_CLFFT
@@ -314,6 +351,14 @@ void FFTFilter::Refresh()
 	}
 	auto din = GetAnalogInputWaveform(0);
 
+	//Averaged mode doesn't use any of the single FFT state
+	if(m_parameters[m_modeName].GetIntVal() == MODE_WELCH)
+	{
+		double fs = din->m_timescale * (din->m_offsets[1] - din->m_offsets[0]);
+		DoRefreshWelch(din, fs);
+		return;
+	}
+
 	const size_t npoints_raw = din->m_samples.size();
 	size_t npoints;
 	if(m_parameters[m_roundingName].GetIntVal() == ROUND_TRUNCATE)
@@ -333,21 +378,11 @@ void FFTFilter::Refresh()
 	DoRefresh(din, din->m_samples, fs, npoints, nouts, true);
 }
 
-void FFTFilter::DoRefresh(
-	AnalogWaveform* din,
-	vector<EmptyConstructorWrapper<float>, AlignedAllocator<EmptyConstructorWrapper<float>, 64>>& data,
-	double fs_per_sample,
-	size_t npoints,
-	size_t nouts,
-	bool log_output)
+/**
+	@brief Sets up the output waveform for a spectrum with the given bin size
+ */
+AnalogWaveform* FFTFilter::SetupSpectrumOutput(AnalogWaveform* din, double bin_hz, size_t nouts)
 {
-	//Look up some parameters
-	double sample_ghz = 1e6 / fs_per_sample;
-	double bin_hz = round((0.5f * sample_ghz * 1e9f) / nouts);
-	auto window = static_cast<WindowFunction>(m_parameters[m_windowName].GetIntVal());
-	LogTrace("bin_hz: %f\n", bin_hz);
-
-	//Set up output and copy time scales / configuration
 	AnalogWaveform* cap = dynamic_cast<AnalogWaveform*>(GetData(0));
 	if(cap == NULL)
 	{
@@ -372,31 +407,56 @@ void FFTFilter::DoRefresh(
 		}
 	}
 
-	//Output scale is based on the number of points we FFT that contain actual sample data.
-	//(If we're zero padding, the zeroes don't contribute any power)
-	size_t numActualSamples = min(data.size(), npoints);
-	float scale = sqrt(2.0) / numActualSamples;
+	return cap;
+}
 
-	//We also need to adjust the scale by the coherent power gain of the window function
+/**
+	@brief Gets the coherent power gain correction for a window function
+ */
+float FFTFilter::GetWindowGain(WindowFunction window)
+{
 	switch(window)
 	{
 		case WINDOW_HAMMING:
-			scale *= 1.862;
-			break;
+			return 1.862;
 
 		case WINDOW_HANN:
-			scale *= 2.013;
-			break;
+			return 2.013;
 
 		case WINDOW_BLACKMAN_HARRIS:
-			scale *= 2.805;
-			break;
+			return 2.805;
 
 		//unit
 		case WINDOW_RECTANGULAR:
 		default:
-			break;
+			return 1;
 	}
+}
+
+void FFTFilter::DoRefresh(
+	AnalogWaveform* din,
+	SharedVector<EmptyConstructorWrapper<float> >& data,
+	double fs_per_sample,
+	size_t npoints,
+	size_t nouts,
+	bool log_output)
+{
+	//Look up some parameters
+	double sample_ghz = 1e6 / fs_per_sample;
+	double bin_hz = round((0.5f * sample_ghz * 1e9f) / nouts);
+	auto window = static_cast<WindowFunction>(m_parameters[m_windowName].GetIntVal());
+	LogTrace("bin_hz: %f\n", bin_hz);
+
+	//Set up output and copy time scales / configuration
+	AnalogWaveform* cap = SetupSpectrumOutput(din, bin_hz, nouts);
+
+	//Output scale is based on the number of points we FFT that contain actual sample data.
+	//(If we're zero padding, the zeroes don't contribute any power)
+	size_t numActualSamples = min(data.size(), npoints);
+	float scale = sqrt(2.0) / numActualSamples;
+
+	//We also need to adjust the scale by the coherent power gain of the window function
+	scale *= GetWindowGain(window);
 
 	#ifdef HAVE_CLFFT
 		if(g_clContext && m_windowProgram && m_normalizeProgram)
@@ -488,7 +548,7 @@ void FFTFilter::DoRefresh(
 			memset(&m_rdinbuf[m_cachedNumPoints], 0, (npoints - m_cachedNumPoints) * sizeof(float));
 
 		//Calculate the FFT
-		ffts_execute(m_plan, &m_rdinbuf[0], &m_rdoutbuf[0]);
+		ExecuteFFT(&m_rdinbuf[0], &m_rdoutbuf[0], npoints);
 
 		//Normalize magnitudes
 		if(log_output)
@@ -514,6 +574,279 @@ void FFTFilter::DoRefresh(
 	FindPeaks(cap);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Multithreaded FFT
+
+/**
+	@brief Runs the single FFT set up by ReallocateBuffers(), multithreaded if it's big enough
+
+	@param in		Input buffer (npoints samples). May be overwritten.
+	@param out		Output buffer (npoints/2 + 1 complex values)
+	@param npoints	Size of the transform
+ */
+void FFTFilter::ExecuteFFT(float* in, float* out, size_t npoints)
+{
+	if( (m_parallelLen1 != 0) && (omp_get_max_threads() > 1) )
+		ParallelFFT(in, out, npoints);
+	else
+		ffts_execute(m_plan.Get(), in, out);
+}
+
+/**
+	@brief Calculates a very large real FFT using all available cores
+
+	ffts is single threaded, so one huge transform leaves most of the machine idle. The N real inputs are treated as
+	N/2 complex values, that complex transform is split into two passes of many small independent transforms (the
+	"four step" algorithm) which run in parallel, and the result is unpacked into the N/2+1 bins of the real transform.
+
+	@param in		Input buffer (npoints samples). Overwritten with intermediate results.
+	@param out		Output buffer (npoints/2 + 1 complex values)
+	@param npoints	Size of the transform
+ */
+void FFTFilter::ParallelFFT(float* in, float* out, size_t npoints)
+{
+	const size_t m = npoints / 2;
+	const size_t len1 = m_parallelLen1;
+	const size_t len2 = m_parallelLen2;
+
+	//Number of transforms done at once in each pass, so the strided accesses use a full cache line
+	const size_t batch = 8;
+
+	//Pass 1: for each column n2, transform z[len2*n1 + n2] over n1 and apply twiddle factors exp(-2*pi*i*n2*k1/m).
+	//Output is stored transposed (row k1 is contiguous) so pass 2 can read it directly.
+	#pragma omp parallel for
+	for(size_t nb=0; nb<len2; nb += batch)
+	{
+		float* cols = FFTPlanCache::GetScratchBuffer(0, batch*2*len1);
+		float* spec = FFTPlanCache::GetScratchBuffer(1, batch*2*len1);
+		ffts_plan_t* plan = m_parallelPlan1.Get();
+
+		for(size_t n1=0; n1<len1; n1++)
+		{
+			const float* src = in + 2*(len2*n1 + nb);
+			for(size_t j=0; j<batch; j++)
+			{
+				cols[j*2*len1 + n1*2]		= src[j*2];
+				cols[j*2*len1 + n1*2 + 1]	= src[j*2 + 1];
+			}
+		}
+
+		for(size_t j=0; j<batch; j++)
+		{
+			float* s = spec + j*2*len1;
+			ffts_execute(plan, cols + j*2*len1, s);
+
+			//Twiddle factors are successive powers of a single root of unity
+			double theta = -2 * M_PI * (nb + j) / m;
+			double stepr = cos(theta);
+			double stepi = sin(theta);
+			double wr = 1;
+			double wi = 0;
+			for(size_t k1=0; k1<len1; k1++)
+			{
+				float re = s[k1*2];
+				float im = s[k1*2 + 1];
+				s[k1*2]		= re*wr - im*wi;
+				s[k1*2 + 1]	= re*wi + im*wr;
+
+				double tmp = wr*stepr - wi*stepi;
+				wi = wr*stepi + wi*stepr;
+				wr = tmp;
+			}
+		}
+
+		for(size_t k1=0; k1<len1; k1++)
+		{
+			float* dst = out + 2*(k1*len2 + nb);
+			for(size_t j=0; j<batch; j++)
+			{
+				dst[j*2]		= spec[j*2*len1 + k1*2];
+				dst[j*2 + 1]	= spec[j*2*len1 + k1*2 + 1];
+			}
+		}
+	}
+
+	//Pass 2: transform each row over n2. Bin k1 + len1*k2 of the complex transform is element k2 of row k1.
+	#pragma omp parallel for
+	for(size_t kb=0; kb<len1; kb += batch)
+	{
+		float* spec = FFTPlanCache::GetScratchBuffer(1, batch*2*len2);
+		ffts_plan_t* plan = m_parallelPlan2.Get();
+
+		for(size_t j=0; j<batch; j++)
+			ffts_execute(plan, out + 2*(kb + j)*len2, spec + j*2*len2);
+
+		for(size_t k2=0; k2<len2; k2++)
+		{
+			float* dst = in + 2*(k2*len1 + kb);
+			for(size_t j=0; j<batch; j++)
+			{
+				dst[j*2]		= spec[j*2*len2 + k2*2];
+				dst[j*2 + 1]	= spec[j*2*len2 + k2*2 + 1];
+			}
+		}
+	}
+
+	//Pass 3: split the complex transform Z into the even/odd sample transforms and combine them:
+	//X[k] = (Z[k] + conj(Z[m-k]))/2 - i*exp(-2*pi*i*k/npoints) * (Z[k] - conj(Z[m-k]))/2
+	out[0]			= in[0] + in[1];
+	out[1]			= 0;
+	out[2*m]		= in[0] - in[1];
+	out[2*m + 1]	= 0;
+
+	const size_t blocksize = 4096;
+	#pragma omp parallel for
+	for(size_t kb=1; kb<m; kb += blocksize)
+	{
+		size_t kend = min(m, kb + blocksize);
+
+		double theta = -M_PI / m;
+		double stepr = cos(theta);
+		double stepi = sin(theta);
+		double wr = cos(theta * kb);
+		double wi = sin(theta * kb);
+		for(size_t k=kb; k<kend; k++)
+		{
+			float ar = in[k*2];
+			float ai = in[k*2 + 1];
+			float cr = in[(m-k)*2];
+			float ci = in[(m-k)*2 + 1];
+
+			float er = 0.5f * (ar + cr);
+			float ei = 0.5f * (ai - ci);
+			float odr = 0.5f * (ai + ci);
+			float odi = 0.5f * (cr - ar);
+
+			out[k*2]		= er + wr*odr - wi*odi;
+			out[k*2 + 1]	= ei + wr*odi + wi*odr;
+
+			double tmp = wr*stepr - wi*stepi;
+			wi = wr*stepi + wi*stepr;
+			wr = tmp;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Welch averaging
+
+/**
+	@brief Recalculates the plan, window, and accumulators for averaged mode if the configuration changed
+ */
+void FFTFilter::UpdateWelchState(size_t seglen, WindowFunction window)
+{
+	size_t nouts = seglen/2 + 1;
+	size_t nthreads = omp_get_max_threads();
+	if( (seglen != m_cachedWelchLength) || (m_welchAccumulators.size() != nthreads) )
+	{
+		m_cachedWelchLength = seglen;
+		m_welchPlan.Reset(seglen, FFTS_FORWARD);
+
+		m_welchAccumulators.resize(nthreads);
+		for(auto& acc : m_welchAccumulators)
+			acc.resize(nouts);
+
+		//Force the window to be recalculated
+		m_welchWindow.clear();
+	}
+
+	//Precompute the window so each segment is just a multiply
+	if( (window != m_cachedWelchWindow) || m_welchWindow.empty() )
+	{
+		m_cachedWelchWindow = window;
+		m_welchWindow.resize(seglen);
+
+		AlignedFloatVector ones(seglen, 1.0f);
+		ApplyWindow(&ones[0], seglen, &m_welchWindow[0], window);
+	}
+}
+
+/**
+	@brief Calculates an averaged power spectrum (Welch's method)
+
+	The input is split into overlapping windowed segments, each of which is transformed independently (in parallel),
+	and the power in each bin is averaged across all segments. This gives a much lower variance estimate of noise
+	spectra than one huge FFT, at the cost of frequency resolution.
+
+	Scaling matches the single FFT mode, so a tone reads the same amplitude in either mode.
+ */
+void FFTFilter::DoRefreshWelch(AnalogWaveform* din, double fs_per_sample)
+{
+	//Shrink segments if the input is too short for even one
+	size_t inlen = din->m_samples.size();
+	size_t seglen = m_parameters[m_segmentLengthName].GetIntVal();
+	seglen = min(seglen, prev_pow2(inlen));
+	if(seglen < 16)
+	{
+		SetData(NULL, 0);
+		return;
+	}
+	size_t nouts = seglen/2 + 1;
+
+	auto window = static_cast<WindowFunction>(m_parameters[m_windowName].GetIntVal());
+	UpdateWelchState(seglen, window);
+
+	float overlap = m_parameters[m_overlapName].GetFloatVal();
+	overlap = max(0.0f, min(overlap, 0.99f));
+	size_t stride = max((size_t)1, (size_t)round(seglen * (1 - overlap)));
+	size_t nsegs = (inlen - seglen) / stride + 1;
+	LogTrace("FFTFilter: averaging %zu %zu-point FFTs\n", nsegs, seglen);
+
+	//Set up output and copy time scales / configuration
+	double sample_ghz = 1e6 / fs_per_sample;
+	double bin_hz = round((0.5f * sample_ghz * 1e9f) / nouts);
+	AnalogWaveform* cap = SetupSpectrumOutput(din, bin_hz, nouts);
+
+	//Not every thread necessarily gets work, so clear all of the accumulators up front
+	for(auto& acc : m_welchAccumulators)
+		memset(&acc[0], 0, nouts * sizeof(float));
+
+	//Sum the power spectra of each segment
+	const float* pin = (const float*)&din->m_samples[0];
+	const float* pwindow = &m_welchWindow[0];
+	#pragma omp parallel
+	{
+		float* inbuf = FFTPlanCache::GetScratchBuffer(0, seglen);
+		float* outbuf = FFTPlanCache::GetScratchBuffer(1, seglen + 2);
+		float* acc = &m_welchAccumulators[omp_get_thread_num()][0];
+		ffts_plan_t* plan = m_welchPlan.Get();
+
+		#pragma omp for nowait
+		for(size_t seg=0; seg<nsegs; seg++)
+		{
+			const float* src = pin + seg*stride;
+			for(size_t i=0; i<seglen; i++)
+				inbuf[i] = src[i] * pwindow[i];
+
+			ffts_execute(plan, inbuf, outbuf);
+
+			for(size_t i=0; i<nouts; i++)
+			{
+				float real = outbuf[i*2];
+				float imag = outbuf[i*2 + 1];
+				acc[i] += real*real + imag*imag;
+			}
+		}
+	}
+
+	//Average and convert to dBm (assume constant 50 ohms for now)
+	float scale = sqrt(2.0) / seglen * GetWindowGain(window);
+	const float impedance = 50;
+	float pscale = scale * scale / (impedance * nsegs);
+	size_t nthreads = m_welchAccumulators.size();
+	float* pout = (float*)&cap->m_samples[0];
+	for(size_t i=0; i<nouts; i++)
+	{
+		float sum = 0;
+		for(size_t t=0; t<nthreads; t++)
+			sum += m_welchAccumulators[t][i];
+		pout[i] = (10 * log10(sum * pscale) + 30);
+	}
+
+	//Peak search
+	FindPeaks(cap);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Normalization
 
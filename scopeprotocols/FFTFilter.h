@@ -35,7 +35,7 @@
 #ifndef FFTFilter_h
 #define FFTFilter_h
 
-#include <ffts.h>
+#include "../scopehal/FFTPlanCache.h"
 
 #ifdef HAVE_CLFFT
 #include <clFFT.h>
@@ -75,6 +75,12 @@ public:
 		ROUND_ZERO_PAD
 	};
 
+	enum FFTMode
+	{
+		MODE_SINGLE,
+		MODE_WELCH
+	};
+
 	//Window function helpers
 	static void ApplyWindow(const float* data, size_t len, float* out, WindowFunction func);
 	static void HannWindow(const float* data, size_t len, float* out);
@@ -94,22 +100,52 @@ protected:
 
 	void ReallocateBuffers(size_t npoints_raw, size_t npoints, size_t nouts);
 
+	AnalogWaveform* SetupSpectrumOutput(AnalogWaveform* din, double bin_hz, size_t nouts);
+	static float GetWindowGain(WindowFunction window);
+
+	void ExecuteFFT(float* in, float* out, size_t npoints);
+	void ParallelFFT(float* in, float* out, size_t npoints);
+
+	void DoRefreshWelch(AnalogWaveform* din, double fs_per_sample);
+	void UpdateWelchState(size_t seglen, WindowFunction window);
+
 	void DoRefresh(
 		AnalogWaveform* din,
-		std::vector<EmptyConstructorWrapper<float>, AlignedAllocator<EmptyConstructorWrapper<float>, 64>>& data,
+		SharedVector<EmptyConstructorWrapper<float> >& data,
 		double fs_per_sample, size_t npoints, size_t nouts, bool log_output);
 
 	size_t m_cachedNumPoints;
 	size_t m_cachedNumPointsFFT;
 	std::vector<float, AlignedAllocator<float, 64> > m_rdinbuf;
 	std::vector<float, AlignedAllocator<float, 64> > m_rdoutbuf;
-	ffts_plan_t* m_plan;
+	FFTPlan m_plan;
+
+	///FFTs at least this big are split up and run on multiple threads
+	static const size_t PARALLEL_FFT_MIN_POINTS = 1024 * 1024;
+
+	//Multithreaded single FFT state (half length complex transform, split into len2 transforms of size len1
+	//followed by len1 transforms of size len2)
+	size_t m_parallelLen1;
+	size_t m_parallelLen2;
+	FFTPlan m_parallelPlan1;
+	FFTPlan m_parallelPlan2;
+
+	//Welch averaging state
+	typedef std::vector<float, AlignedAllocator<float, 64> > AlignedFloatVector;
+	size_t m_cachedWelchLength;
+	WindowFunction m_cachedWelchWindow;
+	FFTPlan m_welchPlan;
+	AlignedFloatVector m_welchWindow;
+	std::vector<AlignedFloatVector> m_welchAccumulators;
 
 	float m_range;
 	float m_offset;
 
 	std::string m_windowName;
 	std::string m_roundingName;
+	std::string m_modeName;
+	std::string m_segmentLengthName;
+	std::string m_overlapName;
 
 	#ifdef HAVE_CLFFT
 	cl::CommandQueue* m_queue;
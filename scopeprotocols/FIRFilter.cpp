@@ -30,6 +30,7 @@
 #include "scopeprotocols.h"
 #include "FIRFilter.h"
 #include <immintrin.h>
+#include <omp.h>
 
 using namespace std;
 
@@ -74,6 +75,12 @@ FIRFilter::FIRFilter(const string& color)
 
 	m_parameters[m_freqHighName] = FilterParameter(FilterParameter::TYPE_FLOAT, Unit(Unit::UNIT_HZ));
 	m_parameters[m_freqHighName].SetFloatVal(100e6);
+
+	m_cachedFFTLength = 0;
+}
+
+FIRFilter::~FIRFilter()
+{
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -258,7 +265,9 @@ void FIRFilter::DoFilterKernel(
 	else
 	#endif
 
-	if(g_hasAvx512F)
+	if(coefficients.size() >= FFT_CROSSOVER_TAPS)
+		DoFilterKernelFFT(coefficients, din, cap, vmin, vmax);
+	else if(g_hasAvx512F)
 		DoFilterKernelAVX512F(coefficients, din, cap, vmin, vmax);
 	else if(g_hasAvx2)
 		DoFilterKernelAVX2(coefficients, din, cap, vmin, vmax);
@@ -612,6 +621,135 @@ void FIRFilter::DoFilterKernelAVX512F(
 	}
 }
 
+/**
+	@brief Recalculates the FFT block size, plans, and kernel spectrum if the filter coefficients changed
+ */
+void FIRFilter::UpdateFFTState(vector<float>& coefficients)
+{
+	size_t filterlen = coefficients.size();
+
+	//Pick a block size big enough that most of each block is useful output, but small enough to stay in cache
+	size_t fftlen = 1024;
+	while(fftlen < 8*filterlen)
+		fftlen *= 2;
+
+	if(fftlen != m_cachedFFTLength)
+	{
+		m_forwardPlan.Reset(fftlen, FFTS_FORWARD);
+		m_reversePlan.Reset(fftlen, FFTS_BACKWARD);
+
+		m_cachedFFTLength = fftlen;
+		m_cachedCoefficients.clear();
+	}
+
+	//Kernel spectrum only needs to be recalculated if the filter changed
+	if(coefficients == m_cachedCoefficients)
+		return;
+	m_cachedCoefficients = coefficients;
+
+	//We're doing a correlation, so the convolution kernel is the reversed coefficient list.
+	//Normalize for the unscaled inverse transform while we're at it.
+	float* kernel = FFTPlanCache::GetScratchBuffer(0, fftlen);
+	float scale = 1.0f / fftlen;
+	for(size_t i=0; i<filterlen; i++)
+		kernel[i] = coefficients[filterlen - 1 - i] * scale;
+	for(size_t i=filterlen; i<fftlen; i++)
+		kernel[i] = 0;
+
+	m_kernelSpectrum.resize(fftlen + 2);
+	ffts_execute(m_forwardPlan.Get(), kernel, &m_kernelSpectrum[0]);
+}
+
+/**
+	@brief Performs a FIR filter in the frequency domain using the overlap-save method
+
+	Much faster than direct form for long filters (cost per sample is logarithmic rather than linear in filter length).
+	Blocks are independent so they're processed in parallel.
+ */
+void FIRFilter::DoFilterKernelFFT(
+	vector<float>& coefficients,
+	AnalogWaveform* din,
+	AnalogWaveform* cap,
+	float& vmin,
+	float& vmax)
+{
+	UpdateFFTState(coefficients);
+
+	//Setup
+	vmin = FLT_MAX;
+	vmax = -FLT_MAX;
+	size_t len = din->m_samples.size();
+	size_t filterlen = coefficients.size();
+	size_t end = len - filterlen;
+	if(len <= filterlen)
+		return;
+	size_t fftlen = m_cachedFFTLength;
+	size_t nouts = fftlen/2 + 1;
+
+	//Each block of fftlen inputs produces this many valid outputs (the rest are corrupted by circular wraparound)
+	size_t stride = fftlen - filterlen + 1;
+	size_t nblocks = (end + stride - 1) / stride;
+
+	float* pin = (float*)&din->m_samples[0];
+	float* pout = (float*)&cap->m_samples[0];
+	float* pkernel = &m_kernelSpectrum[0];
+
+	#pragma omp parallel
+	{
+		//Plans and scratch buffers are per thread
+		float* inbuf = FFTPlanCache::GetScratchBuffer(0, fftlen);
+		float* specbuf = FFTPlanCache::GetScratchBuffer(1, fftlen + 2);
+		float* outbuf = FFTPlanCache::GetScratchBuffer(2, fftlen);
+		ffts_plan_t* forwardPlan = m_forwardPlan.Get();
+		ffts_plan_t* reversePlan = m_reversePlan.Get();
+
+		float tmin = FLT_MAX;
+		float tmax = -FLT_MAX;
+
+		#pragma omp for nowait
+		for(size_t b=0; b<nblocks; b++)
+		{
+			//Copy the input block, zero padding past the end of the waveform
+			size_t start = b*stride;
+			size_t count = min(fftlen, len - start);
+			memcpy(inbuf, pin + start, count * sizeof(float));
+			for(size_t i=count; i<fftlen; i++)
+				inbuf[i] = 0;
+
+			//Multiply by the kernel spectrum
+			ffts_execute(forwardPlan, inbuf, specbuf);
+			for(size_t i=0; i<nouts; i++)
+			{
+				float re = specbuf[i*2];
+				float im = specbuf[i*2 + 1];
+				float kre = pkernel[i*2];
+				float kim = pkernel[i*2 + 1];
+				specbuf[i*2]		= re*kre - im*kim;
+				specbuf[i*2 + 1]	= re*kim + im*kre;
+			}
+			ffts_execute(reversePlan, specbuf, outbuf);
+
+			//Keep the valid part of the output
+			size_t nvalid = min(stride, end - start);
+			float* src = outbuf + filterlen - 1;
+			float* dst = pout + start;
+			for(size_t i=0; i<nvalid; i++)
+			{
+				float v = src[i];
+				tmin = min(tmin, v);
+				tmax = max(tmax, v);
+				dst[i] = v;
+			}
+		}
+
+		#pragma omp critical
+		{
+			vmin = min(vmin, tmin);
+			vmax = max(vmax, tmax);
+		}
+	}
+}
+
 /**
 	@brief Calculates FIR coefficients
 
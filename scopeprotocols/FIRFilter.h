@@ -35,6 +35,9 @@
 #ifndef FIRFilter_h
 #define FIRFilter_h
 
+#include "../scopehal/AlignedAllocator.h"
+#include "../scopehal/FFTPlanCache.h"
+
 /**
 	@brief Performs an arbitrary FIR filter with tap delay equal to the sample rate
  */
@@ -42,6 +45,7 @@ class FIRFilter : public Filter
 {
 public:
 	FIRFilter(const std::string& color);
+	virtual ~FIRFilter();
 
 	virtual void Refresh();
 
@@ -115,6 +119,26 @@ protected:
 		float& vmin,
 		float& vmax);
 
+	void DoFilterKernelFFT(
+		std::vector<float>& coefficients,
+		AnalogWaveform* din,
+		AnalogWaveform* cap,
+		float& vmin,
+		float& vmax);
+
+	void UpdateFFTState(std::vector<float>& coefficients);
+
+	///Filters at least this long are run in the frequency domain
+	static const size_t FFT_CROSSOVER_TAPS = 128;
+
+	//Overlap-save FFT convolution state
+	typedef std::vector<float, AlignedAllocator<float, 64> > AlignedFloatVector;
+	size_t m_cachedFFTLength;
+	std::vector<float> m_cachedCoefficients;
+	AlignedFloatVector m_kernelSpectrum;
+	FFTPlan m_forwardPlan;
+	FFTPlan m_reversePlan;
+
 	float m_min;
 	float m_max;
 	float m_range;
@@ -120,47 +120,48 @@ void HistogramFilter::Refresh()
 	auto din = GetAnalogInputWaveform(0);
 	m_xAxisUnit = GetInput(0).GetYAxisUnits();
 
-	//Calculate min/max of the input data
-	float nmin = FLT_MAX;
-	float nmax = -FLT_MAX;
-	for(float v : din->m_samples)
-	{
-		nmin = min(nmin, v);
-		nmax = max(nmax, v);
-	}
-
-	//Calculate bin count
+	//If we already have a range, bin the new data against it and find its min/max in the same pass.
+	//The range rarely needs to grow once the histogram has settled, so most waveforms are only scanned once.
 	auto cap = dynamic_cast<AnalogWaveform*>(GetData(0));
-
-	//If the signal is outside our current range, extend our range
-	bool reallocate = false;
-	float range = m_max - m_min;
+	float nmin;
+	float nmax;
+	vector<size_t> data;
+	if(cap != NULL)
+		data = MakeHistogram(din, m_min, m_max, m_histogram.size(), nmin, nmax);
+	else
+		GetMinMaxVoltage(din, nmin, nmax);
+
+	//For now, 100fs per bin.
+	//Bins are aligned to multiples of the bin size, so extending the range only adds bins at the ends and
+	//everything we've accumulated so far can be kept.
+	const float binsize = 100;
+
+	//If the signal is outside our current range, extend our range and bin it again
 	if( (nmin < m_min) || (nmax > m_max) || (cap == NULL) )
 	{
-		m_min = min(nmin, m_min);
-		m_max = max(nmax, m_max);
+		float newmin = min(nmin, m_min);
+		float newmax = max(nmax, m_max);
 
 		//Extend the range by a bit to avoid constant reallocation
-		range = m_max - m_min;
-		m_min -= 0.05 * range;
-		m_max += 0.05 * range;
-		range = m_max - m_min;
-
-		reallocate = true;
-	}
-
-	//Calculate histogram for our incoming data
-	//For now, 100fs per bin target
-	size_t bins = ceil(range) / 100;
-	auto data = MakeHistogram(din, m_min, m_max, bins);
-
-	//Calculate bin configuration.
-	//Clip bin size to nearest ps (this will stop being a problem when we move to fs)
-	float binsize = range / bins;
+		float range = newmax - newmin;
+		newmin = floor( (newmin - 0.05 * range) / binsize ) * binsize;
+		newmax = ceil( (newmax + 0.05 * range) / binsize ) * binsize;
+		if(newmax <= newmin)
+			newmax = newmin + binsize;
+		size_t bins = round( (newmax - newmin) / binsize);
+
+		//Move existing counts to their new location
+		vector<size_t> hist(bins, 0);
+		if(!m_histogram.empty())
+		{
+			size_t shift = round( (m_min - newmin) / binsize);
+			for(size_t i=0; i<m_histogram.size(); i++)
+				hist[i + shift] = m_histogram[i];
+		}
+		m_histogram.swap(hist);
+		m_min = newmin;
+		m_max = newmax;
 
-	//Reallocate the histogram if we changed it
-	if(reallocate)
-	{
 		//Reallocate our waveform
 		cap = new AnalogWaveform;
 		cap->m_timescale = 1;
@@ -168,20 +169,19 @@ void HistogramFilter::Refresh()
 		cap->m_startFemtoseconds = din->m_startFemtoseconds;
 		SetData(cap, 0);
 
-		//Set up timestamps and initial values
+		//Set up timestamps
+		cap->Resize(bins);
 		for(size_t i=0; i<bins; i++)
 		{
-			cap->m_offsets.push_back(m_min + binsize*i);
-			cap->m_durations.push_back(binsize);
-			cap->m_samples.push_back(0);
+			cap->m_offsets[i] = m_min + binsize*i;
+			cap->m_durations[i] = binsize;
 		}
 
-		m_histogram.clear();
-		for(size_t i=0; i<bins; i++)
-			m_histogram.push_back(0);
+		data = MakeHistogram(din, m_min, m_max, bins);
 	}
 
 	//Update histogram
+	size_t bins = m_histogram.size();
 	size_t vmax = 0;
 	for(size_t i=0; i<bins; i++)
 	{
@@ -192,6 +192,7 @@ void HistogramFilter::Refresh()
 	//Generate output
 	for(size_t i=0; i<bins; i++)
 		cap->m_samples[i] 	= m_histogram[i];
+	cap->MarkModified();
 
 	vmax *= 1.05;
 	m_range = vmax + 2;
@@ -35,6 +35,7 @@
 
 #include "../scopehal/scopehal.h"
 #include "IBM8b10bDecoder.h"
+#include <omp.h>
 
 using namespace std;
 
@@ -106,97 +107,250 @@ void IBM8b10bDecoder::Refresh()
 	auto din = GetDigitalInputWaveform(0);
 	auto clkin = GetDigitalInputWaveform(1);
 
+	//Record the value of the data stream at each clock edge
+	//TODO: allow single rate clocks too?
+	DigitalWaveform data;
+	SampleOnAnyEdges(din, clkin, data);
+
+	//Need at least two full symbols to find alignment
+	size_t len = data.m_samples.size();
+	if(len < 21)
+	{
+		SetData(NULL, 0);
+		return;
+	}
+
+	//Pack the sampled bits into words (with a zero word of padding at the end for unaligned extraction)
+	size_t nwords = (len + 63) / 64;
+	vector<uint64_t> bits(nwords + 1, 0);
+	PackBits(&data, 0, len, &bits[0]);
+
+	//Find symbol alignment
+	size_t max_offset = FindCommaOffset(bits, len);
+
 	//Create the capture
 	auto cap = new IBM8b10bWaveform;
 	cap->m_timescale = 1;
 	cap->m_startTimestamp = din->m_startTimestamp;
 	cap->m_startFemtoseconds = din->m_startFemtoseconds;
 
-	//Record the value of the data stream at each clock edge
-	//TODO: allow single rate clocks too?
-	DigitalWaveform data;
-	SampleOnAnyEdges(din, clkin, data);
+	size_t dlen = len - 11;
+	size_t nsymbols = 0;
+	if(max_offset < dlen)
+		nsymbols = (dlen - max_offset + 9) / 10;
+	cap->Resize(nsymbols);
+
+	//Table-driven decode of each code group. Everything except running disparity is a pure function of the
+	//code group, so symbols can be decoded in any order.
+	auto table = GetDecodeTable();
+	#pragma omp parallel for
+	for(size_t n=0; n<nsymbols; n++)
+	{
+		size_t i = max_offset + n*10;
 
-	//Look for commas in the data stream
-	//TODO: make this more efficient?
-	size_t max_commas = 0;
-	size_t max_offset = 0;
-	for(size_t offset=0; offset < 10; offset ++)
+		//Grab the 10 bits of the code group (first bit in the LSB)
+		size_t q = i >> 6;
+		size_t r = i & 63;
+		uint64_t word = bits[q] >> r;
+		if(r > 54)
+			word |= bits[q+1] << (64 - r);
+		auto& e = table[word & 0x3ff];
+
+		//Horizontally shift the decoded symbol back by half a UI
+		//since the recovered clock edge is in the middle of the UI.
+		//We want the decoded signal boundaries to line up with the data edge, not the middle of the UI.
+		cap->m_offsets[n] = data.m_offsets[i] - data.m_durations[i]/2;
+		cap->m_durations[n] = data.m_offsets[i+10] - data.m_offsets[i];
+
+		//Temporarily stash the net disparity of the code group in the output, it's resolved below
+		cap->m_samples[n] = IBM8b10bSymbol(e.m_control, e.m_error, e.m_data, e.m_disparity);
+	}
+
+	//Disparity tracking.
+	//The running disparity only ever takes on one of four values, so split the symbols into blocks and find the
+	//ending state of each block for every possible starting state in parallel. Then chain the blocks together
+	//serially (cheap, one step per block) and finally fill in the actual disparity of each symbol in parallel.
+	if(nsymbols)
 	{
-		size_t num_commas = 0;
-		size_t dlen = data.m_samples.size() - 20;
-		for(size_t i=0; i<dlen; i += 10)
+		//The initial disparity is chosen to be consistent with the first symbol
+		int first_disp = (cap->m_samples[0].m_disparity < 0) ? 1 : -1;
+
+		size_t numblocks = 1;
+		if(nsymbols > 100000)
+			numblocks = omp_get_max_threads();
+		size_t lastblock = numblocks - 1;
+		size_t blocksize = nsymbols / numblocks;
+
+		//Disparity states -3, -1, 1, 3 map to indexes 0...3
+		vector<int> endstates(numblocks * 4);
+
+		#pragma omp parallel for
+		for(size_t b=0; b<numblocks; b++)
 		{
-			/*
-			//Check if we have a comma (five identical bits) anywhere in the data stream
-			//Commas are always at positions 2...6 within the symbol (left-right bit ordering)
-			bool comma = true;
-			for(int j=3; j<=6; j++)
+			size_t start = b*blocksize;
+			size_t end = (b == lastblock) ? nsymbols : start + blocksize;
+			for(int k=0; k<4; k++)
 			{
-				if(data.m_samples[i+offset+j] != data.m_samples[i+offset+2])
-				{
-					comma = false;
-					break;
-				}
+				int disp = k*2 - 3;
+				bool disperr;
+				for(size_t n=start; n<end; n++)
+					disp = UpdateDisparity(disp, cap->m_samples[n].m_disparity, disperr);
+				endstates[b*4 + k] = disp;
 			}
-			*/
-
-			//Look for K28.5 symbols only.
-			bool comma = false;
-			if(	!data.m_samples[i+offset+0] &&
-				!data.m_samples[i+offset+1] &&
-				data.m_samples[i+offset+2] &&
-				data.m_samples[i+offset+3] &&
-				data.m_samples[i+offset+4] &&
-				data.m_samples[i+offset+5] &&
-				data.m_samples[i+offset+6] &&
-				!data.m_samples[i+offset+7] &&
-				data.m_samples[i+offset+8] &&
-				!data.m_samples[i+offset+9])
+		}
+
+		vector<int> startstates(numblocks);
+		startstates[0] = first_disp;
+		for(size_t b=1; b<numblocks; b++)
+			startstates[b] = endstates[(b-1)*4 + (startstates[b-1] + 3)/2];
+
+		#pragma omp parallel for
+		for(size_t b=0; b<numblocks; b++)
+		{
+			size_t start = b*blocksize;
+			size_t end = (b == lastblock) ? nsymbols : start + blocksize;
+			int disp = startstates[b];
+			for(size_t n=start; n<end; n++)
 			{
-				comma = true;
+				auto& sym = cap->m_samples[n];
+				bool disperr;
+				disp = UpdateDisparity(disp, sym.m_disparity, disperr);
+				sym.m_disparity = disp;
+				sym.m_error |= disperr;
 			}
-			if(	data.m_samples[i+offset+0] &&
-				data.m_samples[i+offset+1] &&
-				!data.m_samples[i+offset+2] &&
-				!data.m_samples[i+offset+3] &&
-				!data.m_samples[i+offset+4] &&
-				!data.m_samples[i+offset+5] &&
-				!data.m_samples[i+offset+6] &&
-				data.m_samples[i+offset+7] &&
-				!data.m_samples[i+offset+8] &&
-				data.m_samples[i+offset+9])
+		}
+	}
+
+	SetData(cap, 0);
+}
+
+/**
+	@brief Updates the running disparity after a code group
+
+	@param last_disp	Running disparity before the code group
+	@param total_disp	Net disparity of the code group
+	@param disperr		Set true if the code group violates the running disparity rules
+
+	@return Running disparity after the code group
+ */
+int IBM8b10bDecoder::UpdateDisparity(int last_disp, int total_disp, bool& disperr)
+{
+	disperr = false;
+	if(total_disp > 0 && last_disp > 0)
+	{
+		disperr = true;
+		return 1;
+	}
+	else if(total_disp < 0 && last_disp < 0)
+	{
+		disperr = true;
+		return -1;
+	}
+	else
+		return last_disp + total_disp;
+}
+
+/**
+	@brief Finds the bit offset (0-9) of symbol boundaries in the data stream
+
+	Looks for K28.5 symbols at every bit position simultaneously, 64 positions per step: each word of the result is
+	the AND of ten shifted copies of the packed data stream (inverted where the comma pattern has a zero), for both
+	running disparities. The offset with the most commas wins.
+
+	@param bits		Packed data, with at least one word of padding at the end
+	@param len		Number of valid bits
+ */
+size_t IBM8b10bDecoder::FindCommaOffset(const vector<uint64_t>& bits, size_t len)
+{
+	//K28.5 in transmission order, RD- (the RD+ form is the complement)
+	static const bool comma[10] = { 0, 0, 1, 1, 1, 1, 1, 0, 1, 0 };
+
+	//Only look for commas starting at positions i+offset with i a multiple of 10 less than len-20
+	size_t dlen = len - 20;
+	size_t maxpos = dlen + 9;
+	size_t nwords = (maxpos + 63) / 64;
+
+	//Extract 64 bits starting at an arbitrary bit position
+	auto extract = [&bits](size_t pos)
+	{
+		size_t q = pos >> 6;
+		size_t r = pos & 63;
+		if(r == 0)
+			return bits[q];
+		return (bits[q] >> r) | (bits[q+1] << (64 - r));
+	};
+
+	size_t counts[10] = {0};
+	#pragma omp parallel
+	{
+		size_t localcounts[10] = {0};
+
+		#pragma omp for nowait
+		for(size_t q=0; q<nwords; q++)
+		{
+			uint64_t neg = ~0ULL;
+			uint64_t pos = ~0ULL;
+			for(size_t j=0; j<10; j++)
 			{
-				comma = true;
+				uint64_t x = extract(q*64 + j);
+				if(comma[j])
+				{
+					neg &= x;
+					pos &= ~x;
+				}
+				else
+				{
+					neg &= ~x;
+					pos &= x;
+				}
 			}
 
-			if(comma)
-				num_commas ++;
+			//Tally commas by alignment
+			uint64_t found = neg | pos;
+			while(found)
+			{
+				size_t p = q*64 + __builtin_ctzll(found);
+				found &= (found - 1);
+
+				size_t offset = p % 10;
+				if(p - offset < dlen)
+					localcounts[offset] ++;
+			}
 		}
-		if(num_commas > max_commas)
+
+		#pragma omp critical
 		{
-			max_commas = num_commas;
-			max_offset = offset;
+			for(size_t i=0; i<10; i++)
+				counts[i] += localcounts[i];
 		}
-		//LogTrace("Found %zu commas at offset %zu\n", num_commas, offset);
 	}
 
-	//Decode the actual data
-	bool first = true;
-	int last_disp = -1;
-	size_t dlen = data.m_samples.size() - 11;
-	for(size_t i=max_offset; i<dlen; i+= 10)
+	size_t max_commas = 0;
+	size_t max_offset = 0;
+	for(size_t offset=0; offset<10; offset++)
 	{
-		//5b/6b decode
+		if(counts[offset] > max_commas)
+		{
+			max_commas = counts[offset];
+			max_offset = offset;
+		}
+		//LogTrace("Found %zu commas at offset %zu\n", counts[offset], offset);
+	}
+	return max_offset;
+}
+
+/**
+	@brief Gets the decode table for all 1024 possible code groups
 
-		uint8_t code6 =
-			(data.m_samples[i+0] ? 32 : 0) |
-			(data.m_samples[i+1] ? 16 : 0) |
-			(data.m_samples[i+2] ? 8 : 0) |
-			(data.m_samples[i+3] ? 4 : 0) |
-			(data.m_samples[i+4] ? 2 : 0) |
-			(data.m_samples[i+5] ? 1 : 0);
+	The table is indexed by the raw code group with the first transmitted bit in the LSB.
+ */
+const IBM8b10bDecoder::DecodeEntry* IBM8b10bDecoder::GetDecodeTable()
+{
+	static DecodeEntry table[1024];
+	static once_flag built;
 
+	call_once(built, []()
+	{
 		static const int code5_table[64] =
 		{
 			 0,  0,  0,  0,  0, 23,  8,  7,	//00-07
@@ -245,18 +399,6 @@ void IBM8b10bDecoder::Refresh()
 			false, false, false, false, false, false, false, false  //38-3f
 		};
 
-		int code5 = code5_table[code6];
-		int disp5 = disp5_table[code6];
-		bool err5 = err5_table[code6];
-		bool ctl5 = ctl5_table[code6];
-
-		//3b/4b decode
-		uint8_t code4 =
-			(data.m_samples[i+6] ? 8 : 0) |
-			(data.m_samples[i+7] ? 4 : 0) |
-			(data.m_samples[i+8] ? 2 : 0) |
-			(data.m_samples[i+9] ? 1 : 0);
-
 		static const bool err3_ctl_table[16] =
 		{
 			 true,  true, false, false, false, false, false, false,
@@ -300,88 +442,60 @@ void IBM8b10bDecoder::Refresh()
 			1, 0, 0, 0, 0, 0, 0, 0
 		};
 
-		int code3 = false;
-		int disp3 = 0;
-		int err3 = false;
-		if(ctl5)
+		for(unsigned int raw=0; raw<1024; raw++)
 		{
-			if(disp5 >= 0)
-				code3 = code3_pos_ctl_table[code4];
-			else
-				code3 = code3_neg_ctl_table[code4];
-			err3 = err3_ctl_table[code4];
-		}
-		else
-		{
-			code3 = code3_table[code4];
-			err3 = err3_table[code4];
-		}
-		disp3 = disp3_table[code4];
+			//Reverse bit order so the first transmitted bit is the MSB
+			unsigned int code10 = 0;
+			for(int j=0; j<10; j++)
+			{
+				if(raw & (1 << j))
+					code10 |= (1 << (9 - j));
+			}
 
-		//Disparity tracking
-		int total_disp = disp3 + disp5;
-		if(first)
-		{
-			if(total_disp < 0)
-				last_disp = 1;
+			//5b/6b decode
+			uint8_t code6 = code10 >> 4;
+			int code5 = code5_table[code6];
+			int disp5 = disp5_table[code6];
+			bool err5 = err5_table[code6];
+			bool ctl5 = ctl5_table[code6];
+
+			//3b/4b decode
+			uint8_t code4 = code10 & 0xf;
+			int code3 = false;
+			int disp3 = 0;
+			int err3 = false;
+			if(ctl5)
+			{
+				if(disp5 >= 0)
+					code3 = code3_pos_ctl_table[code4];
+				else
+					code3 = code3_neg_ctl_table[code4];
+				err3 = err3_ctl_table[code4];
+			}
 			else
-				last_disp = -1;
-			first = false;
-		}
-
-		bool disperr = false;
-		//int old_disp = last_disp;
-		if(total_disp > 0 && last_disp > 0)
-		{
-			disperr = true;
-			last_disp = 1;
-		}
-		else if(total_disp < 0 && last_disp < 0)
-		{
-			disperr = true;
-			last_disp = -1;
-		}
-		else
-			last_disp += total_disp;
-
-		//Special processing for a few control codes that use the .A7 format
-		bool alt = alt3_table[code4];
-		if(alt)
-		{
-			if( (code5 == 23) || (code5 == 27) || (code5 == 29) || (code5 == 30) )
-				ctl5 = true;
-		}
-
-		//Horizontally shift the decoded symbol back by half a UI
-		//since the recovered clock edge is in the middle of the UI.
-		//We want the decoded signal boundaries to line up with the data edge, not the middle of the UI.
-		cap->m_offsets.push_back(data.m_offsets[i] - data.m_durations[i]/2);
+			{
+				code3 = code3_table[code4];
+				err3 = err3_table[code4];
+			}
+			disp3 = disp3_table[code4];
 
-		cap->m_durations.push_back(data.m_offsets[i+10] - data.m_offsets[i]);
-		cap->m_samples.push_back(IBM8b10bSymbol(ctl5, err5 || err3 || disperr, (code3 << 5) | code5, last_disp));
+			//Special processing for a few control codes that use the .A7 format
+			bool alt = alt3_table[code4];
+			if(alt)
+			{
+				if( (code5 == 23) || (code5 == 27) || (code5 == 29) || (code5 == 30) )
+					ctl5 = true;
+			}
 
-		if(err5 || err3 || disperr)
-		{
-			/*LogDebug(
-				"Symbol %zu (ctl5 = %d, err5 = %d, err3=%d, disperr=%d, code3=%d, code5=%d, "
-					"old_disp = %d, total_disp = %d, disp3 = %d, disp5 = %d)\n",
-				i,
-				ctl5, err5, err3, disperr, code3, code5, old_disp, total_disp, disp3, disp5);*/
+			auto& e = table[raw];
+			e.m_data = (code3 << 5) | code5;
+			e.m_control = ctl5;
+			e.m_error = err5 || err3;
+			e.m_disparity = disp3 + disp5;
 		}
-		/*
-		else
-		{
-			if(ctl5)
-				LogDebug("K%d.%d, disp=%d (old_disp = %d, disp3=%d, disp5=%d)\n",
-					code5, code3, last_disp, old_disp, disp3, disp5);
-			else
-				LogDebug("D%d.%d, disp=%d (old_disp = %d, disp3=%d, disp5=%d)\n",
-					code5, code3, last_disp, old_disp,disp3, disp5);
-		}
-		*/
-	}
+	});
 
-	SetData(cap, 0);
+	return table;
 }
 
 Gdk::Color IBM8b10bDecoder::GetColor(int i)
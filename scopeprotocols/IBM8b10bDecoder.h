@@ -90,6 +90,22 @@ public:
 	PROTOCOL_DECODER_INITPROC(IBM8b10bDecoder)
 
 protected:
+
+	/**
+		@brief Precomputed decode of a single 10-bit code group
+	 */
+	struct DecodeEntry
+	{
+		uint8_t m_data;
+		bool m_control;
+		bool m_error;
+		int8_t m_disparity;		//net disparity of the code group
+	};
+
+	static const DecodeEntry* GetDecodeTable();
+	static size_t FindCommaOffset(const std::vector<uint64_t>& bits, size_t len);
+	static int UpdateDisparity(int last_disp, int total_disp, bool& disperr);
+
 	std::string m_displayformat;
 };
 
@@ -46,6 +46,11 @@ JitterSpectrumFilter::JitterSpectrumFilter(const string& color)
 
 	m_range = 1000;
 	m_offset = -500;
+
+	//We always do a single FFT of the entire record
+	m_parameters.erase(m_modeName);
+	m_parameters.erase(m_segmentLengthName);
+	m_parameters.erase(m_overlapName);
 }
 
 JitterSpectrumFilter::~JitterSpectrumFilter()
@@ -91,86 +96,112 @@ void JitterSpectrumFilter::SetDefaultName()
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Actual decoder logic
 
+/**
+	@brief Makes a rough estimate of the unit interval from the durations of the first few thousand TIE samples
+
+	@return UI width in input timebase units, or zero if no estimate could be made
+ */
 size_t JitterSpectrumFilter::EstimateUIWidth(AnalogWaveform* din)
 {
-	//Make a histogram of sample durations.
 	//Sample no more than 5K UIs since this is just a rough estimate.
 	size_t inlen = din->m_samples.size();
 	inlen = min(inlen, (size_t)5000);
-	map<int64_t, size_t> durations;
-	int64_t maxdur = 0;
+	vector<int64_t> durations;
+	durations.reserve(inlen);
 	for(size_t i=0; i<inlen; i++)
 	{
-		int64_t dur = din->m_durations[i] / 1000;	//convert to ps, we dont need stupidly high resolution here
-													//and this makes the histogram much smaller
-		maxdur = max(dur, maxdur);
+		int64_t dur = din->m_durations[i];
 		if(dur > 0)
-			durations[dur] ++;
+			durations.push_back(dur);
+	}
+	if(durations.empty())
+		return 0;
+
+	//Runs of one UI are the most common in any reasonable line code, so the 10th percentile duration is close to a
+	//single UI. Use it to size a flat histogram with ~1000 bins per UI covering runs of up to 32 UIs. Longer runs
+	//(idle periods etc) don't help find the UI and would make the histogram enormous.
+	auto p10 = durations.begin() + durations.size() / 10;
+	nth_element(durations.begin(), p10, durations.end());
+	int64_t binsize = max((int64_t)1, *p10 / 1000);
+	int64_t nbins = 32 * (*p10 / binsize) + 1;
+	vector<size_t> hist(nbins, 0);
+	for(auto dur : durations)
+	{
+		int64_t bin = dur / binsize;
+		if(bin < nbins)
+			hist[bin] ++;
 	}
 
 	//Find peaks in the histogram.
 	//These should occur at integer multiples of the unit interval.
 	vector<int64_t> peaks;
-	for(auto it : durations)
+	for(int64_t bin=1; bin<nbins; bin++)
 	{
-		//See if this is a peak
-		int64_t dur = it.first;
-		int64_t leftbound = dur * 90 / 100;
-		int64_t rightbound = dur * 110 / 100;
-		size_t target = it.second;
+		size_t target = hist[bin];
+		if(target == 0)
+			continue;
 
+		//See if this is a peak
+		int64_t leftbound = bin * 90 / 100;
+		int64_t rightbound = min(bin * 110 / 100, nbins-1);
 		bool peak = true;
 		for(int64_t i=leftbound; i<=rightbound; i++)
 		{
-			auto jt = durations.find(i);
-			if(jt == durations.end())
-				continue;
-			if(jt->second > target)
+			if(hist[i] > target)
+			{
 				peak = false;
+				break;
+			}
 		}
 		if(peak)
-			peaks.push_back(dur);
+			peaks.push_back(bin);
 	}
 
 	//The lowest peak that's still reasonably tall is our estimated UI.
 	//This doesn't need to be super precise yet (up to 20% error should be pretty harmless).
 	//At this point, we just need an approximate threshold for determining how many UIs apart two edges are.
 	size_t max_height = 0;
-	for(auto dur : peaks)
-		max_height = max(max_height, durations[dur]);
-	int64_t ui_width = 0;
+	for(auto bin : peaks)
+		max_height = max(max_height, hist[bin]);
+	int64_t ui_bin = 0;
 	size_t threshold_height = max_height / 10;
-	for(auto dur : peaks)
+	for(auto bin : peaks)
 	{
-		if(durations[dur] > threshold_height)
+		if(hist[bin] > threshold_height)
 		{
-			ui_width = dur;
+			ui_bin = bin;
 			break;
 		}
 	}
 
-	LogTrace("Initial UI width estimate: %zu\n", ui_width);
+	LogTrace("Initial UI width estimate: %zu\n", (size_t)(ui_bin * binsize));
 
 	//Take a weighted average to smooth out the peak location somewhat.
-	int64_t leftbound = ui_width * 90 / 100;
-	int64_t rightbound = ui_width * 110 / 100;
+	int64_t leftbound = ui_bin * 90 / 100;
+	int64_t rightbound = min(ui_bin * 110 / 100, nbins-1);
 	size_t ui_width_samples = 0;
-	ui_width = 0;
+	double ui_width = 0;
 	for(int64_t i=leftbound; i<=rightbound; i++)
 	{
-		auto jt = durations.find(i);
-		if(jt == durations.end())
-			continue;
-		ui_width_samples += jt->second;
-		ui_width += jt->first * jt->second;
+		ui_width_samples += hist[i];
+		ui_width += (i*binsize + binsize/2) * hist[i];
 	}
+	if(ui_width_samples == 0)
+		return 0;
 	ui_width /= ui_width_samples;
-	LogTrace("Averaged UI width estimate: %zu\n", ui_width);
+	LogTrace("Averaged UI width estimate: %zu\n", (size_t)ui_width);
 
-	ui_width *= 1000;	//convert back to fs
 	return ui_width;
 }
 
+/**
+	@brief Calculates the jitter spectrum
+
+	TIE samples only exist where the signal has an edge, so the input is an irregularly sampled series on a grid of
+	unit intervals. Rather than expanding it to one sample per UI and running a plain FFT, we fit a sinusoid to the
+	samples at each frequency (Lomb-Scargle periodogram). The fast form of Press and Rybicki needs just two FFTs on the
+	UI grid: one of the weighted samples and one of the sampling weights.
+ */
 void JitterSpectrumFilter::Refresh()
 {
 	//Make sure we've got valid inputs
@@ -184,38 +215,148 @@ void JitterSpectrumFilter::Refresh()
 	//Get an initial estimate of the UI width for the waveform
 	size_t inlen = din->m_samples.size();
 	size_t ui_width = EstimateUIWidth(din);
-
-	//Loop over the input and copy samples.
-	//If we have runs of identical bits, extend the same jitter value.
-	//TODO: interpolate?
-	vector<EmptyConstructorWrapper<float>, AlignedAllocator<EmptyConstructorWrapper<float>, 64>> extended_samples;
-	extended_samples.reserve(inlen);
-	for(size_t i=0; i<inlen; i++)
+	if( (inlen < 2) || (ui_width == 0) )
 	{
-		int64_t nui = round(1.0 * din->m_durations[i] / ui_width);
-		for(int64_t j=0; j<nui; j++)
-			extended_samples.push_back(din->m_samples[i]);
+		SetData(NULL, 0);
+		return;
 	}
 
 	//Refine our estimate of the final UI width.
 	//This needs to be fairly precise as the timebase for converting FFT bins to frequency is derived from it.
-	size_t capture_duration = din->m_offsets[inlen-1] + din->m_durations[inlen-1];
-	size_t num_uis = extended_samples.size();
+	int64_t tstart = din->m_offsets[0];
+	int64_t capture_duration = din->m_offsets[inlen-1] + din->m_durations[inlen-1] - tstart;
+	size_t num_uis = max((int64_t)1, (int64_t)round(1.0 * capture_duration / ui_width));
 	double ui_width_final = static_cast<double>(capture_duration) / num_uis;
 	LogTrace("Capture is %zu UIs, %s\n", num_uis, Unit(Unit::UNIT_FS).PrettyPrint(capture_duration).c_str());
 	LogTrace("Final UI width estimate: %s\n", Unit(Unit::UNIT_FS).PrettyPrint(ui_width_final).c_str());
 
 	//Round size up to next power of two
-	const size_t npoints_raw = extended_samples.size();
-	const size_t npoints = next_pow2(npoints_raw);
-	LogTrace("JitterSpectrumFilter: processing %zu raw points\n", npoints_raw);
+	const size_t npoints = next_pow2(num_uis);
+	LogTrace("JitterSpectrumFilter: processing %zu edges over %zu UIs\n", inlen, num_uis);
 	LogTrace("Rounded to %zu\n", npoints);
 
 	//Reallocate buffers if size has changed
 	const size_t nouts = npoints/2 + 1;
-	if(m_cachedNumPoints != npoints_raw)
-		ReallocateBuffers(npoints_raw, npoints, nouts);
+	if(m_cachedNumPoints != num_uis)
+		ReallocateBuffers(num_uis, npoints, nouts);
+	m_weightbuf.resize(npoints);
+	m_weightoutbuf.resize(2*nouts);
+
+	//Place each sample in the UI it starts, and count how many samples landed in each UI
+	//(normally 0 or 1, but don't lose data if two edges end up in the same UI)
+	float* samples = &m_rdinbuf[0];
+	float* weights = &m_weightbuf[0];
+	memset(samples, 0, npoints * sizeof(float));
+	memset(weights, 0, npoints * sizeof(float));
+	for(size_t i=0; i<inlen; i++)
+	{
+		size_t ui = round((din->m_offsets[i] - tstart) / ui_width_final);
+		ui = min(ui, num_uis-1);
+		samples[ui] += din->m_samples[i];
+		weights[ui] += 1;
+	}
+
+	//Apply the window function to both grids, so the fit is weighted by the window
+	auto window = static_cast<WindowFunction>(m_parameters[m_windowName].GetIntVal());
+	if(window != WINDOW_RECTANGULAR)
+	{
+		ApplyWindow(samples, num_uis, samples, window);
+		ApplyWindow(weights, num_uis, weights, window);
+	}
+
+	//Remove the weighted mean so it doesn't leak into other bins through the sampling pattern
+	double weightsum = 0;
+	double samplesum = 0;
+	for(size_t i=0; i<num_uis; i++)
+	{
+		weightsum += weights[i];
+		samplesum += samples[i];
+	}
+	float mean = (weightsum > 0) ? samplesum / weightsum : 0;
+	for(size_t i=0; i<num_uis; i++)
+		samples[i] -= mean * weights[i];
+
+	//Set up output and copy time scales / configuration
+	double sample_ghz = 1e6 / ui_width_final;
+	double bin_hz = round((0.5f * sample_ghz * 1e9f) / nouts);
+	LogTrace("bin_hz: %f\n", bin_hz);
+	AnalogWaveform* cap = SetupSpectrumOutput(din, bin_hz, nouts);
+
+	ExecuteFFT(samples, &m_rdoutbuf[0], npoints);
+	ExecuteFFT(weights, &m_weightoutbuf[0], npoints);
+	CalculateAmplitudes(cap, npoints, nouts, weightsum, mean);
+
+	//Peak search
+	FindPeaks(cap);
+}
+
+/**
+	@brief Converts the two spectra into the RMS amplitude of the best fit sinusoid at each frequency
+
+	@param cap			Output waveform
+	@param npoints		FFT size
+	@param nouts		Number of output bins
+	@param weightsum	Sum of all sample weights
+	@param mean			Weighted mean of the input (reported as the DC bin)
+ */
+void JitterSpectrumFilter::CalculateAmplitudes(
+	AnalogWaveform* cap,
+	size_t npoints,
+	size_t nouts,
+	double weightsum,
+	double mean)
+{
+	const float* spec = &m_rdoutbuf[0];
+	const float* wspec = &m_weightoutbuf[0];
+	const float w = weightsum;
+	const float eps = w * 1e-6f;
+	const size_t half = npoints / 2;
+
+	cap->m_samples[0] = fabs(mean);
+
+	#pragma omp parallel for if(nouts > 1000000)
+	for(size_t i=1; i<nouts; i++)
+	{
+		//Correlation of the data with cos/sin at this frequency
+		float c = spec[i*2];
+		float s = -spec[i*2 + 1];
+
+		//Correlation of the sampling weights with cos/sin at twice this frequency
+		//(the spectrum of a real signal is conjugate symmetric, so fold anything past Nyquist back down)
+		size_t i2 = 2*i;
+		float c2;
+		float s2;
+		if(i2 <= half)
+		{
+			c2 = wspec[i2*2];
+			s2 = -wspec[i2*2 + 1];
+		}
+		else
+		{
+			c2 = wspec[(npoints - i2)*2];
+			s2 = wspec[(npoints - i2)*2 + 1];
+		}
 
-	//and do the actual FFT processing
-	DoRefresh(din, extended_samples, ui_width_final, npoints, nouts, false);
+		//Time offset tau which makes the sine and cosine terms orthogonal over our sample points
+		float r = sqrtf(c2*c2 + s2*s2);
+		float cos2wt = 1;
+		float sin2wt = 0;
+		if(r > eps)
+		{
+			cos2wt = c2 / r;
+			sin2wt = s2 / r;
+		}
+		float coswt = sqrtf(max(0.0f, 0.5f * (1 + cos2wt)));
+		float sinwt = copysignf(sqrtf(max(0.0f, 0.5f * (1 - cos2wt))), sin2wt);
+
+		//Least squares fit of cosine and sine amplitudes about tau
+		float yc = c*coswt + s*sinwt;
+		float ys = s*coswt - c*sinwt;
+		float cc = 0.5f * (w + r);
+		float ss = 0.5f * (w - r);
+		float a = (cc > eps) ? yc / cc : 0;
+		float b = (ss > eps) ? ys / ss : 0;
+
+		cap->m_samples[i] = sqrtf(0.5f * (a*a + b*b));
+	}
 }
@@ -54,6 +54,11 @@ public:
 
 protected:
 	size_t EstimateUIWidth(AnalogWaveform* din);
+	void CalculateAmplitudes(AnalogWaveform* cap, size_t npoints, size_t nouts, double weightsum, double mean);
+
+	//Sampling weight at each grid point, and its spectrum
+	AlignedFloatVector m_weightbuf;
+	AlignedFloatVector m_weightoutbuf;
 };
 
 #endif
@@ -126,8 +126,9 @@ void MagnitudeFilter::Refresh()
 		fdst[i] = sqrtf(fa[i]*fa[i] + fb[i]*fb[i]);
 
 	//Calculate range of the output waveform
-	float x = GetMaxVoltage(cap);
-	float n = GetMinVoltage(cap);
+	float x;
+	float n;
+	GetMinMaxVoltage(cap, n, x);
 	m_range = x - n;
 	m_offset = (x+n)/2;
 
@@ -48,16 +48,13 @@ bool MaximumStatistic::Calculate(StreamDescriptor stream, double& value)
 	if(!data)
 		return false;
 
-	//Starting value is previous minimum, if we have one
+	//Starting value is previous maximum, if we have one
 	value = -1e20;
 	if(m_pastMaximums.find(stream) != m_pastMaximums.end())
 		value = m_pastMaximums[stream];
 
-	for(auto sample : data->m_samples)
-	{
-		if((float)sample > value)
-			value = sample;
-	}
+	if(!data->m_samples.empty())
+		value = max(value, (double)GetSampleStatistics(data).GetMax());
 
 	m_pastMaximums[stream] = value;
 	return true;
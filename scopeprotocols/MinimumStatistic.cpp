@@ -53,11 +53,8 @@ bool MinimumStatistic::Calculate(StreamDescriptor stream, double& value)
 	if(m_pastMinimums.find(stream) != m_pastMinimums.end())
 		value = m_pastMinimums[stream];
 
-	for(auto sample : data->m_samples)
-	{
-		if((float)sample < value)
-			value = sample;
-	}
+	if(!data->m_samples.empty())
+		value = min(value, (double)GetSampleStatistics(data).GetMin());
 
 	m_pastMinimums[stream] = value;
 
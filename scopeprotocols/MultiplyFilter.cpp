@@ -36,7 +36,7 @@ using namespace std;
 // Construction / destruction
 
 MultiplyFilter::MultiplyFilter(const string& color)
-	: Filter(OscilloscopeChannel::CHANNEL_TYPE_ANALOG, color, CAT_MATH)
+	: ElementwiseFilter(color, CAT_MATH)
 {
 	//Set up channels
 	CreateInput("a");
@@ -97,38 +97,33 @@ void MultiplyFilter::SetDefaultName()
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Actual decoder logic
 
-void MultiplyFilter::Refresh()
+bool MultiplyFilter::PrepareElementwise()
 {
-	//Make sure we've got valid inputs
-	if(!VerifyAllInputsOKAndAnalog())
-	{
-		SetData(NULL, 0);
-		return;
-	}
-
-	//Get the input data
-	auto a = GetAnalogInputWaveform(0);
-	auto b = GetAnalogInputWaveform(1);
-	auto len = min(a->m_samples.size(), b->m_samples.size());
-
 	//Multiply the units
 	SetYAxisUnits(m_inputs[0].GetYAxisUnits() * m_inputs[1].GetYAxisUnits(), 0);
+	return true;
+}
 
-	//Set up the output waveform
-	auto cap = SetupOutputWaveform(a, 0, 0, 0);
-	cap->m_samples.resize(len);
-	cap->m_offsets.resize(len);
-	cap->m_durations.resize(len);
-
-	float* fa = (float*)__builtin_assume_aligned(&a->m_samples[0], 16);
-	float* fb = (float*)__builtin_assume_aligned(&b->m_samples[0], 16);
-	float* fdst = (float*)__builtin_assume_aligned(&cap->m_samples[0], 16);
+void MultiplyFilter::ProcessElementwise(float* out, const float* const* in, size_t len)
+{
+	const float* fa = (const float*)__builtin_assume_aligned(in[0], 64);
+	const float* fb = (const float*)__builtin_assume_aligned(in[1], 64);
+	float* fdst = (float*)__builtin_assume_aligned(out, 64);
 	for(size_t i=0; i<len; i++)
 		fdst[i] = fa[i] * fb[i];
+}
+
+void MultiplyFilter::Refresh()
+{
+	ElementwiseFilter::Refresh();
 
 	//Calculate range of the output waveform
-	float x = GetMaxVoltage(cap);
-	float n = GetMinVoltage(cap);
+	auto cap = dynamic_cast<AnalogWaveform*>(GetData(0));
+	if(!cap)
+		return;
+	float x;
+	float n;
+	GetMinMaxVoltage(cap, n, x);
 	m_range = x - n;
 	m_offset = (x+n)/2;
 }
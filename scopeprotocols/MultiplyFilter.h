@@ -35,7 +35,7 @@
 #ifndef MultiplyFilter_h
 #define MultiplyFilter_h
 
-class MultiplyFilter : public Filter
+class MultiplyFilter : public ElementwiseFilter
 {
 public:
 	MultiplyFilter(const std::string& color);
@@ -54,6 +54,9 @@ public:
 	PROTOCOL_DECODER_INITPROC(MultiplyFilter)
 
 protected:
+	virtual bool PrepareElementwise();
+	virtual void ProcessElementwise(float* out, const float* const* in, size_t len);
+
 	float	m_range;
 	float	m_offset;
 };
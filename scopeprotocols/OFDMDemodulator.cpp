@@ -64,19 +64,15 @@ OFDMDemodulator::OFDMDemodulator(const string& color)
 	m_parameters[m_fftSizeName].SetIntVal(64);
 
 	m_cachedFftSize = 0;
-	m_fftPlan = NULL;
 	m_fftInputBuf = NULL;
 	m_fftOutputBuf = NULL;
 
 	//Constant 16 point FFT
-	m_fftPlan16 = ffts_init_1d(16, FFTS_FORWARD);
+	m_fftPlan16.Reset(16, FFTS_FORWARD, FFTPlanCache::TRANSFORM_COMPLEX);
 }
 
 OFDMDemodulator::~OFDMDemodulator()
 {
-	ffts_free(m_fftPlan);
-	ffts_free(m_fftPlan16);
-
 	m_allocator.deallocate(m_fftInputBuf);
 	m_allocator.deallocate(m_fftOutputBuf);
 }
@@ -214,9 +210,7 @@ void OFDMDemodulator::Refresh()
 	{
 		m_cachedFftSize = fftsize;
 
-		if(m_fftPlan)
-			ffts_free(m_fftPlan);
-		m_fftPlan = ffts_init_1d(fftsize, FFTS_FORWARD);
+		m_fftPlan.Reset(fftsize, FFTS_FORWARD, FFTPlanCache::TRANSFORM_COMPLEX);
 
 		if(m_fftInputBuf)
 			m_allocator.deallocate(m_fftInputBuf);
@@ -268,7 +262,7 @@ void OFDMDemodulator::Refresh()
 		}
 
 		//Do the FFT
-		ffts_execute(m_fftPlan16, m_fftInputBuf, m_fftOutputBuf);
+		ffts_execute(m_fftPlan16.Get(), m_fftInputBuf, m_fftOutputBuf);
 
 		//Process each symbol
 		for(size_t i=0; i<12; i++)
@@ -337,7 +331,7 @@ void OFDMDemodulator::Refresh()
 		}
 
 		//Run the FFT
-		ffts_execute(m_fftPlan, m_fftInputBuf, m_fftOutputBuf);
+		ffts_execute(m_fftPlan.Get(), m_fftInputBuf, m_fftOutputBuf);
 
 		//Grab each output
 		LogDebug("%zu,", i);
@@ -375,7 +369,7 @@ void OFDMDemodulator::Refresh()
 		}
 
 		//Run the FFT
-		ffts_execute(m_fftPlan, m_fftInputBuf, m_fftOutputBuf);
+		ffts_execute(m_fftPlan.Get(), m_fftInputBuf, m_fftOutputBuf);
 
 		LogDebug("%5zu,", iblock);
 
@@ -35,7 +35,7 @@
 #ifndef OFDMDemodulator_h
 #define OFDMDemodulator_h
 
-#include <ffts.h>
+#include "../scopehal/FFTPlanCache.h"
 
 class OFDMDemodulator : public Filter
 {
@@ -64,8 +64,8 @@ protected:
 	float m_min;
 	float m_max;
 
-	ffts_plan_t* m_fftPlan;
-	ffts_plan_t* m_fftPlan16;
+	FFTPlan m_fftPlan;
+	FFTPlan m_fftPlan16;
 	float* m_fftInputBuf;
 	float* m_fftOutputBuf;
 	int m_cachedFftSize;
@@ -30,6 +30,7 @@
 #include "../scopehal/scopehal.h"
 #include "PRBSCheckerFilter.h"
 #include "PRBSGeneratorFilter.h"
+#include <omp.h>
 
 using namespace std;
 
@@ -39,6 +40,8 @@ using namespace std;
 PRBSCheckerFilter::PRBSCheckerFilter(const string& color)
 	: Filter(OscilloscopeChannel::CHANNEL_TYPE_DIGITAL, color, CAT_ANALYSIS)
 	, m_polyname("Polynomial")
+	, m_errorCount(0)
+	, m_bitCount(0)
 {
 	CreateInput("Data");
 	CreateInput("Clock");
@@ -117,6 +120,12 @@ bool PRBSCheckerFilter::NeedsConfig()
 	return true;
 }
 
+void PRBSCheckerFilter::ClearSweeps()
+{
+	m_errorCount = 0;
+	m_bitCount = 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Actual decoder logic
 
@@ -162,24 +171,49 @@ void PRBSCheckerFilter::Refresh()
 	dout->m_densePacked = true;
 	dout->Resize(len);
 
+	memcpy(&dout->m_offsets[0], &data.m_offsets[0], len * sizeof(int64_t));
+	memcpy(&dout->m_durations[0], &data.m_durations[0], len * sizeof(int64_t));
+
 	//Read the first N bits of state into the seed
 	uint32_t prbs = 0;
 	for(size_t i=0; i<statesize; i++)
 	{
 		prbs = (prbs << 1) | data.m_samples[i];
-
-		dout->m_offsets[i] = data.m_offsets[i];
-		dout->m_durations[i] = data.m_durations[i];
 		dout->m_samples[i] = 0;
 	}
 
-	//Start checking actual data bits
-	for(size_t i=statesize; i<len; i++)
+	//Check actual data bits in blocks: jump the LFSR ahead to the start of each block, generate the expected
+	//sequence 64 bits at a time, and XOR against the packed data to find errors
+	size_t nbits = len - statesize;
+	const size_t blockbits = 1024 * 1024;
+	size_t numblocks = (nbits + blockbits - 1) / blockbits;
+	int64_t errors = 0;
+	#pragma omp parallel for reduction(+:errors)
+	for(size_t i=0; i<numblocks; i++)
 	{
-		dout->m_offsets[i] = data.m_offsets[i];
-		dout->m_durations[i] = data.m_durations[i];
-
-		bool value = PRBSGeneratorFilter::RunPRBS(prbs, poly);
-		dout->m_samples[i] = (value != data.m_samples[i]);
+		size_t start = i*blockbits;
+		size_t n = min(blockbits, nbits - start);
+		size_t nwords = (n + 63) / 64;
+
+		vector<uint64_t> expected(nwords);
+		vector<uint64_t> actual(nwords);
+		PRBSGeneratorFilter::GeneratePRBSBits(
+			PRBSGeneratorFilter::JumpPRBS(prbs, poly, start), poly, &expected[0], n);
+		PackBits(&data, statesize + start, n, &actual[0]);
+
+		//Clear unused bits at the end of the last word so they don't count as errors
+		if(n % 64)
+			expected[nwords-1] &= (1ULL << (n % 64)) - 1;
+
+		for(size_t j=0; j<nwords; j++)
+		{
+			expected[j] ^= actual[j];
+			errors += __builtin_popcountll(expected[j]);
+		}
+
+		UnpackBits(&expected[0], n, dout, statesize + start);
 	}
+
+	m_errorCount += errors;
+	m_bitCount += nbits;
 }
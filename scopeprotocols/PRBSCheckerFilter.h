@@ -42,16 +42,28 @@ public:
 
 	virtual void Refresh();
 	virtual bool NeedsConfig();
+	virtual void ClearSweeps();
 
 	static std::string GetProtocolName();
 	virtual void SetDefaultName();
 
 	virtual bool ValidateChannel(size_t i, StreamDescriptor stream);
 
+	///@brief Total number of bit errors seen since the last ClearSweeps()
+	int64_t GetErrorCount()
+	{ return m_errorCount; }
+
+	///@brief Total number of bits checked since the last ClearSweeps()
+	int64_t GetBitCount()
+	{ return m_bitCount; }
+
 	PROTOCOL_DECODER_INITPROC(PRBSCheckerFilter)
 
 protected:
 	std::string m_polyname;
+
+	int64_t m_errorCount;
+	int64_t m_bitCount;
 };
 
 #endif
@@ -29,6 +29,7 @@
 
 #include "../scopehal/scopehal.h"
 #include "PRBSGeneratorFilter.h"
+#include <omp.h>
 
 using namespace std;
 
@@ -158,6 +159,150 @@ bool PRBSGeneratorFilter::RunPRBS(uint32_t& state, Polynomials poly)
 	return (bool)next;
 }
 
+/**
+	@brief Gets the position of the second feedback tap of a PRBS polynomial
+
+	The first tap is always at the polynomial order, so the sequence satisfies x[k] = x[k-order] ^ x[k-tap].
+ */
+int PRBSGeneratorFilter::GetPRBSTap(Polynomials poly)
+{
+	switch(poly)
+	{
+		case POLY_PRBS7:
+			return 6;
+
+		case POLY_PRBS9:
+			return 5;
+
+		case POLY_PRBS11:
+			return 9;
+
+		case POLY_PRBS15:
+			return 14;
+
+		case POLY_PRBS23:
+			return 18;
+
+		case POLY_PRBS31:
+		default:
+			return 28;
+	}
+}
+
+/**
+	@brief Advances a PRBS generator by an arbitrary number of bits in O(log count) time.
+
+	The LFSR update is linear over GF(2), so it can be represented as an order x order bit matrix. We raise this
+	matrix to the requested power by repeated squaring and apply it to the state.
+
+	@param state	Current LFSR state, as used by RunPRBS()
+	@param poly		The polynomial
+	@param count	Number of bits to advance by
+
+	@return The state RunPRBS() would have after being called count times (bits beyond the polynomial order are zero)
+ */
+uint32_t PRBSGeneratorFilter::JumpPRBS(uint32_t state, Polynomials poly, uint64_t count)
+{
+	int order = poly;
+	int tap = GetPRBSTap(poly);
+	uint32_t mask = (order == 32) ? 0xffffffff : ((1U << order) - 1);
+
+	//Columns of the single step matrix: image of each basis vector.
+	//Bit j moves to bit j+1, and bits (order-1) and (tap-1) feed back into bit 0.
+	uint32_t step[32];
+	for(int j=0; j<order; j++)
+	{
+		uint32_t col = (1U << (j+1)) & mask;
+		if( (j == (order-1)) || (j == (tap-1)) )
+			col |= 1;
+		step[j] = col;
+	}
+
+	//Apply a matrix (given by its columns) to a state vector
+	auto apply = [order](const uint32_t* m, uint32_t v)
+	{
+		uint32_t ret = 0;
+		for(int j=0; j<order; j++)
+		{
+			if(v & (1U << j))
+				ret ^= m[j];
+		}
+		return ret;
+	};
+
+	//Square-and-multiply, applying each power of the step matrix directly to the state
+	state &= mask;
+	uint32_t tmp[32];
+	while(count)
+	{
+		if(count & 1)
+			state = apply(step, state);
+
+		for(int j=0; j<order; j++)
+			tmp[j] = apply(step, step[j]);
+		memcpy(step, tmp, sizeof(step));
+
+		count >>= 1;
+	}
+
+	return state;
+}
+
+/**
+	@brief Generates a run of PRBS bits into a packed bit vector, 64 bits at a time.
+
+	Bit i of the output (bit i % 64 of out[i / 64]) is the value returned by the i'th call to RunPRBS() starting from
+	the given state. Any unused bits at the end of the last word are undefined.
+
+	The sequence satisfies x[k] = x[k-order] ^ x[k-tap]. Squaring the characteristic polynomial over GF(2) shows that
+	it also satisfies x[k] = x[k-2*order] ^ x[k-2*tap], and so on. We pick the smallest power of two scaling for which
+	the tap distance is at least 64, at which point a whole word depends only on previously generated words and can be
+	computed with two unaligned extractions and an XOR. The first few words are generated with the scalar LFSR.
+
+	@param state	Initial LFSR state
+	@param poly		The polynomial
+	@param out		Output buffer, must have room for at least (nbits+63)/64 words
+	@param nbits	Number of bits to generate
+ */
+void PRBSGeneratorFilter::GeneratePRBSBits(uint32_t state, Polynomials poly, uint64_t* out, size_t nbits)
+{
+	size_t nwords = (nbits + 63) / 64;
+
+	size_t far = poly;
+	size_t near = GetPRBSTap(poly);
+	while(near < 64)
+	{
+		far *= 2;
+		near *= 2;
+	}
+
+	//Run the scalar generator until we have enough history for the word-parallel recurrence
+	size_t scalarbits = min(nbits, ((far + 63) / 64) * 64);
+	size_t scalarwords = (scalarbits + 63) / 64;
+	memset(out, 0, scalarwords * sizeof(uint64_t));
+	for(size_t i=0; i<scalarbits; i++)
+	{
+		if(RunPRBS(state, poly))
+			out[i >> 6] |= (1ULL << (i & 63));
+	}
+
+	//Extract 64 bits starting at an arbitrary bit position
+	auto extract = [out](size_t pos)
+	{
+		size_t q = pos >> 6;
+		size_t r = pos & 63;
+		if(r == 0)
+			return out[q];
+		return (out[q] >> r) | (out[q+1] << (64 - r));
+	};
+
+	for(size_t q=scalarwords; q<nwords; q++)
+	{
+		size_t pos = q*64;
+		out[q] = extract(pos - far) ^ extract(pos - near);
+	}
+}
+
 void PRBSGeneratorFilter::Refresh()
 {
 	size_t depth = m_parameters[m_depthname].GetIntVal();
@@ -195,19 +340,30 @@ void PRBSGeneratorFilter::Refresh()
 	clk->m_densePacked = true;
 	clk->Resize(depth);
 
-	bool lastclk = false;
-	uint32_t prbs = rand();
+	//Fill timestamps and clock
+	#pragma omp parallel for
 	for(size_t i=0; i<depth; i++)
 	{
-		//Fill clock
 		clk->m_offsets[i] = i;
 		clk->m_durations[i] = 1;
-		clk->m_samples[i] = lastclk;
-		lastclk = !lastclk;
+		clk->m_samples[i] = (i & 1);
 
-		//Fill data
 		dat->m_offsets[i] = i;
 		dat->m_durations[i] = 1;
-		dat->m_samples[i] = RunPRBS(prbs, poly);
+	}
+
+	//Fill data in blocks of 64-bit words, jumping the LFSR ahead to the start of each block
+	uint32_t prbs = rand();
+	const size_t blockbits = 1024 * 1024;
+	size_t numblocks = (depth + blockbits - 1) / blockbits;
+	#pragma omp parallel for
+	for(size_t i=0; i<numblocks; i++)
+	{
+		size_t start = i*blockbits;
+		size_t nbits = min(blockbits, depth - start);
+
+		vector<uint64_t> bits((nbits + 63) / 64);
+		GeneratePRBSBits(JumpPRBS(prbs, poly, start), poly, &bits[0], nbits);
+		UnpackBits(&bits[0], nbits, dat, start);
 	}
 }
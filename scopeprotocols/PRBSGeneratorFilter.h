@@ -61,6 +61,9 @@ public:
 	};
 
 	static bool RunPRBS(uint32_t& state, Polynomials poly);
+	static int GetPRBSTap(Polynomials poly);
+	static uint32_t JumpPRBS(uint32_t state, Polynomials poly, uint64_t count);
+	static void GeneratePRBSBits(uint32_t state, Polynomials poly, uint64_t* out, size_t nbits);
 
 protected:
 	std::string m_baudname;
@@ -147,6 +147,7 @@ void PeakHoldFilter::Refresh()
 		for(size_t i=0; i<len; i++)
 			cap->m_samples[i] = max((float)cap->m_samples[i], (float)din->m_samples[i]);
 	}
+	cap->MarkModified();
 
 	FindPeaks(cap);
 
@@ -118,8 +118,8 @@ void PhaseMeasurement::Refresh()
 	float vmax = GetTopVoltage(din);
 	float vmin = GetBaseVoltage(din);
 	float vavg = (vmax + vmin) / 2;
-	vector<int64_t> edges;
-	FindZeroCrossings(din, vavg, edges);
+	auto pedges = FindZeroCrossings(din, vavg);
+	auto& edges = *pedges;
 	size_t edgelen = edges.size();
 
 	//Auto: use median of interval between pairs of zero crossings
@@ -118,66 +118,65 @@ void RiseMeasurement::Refresh()
 
 	//Get the input data
 	auto din = GetAnalogInputWaveform(0);
-	size_t len = din->m_samples.size();
 
 	//Get the base/top (we use these for calculating percentages)
-	float base = GetBaseVoltage(din);
-	float top = GetTopVoltage(din);
+	float base;
+	float top;
+	GetBaseAndTopVoltage(din, base, top);
 
 	//Find the actual levels we use for our time gate
 	float delta = top - base;
 	float vstart = base + m_parameters[m_startname].GetFloatVal()*delta;
 	float vend = base + m_parameters[m_endname].GetFloatVal()*delta;
 
+	//Look up crossings of both levels (shared with any other measurements on this waveform)
+	auto crossings = GetLevelCrossings(din, vector<float>{vstart, vend});
+	auto& starts = crossings[0]->m_rising;
+	auto& ends = crossings[1]->m_rising;
+
 	//Create the output
 	auto cap = new AnalogWaveform;
 
-	float last = 1e20;
-	double tedge = 0;
 	float fmax = -1e20;
 	float fmin =  1e20;
 
-	int state = 0;
 	int64_t tlast = 0;
 
-	//LogDebug("vstart = %.3f, vend = %.3f\n", vstart, vend);
-	for(size_t i=0; i < len; i++)
+	//Pair each crossing of the start level with the next crossing of the end level after it.
+	//The next edge can't start until the sample after this one ended.
+	size_t istart = 0;
+	size_t iend = 0;
+	size_t nextsample = 0;
+	while(true)
 	{
-		float cur = din->m_samples[i];
-		int64_t tnow = din->m_offsets[i] * din->m_timescale;
-
 		//Find start of edge
-		if(state == 0)
-		{
-			if( (cur > vstart) && (last <= vstart) )
-			{
-				tedge = tnow - din->m_timescale + InterpolateTime(din, i-1, vstart)*din->m_timescale;
-				state = 1;
-			}
-		}
+		while( (istart < starts.size()) && (starts[istart].m_index < nextsample) )
+			istart ++;
+		if(istart >= starts.size())
+			break;
+		auto& start = starts[istart];
 
 		//Find end of edge
-		else if(state == 1)
-		{
-			if( (cur > vend) && (last <= vend) )
-			{
-				double dt = InterpolateTime(din, i-1, vend)*din->m_timescale + tnow - din->m_timescale - tedge;
-
-				cap->m_offsets.push_back(tlast);
-				cap->m_durations.push_back(tnow-tlast);
-				cap->m_samples.push_back(dt);
-				tlast = tnow;
-
-				if(dt < fmin)
-					fmin = dt;
-				if(dt > fmax)
-					fmax = dt;
-
-				state = 0;
-			}
-		}
-
-		last = cur;
+		while( (iend < ends.size()) && (ends[iend].m_index <= start.m_index) )
+			iend ++;
+		if(iend >= ends.size())
+			break;
+		auto& end = ends[iend];
+
+		double dt = end.m_time - start.m_time;
+		int64_t tnow = din->m_offsets[end.m_index] * din->m_timescale;
+
+		cap->m_offsets.push_back(tlast);
+		cap->m_durations.push_back(tnow - tlast);
+		cap->m_samples.push_back(dt);
+		tlast = tnow;
+
+		if(dt < fmin)
+			fmin = dt;
+		if(dt > fmax)
+			fmax = dt;
+
+		nextsample = end.m_index + 1;
 	}
 
 	m_range = fmax - fmin;
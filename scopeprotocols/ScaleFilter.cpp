@@ -36,7 +36,8 @@ using namespace std;
 // Construction / destruction
 
 ScaleFilter::ScaleFilter(const string& color)
-	: Filter(OscilloscopeChannel::CHANNEL_TYPE_ANALOG, color, CAT_MATH)
+	: ElementwiseFilter(color, CAT_MATH)
+	, m_scale(1)
 {
 	//Set up channels
 	CreateInput("din");
@@ -99,24 +100,17 @@ void ScaleFilter::SetDefaultName()
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Actual decoder logic
 
-void ScaleFilter::Refresh()
+bool ScaleFilter::PrepareElementwise()
 {
-	//Make sure we've got valid inputs
-	if(!VerifyAllInputsOKAndAnalog())
-	{
-		SetData(NULL, 0);
-		return;
-	}
-
-	auto din = GetAnalogInputWaveform(0);
-	size_t len = din->m_samples.size();
-
-	float scalefactor = m_parameters[m_scalefactorname].GetFloatVal();
+	m_scale = m_parameters[m_scalefactorname].GetFloatVal();
+	return true;
+}
 
+void ScaleFilter::ProcessElementwise(float* out, const float* const* in, size_t len)
+{
 	//Multiply all of our samples by the scale factor
-	auto cap = SetupOutputWaveform(din, 0, 0, 0);
-	float* out = (float*)__builtin_assume_aligned(&cap->m_samples[0], 16);
-	float* a = (float*)__builtin_assume_aligned(&din->m_samples[0], 16);
+	out = (float*)__builtin_assume_aligned(out, 64);
+	const float* a = (const float*)__builtin_assume_aligned(in[0], 64);
 	for(size_t i=0; i<len; i++)
-		out[i] = a[i] * scalefactor;
+		out[i] = a[i] * m_scale;
 }
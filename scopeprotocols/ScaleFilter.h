@@ -35,13 +35,11 @@
 #ifndef ScaleFilter_h
 #define ScaleFilter_h
 
-class ScaleFilter : public Filter
+class ScaleFilter : public ElementwiseFilter
 {
 public:
 	ScaleFilter(const std::string& color);
 
-	virtual void Refresh();
-
 	virtual bool NeedsConfig();
 
 	static std::string GetProtocolName();
@@ -54,7 +52,11 @@ public:
 	PROTOCOL_DECODER_INITPROC(ScaleFilter)
 
 protected:
+	virtual bool PrepareElementwise();
+	virtual void ProcessElementwise(float* out, const float* const* in, size_t len);
+
 	std::string m_scalefactorname;
+	float m_scale;
 };
 
 #endif
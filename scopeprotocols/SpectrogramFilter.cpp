@@ -33,6 +33,7 @@
 #include <immintrin.h>
 #include "../scopehal/avx_mathfun.h"
 #include "FFTFilter.h"
+#include <omp.h>
 
 using namespace std;
 
@@ -72,12 +73,12 @@ SpectrogramFilter::SpectrogramFilter(const string& color)
 
 	//Set up channels
 	CreateInput("din");
-	m_plan = NULL;
 
 	//Default config
 	m_range = 1e9;
 	m_offset = -5e8;
 	m_cachedFFTLength = 0;
+	m_cachedWindow = FFTFilter::WINDOW_RECTANGULAR;
 
 	m_parameters[m_windowName] = FilterParameter(FilterParameter::TYPE_ENUM, Unit(Unit::UNIT_COUNTS));
 	m_parameters[m_windowName].AddEnumValue("Blackman-Harris", FFTFilter::WINDOW_BLACKMAN_HARRIS);
@@ -103,12 +104,14 @@ SpectrogramFilter::SpectrogramFilter(const string& color)
 
 	m_parameters[m_rangeMinName] = FilterParameter(FilterParameter::TYPE_FLOAT, Unit(Unit::UNIT_DBM));
 	m_parameters[m_rangeMinName].SetFloatVal(-50);
+
+	m_overlapName = "Overlap";
+	m_parameters[m_overlapName] = FilterParameter(FilterParameter::TYPE_FLOAT, Unit(Unit::UNIT_PERCENT));
+	m_parameters[m_overlapName].SetFloatVal(0);
 }
 
 SpectrogramFilter::~SpectrogramFilter()
 {
-	if(m_plan)
-		ffts_free(m_plan);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -169,14 +172,38 @@ void SpectrogramFilter::SetDefaultName()
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Actual decoder logic
 
-void SpectrogramFilter::ReallocateBuffers(size_t fftlen)
+void SpectrogramFilter::ReallocateBuffers(size_t fftlen, FFTFilter::WindowFunction window)
 {
-	m_cachedFFTLength = fftlen;
-	ffts_free(m_plan);
-	m_plan = ffts_init_1d_real(fftlen, FFTS_FORWARD);
+	//The plan cache gives each thread its own instance of the plan, but we still need per-thread buffers
+	size_t nthreads = omp_get_max_threads();
+	if( (fftlen != m_cachedFFTLength) || (nthreads != m_rdinbufs.size()) )
+	{
+		m_cachedFFTLength = fftlen;
+		m_plan.Reset(fftlen, FFTS_FORWARD);
+
+		m_rdinbufs.resize(nthreads);
+		m_rdoutbufs.resize(nthreads);
+		m_normbufs.resize(nthreads);
+		for(size_t i=0; i<nthreads; i++)
+		{
+			m_rdinbufs[i].resize(fftlen);
+			m_rdoutbufs[i].resize(fftlen + 2);
+			m_normbufs[i].resize(fftlen/2 + 1);
+		}
 
-	m_rdinbuf.resize(fftlen);
-	m_rdoutbuf.resize(fftlen + 2);
+		//Force the window to be recalculated
+		m_window.clear();
+	}
+
+	//Precompute the window so each block is just a multiply
+	if( (window != m_cachedWindow) || m_window.empty() )
+	{
+		m_cachedWindow = window;
+		m_window.resize(fftlen);
+
+		AlignedFloatVector ones(fftlen, 1.0f);
+		FFTFilter::ApplyWindow(&ones[0], fftlen, &m_window[0], window);
+	}
 }
 
 void SpectrogramFilter::Refresh()
@@ -190,12 +217,21 @@ void SpectrogramFilter::Refresh()
 	auto din = GetAnalogInputWaveform(0);
 
 	//Figure out how many FFTs to do
-	//For now, consecutive blocks and not a sliding window
 	size_t inlen = din->m_samples.size();
 	size_t fftlen = m_parameters[m_fftLengthName].GetIntVal();
-	if(fftlen != m_cachedFFTLength)
-		ReallocateBuffers(fftlen);
-	size_t nblocks = inlen / fftlen;
+	if(inlen < fftlen)
+	{
+		SetData(NULL, 0);
+		return;
+	}
+	auto window = static_cast<FFTFilter::WindowFunction>(m_parameters[m_windowName].GetIntVal());
+	ReallocateBuffers(fftlen, window);
+
+	//Blocks may overlap (sliding window)
+	float overlap = m_parameters[m_overlapName].GetFloatVal();
+	overlap = max(0.0f, min(overlap, 0.99f));
+	size_t stride = max((size_t)1, (size_t)round(fftlen * (1 - overlap)));
+	size_t nblocks = (inlen - fftlen) / stride + 1;
 
 	//Figure out range of the FFTs
 	double fs_per_sample = din->m_timescale * (din->m_offsets[1] - din->m_offsets[0]);
@@ -217,7 +253,7 @@ void SpectrogramFilter::Refresh()
 		nouts,
 		fmax,
 		din->m_offsets[0] * din->m_timescale,
-		fs_per_sample * nblocks * fftlen
+		fs_per_sample * nblocks * stride
 		);
 	cap->m_startTimestamp = din->m_startTimestamp;
 	cap->m_startFemtoseconds = din->m_startFemtoseconds;
@@ -226,32 +262,159 @@ void SpectrogramFilter::Refresh()
 	cap->m_densePacked = true;
 	SetData(cap, 0);
 
-	//Run the FFTs
-	auto window = static_cast<FFTFilter::WindowFunction>(m_parameters[m_windowName].GetIntVal());
+	//Run the FFTs. Each block is independent so do them in parallel.
 	auto data = cap->GetData();
-	const float impedance = 50;
 	float minscale = m_parameters[m_rangeMinName].GetFloatVal();
 	float fullscale = m_parameters[m_rangeMaxName].GetFloatVal();
 	float range = fullscale - minscale;
+	const float* pin = (const float*)&din->m_samples[0];
+	#pragma omp parallel for
 	for(size_t block=0; block<nblocks; block++)
 	{
-		//Grab the input and apply the window function
-		FFTFilter::ApplyWindow((float*)&din->m_samples[block*fftlen], fftlen, &m_rdinbuf[0], window);
+		size_t tid = omp_get_thread_num();
+		if(g_hasAvx2)
+			ProcessBlockAVX2(tid, pin + block*stride, nouts, scale, minscale, range, data + block, nblocks);
+		else
+			ProcessBlock(tid, pin + block*stride, nouts, scale, minscale, range, data + block, nblocks);
+	}
+}
 
-		//Do the actual FFT
-		ffts_execute(m_plan, &m_rdinbuf[0], &m_rdoutbuf[0]);
+/**
+	@brief Windows, transforms, and normalizes a single block
+
+	@param tid		Thread ID (selects scratch buffers)
+	@param din		Input samples
+	@param nouts	Number of FFT bins
+	@param scale	Normalization factor for FFT output
+	@param minscale	Bottom of the display range, in dBm
+	@param range	Size of the display range, in dB
+	@param out		Output column
+	@param stride	Distance between rows of the output
+ */
+void SpectrogramFilter::ProcessBlock(
+	size_t tid,
+	const float* din,
+	size_t nouts,
+	float scale,
+	float minscale,
+	float range,
+	float* out,
+	size_t stride)
+{
+	size_t fftlen = m_cachedFFTLength;
+	float* inbuf = &m_rdinbufs[tid][0];
+	float* outbuf = &m_rdoutbufs[tid][0];
 
-		//TODO: figure out if there's any way to vectorize this
-		for(size_t i=0; i<nouts; i++)
-		{
-			float real = m_rdoutbuf[i*2 + 0];
-			float imag = m_rdoutbuf[i*2 + 1];
-			float voltage = sqrtf(real*real + imag*imag) * scale;
-			float dbm = (10 * log10(voltage*voltage / impedance) + 30);
-			if(dbm < minscale)
-				data[i*nblocks + block] = 0;
-			else
-				data[i*nblocks + block] = (dbm - minscale) / range;
-		}
+	//Grab the input and apply the window function
+	for(size_t i=0; i<fftlen; i++)
+		inbuf[i] = din[i] * m_window[i];
+
+	//Do the actual FFT
+	ffts_execute(m_plan.Get(), inbuf, outbuf);
+
+	const float impedance = 50;
+	for(size_t i=0; i<nouts; i++)
+	{
+		float real = outbuf[i*2 + 0];
+		float imag = outbuf[i*2 + 1];
+		float voltage = sqrtf(real*real + imag*imag) * scale;
+		float dbm = (10 * log10(voltage*voltage / impedance) + 30);
+		if(dbm < minscale)
+			out[i*stride] = 0;
+		else
+			out[i*stride] = (dbm - minscale) / range;
+	}
+}
+
+/**
+	@brief Windows, transforms, and normalizes a single block (optimized AVX2 implementation)
+ */
+__attribute__((target("avx2")))
+void SpectrogramFilter::ProcessBlockAVX2(
+	size_t tid,
+	const float* din,
+	size_t nouts,
+	float scale,
+	float minscale,
+	float range,
+	float* out,
+	size_t stride)
+{
+	size_t fftlen = m_cachedFFTLength;
+	float* inbuf = &m_rdinbufs[tid][0];
+	float* outbuf = &m_rdoutbufs[tid][0];
+	float* normbuf = &m_normbufs[tid][0];
+	float* window = &m_window[0];
+
+	//Grab the input and apply the window function
+	//(FFT length is always a multiple of 8. Input may not be aligned if blocks overlap)
+	for(size_t i=0; i<fftlen; i += 8)
+	{
+		__m256 vin = _mm256_loadu_ps(din + i);
+		__m256 w = _mm256_load_ps(window + i);
+		_mm256_store_ps(inbuf + i, _mm256_mul_ps(vin, w));
+	}
+
+	//Do the actual FFT
+	ffts_execute(m_plan.Get(), inbuf, outbuf);
+
+	//dBm = 10*log10(v^2 / 50) + 30 = (10 / ln(10)) * ln(v^2 / 50) + 30
+	const float impedance = 50;
+	__m256 pscale = _mm256_set1_ps(scale * scale / impedance);
+	__m256 logscale = _mm256_set1_ps(10 / log(10.0f));
+	__m256 const_30 = _mm256_set1_ps(30);
+	__m256 vmin = _mm256_set1_ps(minscale);
+	__m256 vinvrange = _mm256_set1_ps(1.0f / range);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 fmin = _mm256_set1_ps(FLT_MIN);
+
+	size_t end = nouts - (nouts % 8);
+	for(size_t k=0; k<end; k += 8)
+	{
+		//Read interleaved real/imaginary FFT output (riririri riririri)
+		__m256 din0 = _mm256_load_ps(outbuf + k*2);
+		__m256 din1 = _mm256_load_ps(outbuf + k*2 + 8);
+
+		//Step 1: Shuffle 32-bit values within 128-bit lanes to get rriirrii rriirrii.
+		din0 = _mm256_permute_ps(din0, 0xd8);
+		din1 = _mm256_permute_ps(din1, 0xd8);
+
+		//Step 2: Shuffle 64-bit values to get rrrriiii rrrriiii.
+		__m256i block0 = _mm256_permute4x64_epi64(_mm256_castps_si256(din0), 0xd8);
+		__m256i block1 = _mm256_permute4x64_epi64(_mm256_castps_si256(din1), 0xd8);
+
+		//Step 3: Shuffle 128-bit values to get rrrrrrrr iiiiiiii.
+		__m256 real = _mm256_castsi256_ps(_mm256_permute2x128_si256(block0, block1, 0x20));
+		__m256 imag = _mm256_castsi256_ps(_mm256_permute2x128_si256(block0, block1, 0x31));
+
+		//Power in watts
+		__m256 sum = _mm256_add_ps(_mm256_mul_ps(real, real), _mm256_mul_ps(imag, imag));
+		__m256 watts = _mm256_mul_ps(sum, pscale);
+
+		//Clamp to avoid log(0), anything that small is going to be clipped anyway
+		watts = _mm256_max_ps(watts, fmin);
+
+		//Convert to dBm and normalize to the display range, clipping anything below the range to zero
+		__m256 dbm = _mm256_add_ps(_mm256_mul_ps(_mm256_log_ps(watts), logscale), const_30);
+		__m256 norm = _mm256_mul_ps(_mm256_sub_ps(dbm, vmin), vinvrange);
+		norm = _mm256_blendv_ps(norm, zero, _mm256_cmp_ps(dbm, vmin, _CMP_LT_OQ));
+		_mm256_store_ps(normbuf + k, norm);
+	}
+
+	//Output is stored transposed so write it out one bin at a time
+	for(size_t k=0; k<end; k++)
+		out[k*stride] = normbuf[k];
+
+	//Get any extras we didn't get in the SIMD loop
+	for(size_t i=end; i<nouts; i++)
+	{
+		float real = outbuf[i*2 + 0];
+		float imag = outbuf[i*2 + 1];
+		float voltage = sqrtf(real*real + imag*imag) * scale;
+		float dbm = (10 * log10(voltage*voltage / impedance) + 30);
+		if(dbm < minscale)
+			out[i*stride] = 0;
+		else
+			out[i*stride] = (dbm - minscale) / range;
 	}
 }
@@ -35,7 +35,8 @@
 #ifndef SpectrogramFilter_h
 #define SpectrogramFilter_h
 
-#include <ffts.h>
+#include "../scopehal/FFTPlanCache.h"
+#include "FFTFilter.h"
 
 class SpectrogramWaveform : public WaveformBase
 {
@@ -98,14 +99,41 @@ public:
 	PROTOCOL_DECODER_INITPROC(SpectrogramFilter)
 
 protected:
-	void ReallocateBuffers(size_t fftlen);
-
-	std::vector<float, AlignedAllocator<float, 64> > m_rdinbuf;
-	std::vector<float, AlignedAllocator<float, 64> > m_rdoutbuf;
+	void ReallocateBuffers(size_t fftlen, FFTFilter::WindowFunction window);
+
+	void ProcessBlock(
+		size_t tid,
+		const float* din,
+		size_t nouts,
+		float scale,
+		float minscale,
+		float range,
+		float* out,
+		size_t stride);
+	void ProcessBlockAVX2(
+		size_t tid,
+		const float* din,
+		size_t nouts,
+		float scale,
+		float minscale,
+		float range,
+		float* out,
+		size_t stride);
+
+	typedef std::vector<float, AlignedAllocator<float, 64> > AlignedFloatVector;
+
+	//Per-thread scratch buffers
+	std::vector<AlignedFloatVector> m_rdinbufs;
+	std::vector<AlignedFloatVector> m_rdoutbufs;
+	std::vector<AlignedFloatVector> m_normbufs;
+	FFTPlan m_plan;
+
+	//Precomputed window function coefficients
+	AlignedFloatVector m_window;
 
 	size_t m_cachedFFTLength;
+	FFTFilter::WindowFunction m_cachedWindow;
 
-	ffts_plan_t* m_plan;
 	float m_range;
 	float m_offset;
 
@@ -113,6 +141,7 @@ protected:
 	std::string m_fftLengthName;
 	std::string m_rangeMinName;
 	std::string m_rangeMaxName;
+	std::string m_overlapName;
 };
 
 #endif
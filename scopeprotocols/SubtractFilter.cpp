@@ -37,7 +37,8 @@ using namespace std;
 // Construction / destruction
 
 SubtractFilter::SubtractFilter(const string& color)
-	: Filter(OscilloscopeChannel::CHANNEL_TYPE_ANALOG, color, CAT_MATH)
+	: ElementwiseFilter(color, CAT_MATH)
+	, m_modular(false)
 {
 	//Set up channels
 	CreateInput("IN+");
@@ -131,40 +132,29 @@ float SubtractFilter::GetVoltageRange(size_t /*stream*/)
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Actual decoder logic
 
-void SubtractFilter::Refresh()
+bool SubtractFilter::PrepareElementwise()
 {
-	//Make sure we've got valid inputs
-	if(!VerifyAllInputsOKAndAnalog())
-	{
-		SetData(NULL, 0);
-		return;
-	}
-
-	auto din_p = GetAnalogInputWaveform(0);
-	auto din_n = GetAnalogInputWaveform(1);
-
 	//Set up units and complain if they're inconsistent
 	m_xAxisUnit = m_inputs[0].m_channel->GetXAxisUnits();
 	SetYAxisUnits(m_inputs[0].GetYAxisUnits(), 0);
 	if( (m_xAxisUnit != m_inputs[1].m_channel->GetXAxisUnits()) ||
 		(m_inputs[0].GetYAxisUnits() != m_inputs[1].GetYAxisUnits()) )
 	{
-		SetData(NULL, 0);
-		return;
+		return false;
 	}
 
-	//We need meaningful data
-	size_t len = min(din_p->m_samples.size(), din_n->m_samples.size());
+	m_modular = (GetYAxisUnits(0) == Unit::UNIT_DEGREES);
+	return true;
+}
 
-	//Create the output and copy timestamps
-	auto cap = SetupOutputWaveform(din_p, 0, 0, 0);
-	float* out = (float*)&cap->m_samples[0];
-	float* a = (float*)&din_p->m_samples[0];
-	float* b = (float*)&din_n->m_samples[0];
+void SubtractFilter::ProcessElementwise(float* out, const float* const* in, size_t len)
+{
+	const float* a = in[0];
+	const float* b = in[1];
 
 	//Special case if input units are degrees: we want to do modular arithmetic
 	//TODO: vectorized version of this
-	if(GetYAxisUnits(0) == Unit::UNIT_DEGREES)
+	if(m_modular)
 	{
 		for(size_t i=0; i<len; i++)
 		{
@@ -187,18 +177,18 @@ void SubtractFilter::Refresh()
 }
 
 //We probably still have SSE2 or similar if no AVX, so give alignment hints for compiler auto-vectorization
-void SubtractFilter::InnerLoop(float* out, float* a, float* b, size_t len)
+void SubtractFilter::InnerLoop(float* out, const float* a, const float* b, size_t len)
 {
 	out = (float*)__builtin_assume_aligned(out, 64);
-	a = (float*)__builtin_assume_aligned(a, 64);
-	b = (float*)__builtin_assume_aligned(b, 64);
+	a = (const float*)__builtin_assume_aligned(a, 64);
+	b = (const float*)__builtin_assume_aligned(b, 64);
 
 	for(size_t i=0; i<len; i++)
 		out[i] 		= a[i] - b[i];
 }
 
 __attribute__((target("avx2")))
-void SubtractFilter::InnerLoopAVX2(float* out, float* a, float* b, size_t len)
+void SubtractFilter::InnerLoopAVX2(float* out, const float* a, const float* b, size_t len)
 {
 	size_t end = len - (len % 8);
 
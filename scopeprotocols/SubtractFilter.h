@@ -35,13 +35,11 @@
 #ifndef SubtractFilter_h
 #define SubtractFilter_h
 
-class SubtractFilter : public Filter
+class SubtractFilter : public ElementwiseFilter
 {
 public:
 	SubtractFilter(const std::string& color);
 
-	virtual void Refresh();
-
 	virtual bool NeedsConfig();
 
 	static std::string GetProtocolName();
@@ -55,8 +53,14 @@ public:
 	PROTOCOL_DECODER_INITPROC(SubtractFilter)
 
 protected:
-	void InnerLoop(float* out, float* a, float* b, size_t len);
-	void InnerLoopAVX2(float* out, float* a, float* b, size_t len);
+	virtual bool PrepareElementwise();
+	virtual void ProcessElementwise(float* out, const float* const* in, size_t len);
+
+	void InnerLoop(float* out, const float* a, const float* b, size_t len);
+	void InnerLoopAVX2(float* out, const float* a, const float* b, size_t len);
+
+	///@brief True if inputs are angles, and the output should be wrapped to +/- 180 degrees
+	bool m_modular;
 };
 
 #endif
@@ -49,7 +49,6 @@ TDRStepDeEmbedFilter::TDRStepDeEmbedFilter(const string& color)
 	m_range = 70;
 	m_offset = 35;
 
-	m_plan = NULL;
 	m_cachedPlanSize = 0;
 
 	m_numAverages = 0;
@@ -57,8 +56,6 @@ TDRStepDeEmbedFilter::TDRStepDeEmbedFilter(const string& color)
 
 TDRStepDeEmbedFilter::~TDRStepDeEmbedFilter()
 {
-	if(m_plan)
-		ffts_free(m_plan);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -162,16 +159,13 @@ void TDRStepDeEmbedFilter::Refresh()
 	const size_t nouts = npoints/2 + 1;
 
 	//New input size? Clear out old state
-	if(m_plan && (m_cachedPlanSize != npoints) )
-	{
-		ffts_free(m_plan);
-		m_plan = NULL;
-	}
+	if(!m_plan.empty() && (m_cachedPlanSize != npoints) )
+		m_plan.Clear();
 
 	//Reset inputs as needed
-	if(!m_plan)
+	if(m_plan.empty())
 	{
-		m_plan = ffts_init_1d_real(npoints, FFTS_FORWARD);
+		m_plan.Reset(npoints, FFTS_FORWARD);
 		m_signalinbuf.resize(npoints);
 		m_signaloutbuf.resize(2*nouts);
 		m_stepinbuf.resize(npoints);
@@ -187,7 +181,7 @@ void TDRStepDeEmbedFilter::Refresh()
 				m_stepinbuf[i] = 1;
 		}
 		FFTFilter::ApplyWindow(&m_stepinbuf[0], npoints_raw, &m_stepinbuf[0], FFTFilter::WINDOW_BLACKMAN_HARRIS);
-		ffts_execute(m_plan, &m_stepinbuf[0], &m_stepoutbuf[0]);
+		ffts_execute(m_plan.Get(), &m_stepinbuf[0], &m_stepoutbuf[0]);
 	}
 
 	//DEBUG: remove old averages
@@ -208,7 +202,7 @@ void TDRStepDeEmbedFilter::Refresh()
 	FFTFilter::ApplyWindow(&m_signalinbuf[0], npoints_raw, &m_signalinbuf[0], FFTFilter::WINDOW_BLACKMAN_HARRIS);
 	for(size_t i=npoints_raw; i<npoints; i++)
 		m_signalinbuf[i] = 0;
-	ffts_execute(m_plan, &m_signalinbuf[0], &m_signaloutbuf[0]);
+	ffts_execute(m_plan.Get(), &m_signalinbuf[0], &m_signaloutbuf[0]);
 
 	//Generate the de-embedding filter
 	SParameters params;
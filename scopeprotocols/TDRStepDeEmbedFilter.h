@@ -35,7 +35,7 @@
 #ifndef TDRStepDeEmbedFilter_h
 #define TDRStepDeEmbedFilter_h
 
-#include <ffts.h>
+#include "../scopehal/FFTPlanCache.h"
 
 class TDRStepDeEmbedFilter : public Filter
 {
@@ -68,7 +68,7 @@ protected:
 	std::vector<float> m_inputSums;
 	size_t m_numAverages;
 
-	ffts_plan_t* m_plan;
+	FFTPlan m_plan;
 	size_t m_cachedPlanSize;
 
 	std::vector<float, AlignedAllocator<float, 64> > m_signalinbuf;
@@ -28,6 +28,7 @@
 ***********************************************************************************************************************/
 
 #include "scopeprotocols.h"
+#include <omp.h>
 
 using namespace std;
 
@@ -132,68 +133,187 @@ void TIEMeasurement::Refresh()
 	auto golden = GetDigitalInputWaveform(1);
 	size_t len = min(clk->m_offsets.size(), golden->m_offsets.size());
 
-	//Create the output
-	auto cap = new AnalogWaveform;
-
 	//Timestamps of the edges
-	vector<int64_t> edges;
+	EdgeListPtr edgelist;
 	if(clk_analog)
-		FindZeroCrossings(clk_analog, m_parameters[m_threshname].GetFloatVal(), edges);
+		edgelist = FindZeroCrossings(clk_analog, m_parameters[m_threshname].GetFloatVal());
 	else
-		FindZeroCrossings(clk_digital, edges);
+	{
+		auto digital_edges = make_shared<vector<int64_t> >();
+		FindZeroCrossings(clk_digital, *digital_edges);
+		edgelist = digital_edges;
+	}
+	const vector<int64_t>& edges = *edgelist;
+	size_t nedges = edges.size();
 
 	//Ignore edges before things have stabilized
 	int64_t skip_time = m_parameters[m_skipname].GetIntVal();
 
+	//Each clock edge is paired with the golden clock cycle containing it, and whether it produces an output depends
+	//only on that cycle and the previous edge's. So we can split the edges into independent blocks, count outputs
+	//in each, then have every block write directly to its slice of the output.
+	//Divide large waveforms (>1M points) into blocks and multithread them
+	size_t numblocks = 1;
+	if(nedges > 1000000)
+		numblocks = omp_get_max_threads();
+	size_t lastblock = numblocks - 1;
+	size_t blocksize = nedges / numblocks;
+	vector<BlockResult> results(numblocks);
+
+	#pragma omp parallel for
+	for(size_t i=0; i<numblocks; i++)
+	{
+		size_t istart = i*blocksize;
+		size_t iend = (i == lastblock) ? nedges : istart + blocksize;
+		MatchEdgesBlock(&edges[0], istart, iend, golden, len, skip_time, results[i]);
+	}
+
+	//Figure out where each block's output goes, and the first clock edge after it (to get the last duration)
+	vector<size_t> outstarts(numblocks);
+	vector<int64_t> nextedges(numblocks);
+	size_t total = 0;
 	int64_t vmin = FS_PER_SECOND;
 	int64_t vmax = -FS_PER_SECOND;
+	for(size_t i=0; i<numblocks; i++)
+	{
+		outstarts[i] = total;
+		total += results[i].m_count;
+		vmin = min(vmin, results[i].m_min);
+		vmax = max(vmax, results[i].m_max);
+	}
+	int64_t nextedge = INT64_MIN;
+	for(size_t i=numblocks; i>0; i--)
+	{
+		nextedges[i-1] = nextedge;
+		if(results[i-1].m_count)
+			nextedge = results[i-1].m_firstEdge;
+	}
+
+	//Set up the output, reusing the previous one if possible
+	auto cap = SetupEmptyOutputWaveform(clk, 0, false);
+	cap->m_timescale = 1;
+	cap->m_triggerPhase = 0;
+	cap->m_densePacked = false;
+	cap->Resize(total);
 
-	//For each input clock edge, find the closest recovered clock edge
-	size_t iedge = 0;
-	size_t tlast = 0;
-	for(auto atime : edges)
+	#pragma omp parallel for
+	for(size_t i=0; i<numblocks; i++)
 	{
-		if(iedge >= len)
-			break;
+		if(results[i].m_count == 0)
+			continue;
 
-		int64_t prev_edge = golden->m_offsets[iedge] * golden->m_timescale;
-		int64_t next_edge = prev_edge;
-		size_t jedge = iedge;
+		size_t istart = i*blocksize;
+		size_t iend = (i == lastblock) ? nedges : istart + blocksize;
+		BlockResult unused;
+		MatchEdgesBlock(&edges[0], istart, iend, golden, len, skip_time, unused, cap, outstarts[i], nextedges[i]);
+	}
 
-		bool hit = false;
+	//Calculate bounds
+	if(total)
+	{
+		m_max = max(m_max, (float)vmax);
+		m_min = min(m_min, (float)vmin);
+	}
+	m_range = (m_max - m_min) * 1.05;
+	m_offset = -( (m_max - m_min)/2 + m_min );
+}
+
+/**
+	@brief Finds the first golden clock edge after a given time
 
-		//Look for a pair of edges bracketing our edge
-		while(true)
+	@param golden	The golden clock
+	@param len		Number of golden clock edges to consider
+	@param t		Timestamp, in femtoseconds
+
+	@return Index of the first edge strictly after t, or len if there is none
+ */
+size_t TIEMeasurement::FindGoldenEdge(DigitalWaveform* golden, size_t len, int64_t t)
+{
+	int64_t timescale = golden->m_timescale;
+	auto it = upper_bound(
+		golden->m_offsets.begin(),
+		golden->m_offsets.begin() + len,
+		t,
+		[timescale](int64_t a, int64_t b) { return a < b*timescale; });
+	return it - golden->m_offsets.begin();
+}
+
+/**
+	@brief Matches a block of clock edges against the golden clock
+
+	Each golden clock cycle is used by at most one clock edge: the first one strictly inside it.
+
+	When cap is NULL, this only counts the outputs and finds their range. Otherwise, the outputs are written to cap
+	starting at outstart.
+
+	@param edges		Clock edge timestamps
+	@param istart		Index of the first edge to process
+	@param iend			One past the index of the last edge to process
+	@param golden		The golden clock
+	@param len			Number of golden clock edges to consider
+	@param skip_time	Ignore golden clock cycles starting before this time
+	@param result		Output count, first clock edge with an output, and TIE range
+	@param cap			Output waveform (NULL to only count)
+	@param outstart		Index in cap of this block's first output
+	@param nextedge		Clock edge of the first output after this block (INT64_MIN if none)
+ */
+void TIEMeasurement::MatchEdgesBlock(
+	const int64_t* edges,
+	size_t istart,
+	size_t iend,
+	DigitalWaveform* golden,
+	size_t len,
+	int64_t skip_time,
+	BlockResult& result,
+	AnalogWaveform* cap,
+	size_t outstart,
+	int64_t nextedge)
+{
+	if(istart >= iend)
+		return;
+
+	int64_t timescale = golden->m_timescale;
+	auto goldenEdges = &golden->m_offsets[0];
+
+	//Find the golden cycle of the previous edge, so we know if it claimed the same cycle as our first one
+	size_t jlast = SIZE_MAX;
+	int64_t elast = 0;
+	if(istart > 0)
+	{
+		elast = edges[istart-1];
+		jlast = FindGoldenEdge(golden, len, elast);
+	}
+
+	size_t j = FindGoldenEdge(golden, len, edges[istart]);
+	size_t iout = outstart;
+	for(size_t i=istart; i<iend; i++)
+	{
+		int64_t atime = edges[i];
+
+		//Walk forward to the first golden edge after this one
+		while( (j < len) && (goldenEdges[j] * timescale <= atime) )
+			j ++;
+
+		//Check if we're strictly inside a golden cycle that no earlier edge has claimed
+		bool hit = false;
+		int64_t prev_edge = 0;
+		int64_t next_edge = 0;
+		if( (j > 0) && (j < len) )
 		{
-			prev_edge = next_edge;
-			next_edge = golden->m_offsets[jedge] * golden->m_timescale;
-
-			//First golden edge is after this signal edge
-			if(prev_edge > atime)
-				break;
-
-			//Bracketed
-			if( (prev_edge < atime) && (next_edge > atime) )
-			{
-				hit = true;
-				break;
-			}
-
-			//No, keep looking
-			jedge ++;
-
-			//End of capture
-			if(jedge >= len)
-				break;
+			prev_edge = goldenEdges[j-1] * timescale;
+			next_edge = goldenEdges[j] * timescale;
+			hit = (prev_edge < atime);
+			if( (jlast == j) && (prev_edge < elast) )
+				hit = false;
 		}
+		jlast = j;
+		elast = atime;
 
 		//No interval error possible without a reference clock edge.
-		if(!hit)
+		//Also ignore edges before things have stabilized
+		if(!hit || (prev_edge < skip_time) )
 			continue;
 
-		//Hit! We're bracketed. Start the next search from this edge
-		iedge = jedge;
-
 		//Since the CDR filter adds a 90 degree phase offset for sampling in the middle of the data eye,
 		//we need to use the *midpoint* of the golden clock cycle as the nominal position of the clock
 		//edge for TIE measurements.
@@ -201,39 +321,27 @@ void TIEMeasurement::Refresh()
 		int64_t golden_center = prev_edge + golden_period/2;
 		int64_t tie = atime - golden_center;
 
-		//Ignore edges before things have stabilized
-		if(prev_edge < skip_time)
-		{}
-
-		else
+		if(!cap)
 		{
-			//Update the last sample
-			size_t end = cap->m_durations.size();
-			if(end)
-				cap->m_durations[end-1] = atime - tlast;
-
-			vmax = max(vmax, tie);
-			vmin = min(vmin, tie);
-
-			cap->m_offsets.push_back(golden_center);
-			cap->m_durations.push_back(0);
-			cap->m_samples.push_back(tie);
+			if(result.m_count == 0)
+				result.m_firstEdge = atime;
+			result.m_count ++;
+			result.m_min = min(result.m_min, tie);
+			result.m_max = max(result.m_max, tie);
+			continue;
 		}
 
-		tlast = golden_center;
-	}
-
-	SetData(cap, 0);
+		//Each sample lasts until the next clock edge
+		if(iout > outstart)
+			cap->m_durations[iout-1] = atime - cap->m_offsets[iout-1];
 
-	//Copy start time etc from the input
-	cap->m_timescale = 1;
-	cap->m_startTimestamp = clk->m_startTimestamp;
-	cap->m_startFemtoseconds = clk->m_startFemtoseconds;
-	cap->m_triggerPhase = 0;
+		cap->m_offsets[iout] = golden_center;
+		cap->m_durations[iout] = 0;
+		cap->m_samples[iout] = tie;
+		iout ++;
+	}
 
-	//Calculate bounds
-	m_max = max(m_max, (float)vmax);
-	m_min = min(m_min, (float)vmin);
-	m_range = (m_max - m_min) * 1.05;
-	m_offset = -( (m_max - m_min)/2 + m_min );
+	//Last sample in the block lasts until the first one in the next block
+	if(cap && (iout > outstart) && (nextedge != INT64_MIN) )
+		cap->m_durations[iout-1] = nextedge - cap->m_offsets[iout-1];
 }
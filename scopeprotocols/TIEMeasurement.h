@@ -57,6 +57,36 @@ public:
 	PROTOCOL_DECODER_INITPROC(TIEMeasurement)
 
 protected:
+	///@brief Results of matching one block of clock edges against the golden clock
+	class BlockResult
+	{
+	public:
+		BlockResult()
+		: m_count(0)
+		, m_firstEdge(0)
+		, m_min(INT64_MAX)
+		, m_max(INT64_MIN)
+		{}
+
+		size_t m_count;
+		int64_t m_firstEdge;
+		int64_t m_min;
+		int64_t m_max;
+	};
+
+	static size_t FindGoldenEdge(DigitalWaveform* golden, size_t len, int64_t t);
+	static void MatchEdgesBlock(
+		const int64_t* edges,
+		size_t istart,
+		size_t iend,
+		DigitalWaveform* golden,
+		size_t len,
+		int64_t skip_time,
+		BlockResult& result,
+		AnalogWaveform* cap = NULL,
+		size_t outstart = 0,
+		int64_t nextedge = INT64_MIN);
+
 	float m_min;
 	float m_max;
 	float m_range;
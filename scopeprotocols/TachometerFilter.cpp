@@ -113,8 +113,8 @@ void TachometerFilter::Refresh()
 	float midpoint = GetAvgVoltage(din);
 
 	//Timestamps of the edges
-	vector<int64_t> edges;
-	FindZeroCrossings(din, midpoint, edges);
+	auto pedges = FindZeroCrossings(din, midpoint);
+	auto& edges = *pedges;
 	if(edges.size() < 2)
 	{
 		SetData(NULL, 0);
@@ -30,6 +30,7 @@
 #include "scopeprotocols.h"
 #include "TappedDelayLineFilter.h"
 #include <immintrin.h>
+#include <omp.h>
 
 using namespace std;
 
@@ -197,10 +198,48 @@ void TappedDelayLineFilter::DoFilterKernel(
 	float& vmin,
 	float& vmax)
 {
-	if(g_hasAvx2)
-		DoFilterKernelAVX2(tap_delay, taps, din, cap, vmin, vmax);
-	else
-		DoFilterKernelGeneric(tap_delay, taps, din, cap, vmin, vmax);
+	vmin = FLT_MAX;
+	vmax = -FLT_MAX;
+
+	//For now, no resampling. Assume tap delay is an integer number of samples.
+	int64_t samples_per_tap = tap_delay / cap->m_timescale;
+	size_t len = din->m_samples.size();
+	size_t filterlen = 8*samples_per_tap;
+	if(len <= filterlen)
+		return;
+	size_t end = len - filterlen;
+
+	//Divide large waveforms (>1M points) into blocks and multithread them
+	//(the kernel only has 8 nonzero taps, so direct form is already much cheaper than an FFT convolution)
+	//TODO: tune split
+	size_t numblocks = 1;
+	if(end > 1000000)
+		numblocks = omp_get_max_threads();
+
+	//Round blocks to a multiple of 64 samples to keep vector loads aligned
+	size_t lastblock = numblocks - 1;
+	size_t blocksize = end / numblocks;
+	blocksize = blocksize - (blocksize % 64);
+
+	#pragma omp parallel for
+	for(size_t i=0; i<numblocks; i++)
+	{
+		size_t istart = i*blocksize;
+		size_t iend = (i == lastblock) ? end : istart + blocksize;
+
+		float bmin;
+		float bmax;
+		if(g_hasAvx2)
+			DoFilterKernelAVX2(tap_delay, taps, din, cap, istart, iend, bmin, bmax);
+		else
+			DoFilterKernelGeneric(tap_delay, taps, din, cap, istart, iend, bmin, bmax);
+
+		#pragma omp critical
+		{
+			vmin = min(vmin, bmin);
+			vmax = max(vmax, bmax);
+		}
+	}
 }
 
 void TappedDelayLineFilter::DoFilterKernelGeneric(
@@ -208,6 +247,8 @@ void TappedDelayLineFilter::DoFilterKernelGeneric(
 	float* taps,
 	AnalogWaveform* din,
 	AnalogWaveform* cap,
+	size_t istart,
+	size_t iend,
 	float& vmin,
 	float& vmax)
 {
@@ -217,12 +258,9 @@ void TappedDelayLineFilter::DoFilterKernelGeneric(
 	//Setup
 	vmin = FLT_MAX;
 	vmax = -FLT_MAX;
-	size_t len = din->m_samples.size();
-	size_t filterlen = 8*samples_per_tap;
-	size_t end = len - filterlen;
 
 	//Do the filter
-	for(size_t i=0; i<end; i++)
+	for(size_t i=istart; i<iend; i++)
 	{
 		float v = 0;
 		for(int64_t j=0; j<8; j++)
@@ -241,6 +279,8 @@ void TappedDelayLineFilter::DoFilterKernelAVX2(
 	float* taps,
 	AnalogWaveform* din,
 	AnalogWaveform* cap,
+	size_t istart,
+	size_t iend,
 	float& vmin,
 	float& vmax)
 {
@@ -250,9 +290,6 @@ void TappedDelayLineFilter::DoFilterKernelAVX2(
 	//Setup
 	vmin = FLT_MAX;
 	vmax = -FLT_MAX;
-	size_t len = din->m_samples.size();
-	size_t filterlen = 8*samples_per_tap;
-	size_t end = len - filterlen;
 
 	//Reverse the taps
 	float taps_reversed[8] =
@@ -261,8 +298,8 @@ void TappedDelayLineFilter::DoFilterKernelAVX2(
 	//I/O pointers
 	float* pin = (float*)&din->m_samples[0];
 	float* pout = (float*)&cap->m_samples[0];
-	size_t end_rounded = end - (end % 8);
-	size_t i=0;
+	size_t end_rounded = iend - ((iend - istart) % 8);
+	size_t i=istart;
 
 	__m256 vmin_x8 = { FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX };
 	__m256 vmax_x8 = { -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX };
@@ -337,7 +374,7 @@ void TappedDelayLineFilter::DoFilterKernelAVX2(
 	}
 
 	//Catch stragglers at the end
-	for(; i<end; i++)
+	for(; i<iend; i++)
 	{
 		float v = pin[i] * taps_reversed[0];
 		v += pin[i + 1*samples_per_tap] * taps_reversed[1];
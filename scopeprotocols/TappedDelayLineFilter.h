@@ -76,6 +76,8 @@ protected:
 		float* taps,
 		AnalogWaveform* din,
 		AnalogWaveform* cap,
+		size_t istart,
+		size_t iend,
 		float& vmin,
 		float& vmax);
 
@@ -84,6 +86,8 @@ protected:
 		float* taps,
 		AnalogWaveform* din,
 		AnalogWaveform* cap,
+		size_t istart,
+		size_t iend,
 		float& vmin,
 		float& vmax);
 
@@ -29,6 +29,8 @@
 
 #include "../scopehal/scopehal.h"
 #include "ThresholdFilter.h"
+#include <immintrin.h>
+#include <omp.h>
 
 using namespace std;
 
@@ -48,6 +50,10 @@ ThresholdFilter::ThresholdFilter(const string& color)
 	m_hysname = "Hysteresis";
 	m_parameters[m_hysname] = FilterParameter(FilterParameter::TYPE_FLOAT, Unit(Unit::UNIT_VOLTS));
 	m_parameters[m_hysname].SetFloatVal(0);
+
+	m_edgesname = "Precompute Edges";
+	m_parameters[m_edgesname] = FilterParameter(FilterParameter::TYPE_BOOL, Unit(Unit::UNIT_COUNTS));
+	m_parameters[m_edgesname].SetBoolVal(false);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -88,6 +94,16 @@ bool ThresholdFilter::NeedsConfig()
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Actual decoder logic
 
+/**
+	@brief Thresholds the input and generates digital output
+
+	Samples are first compared into a packed bit vector (64 per word), then expanded to the output waveform. With
+	hysteresis, the state machine only has to do work at samples beyond one of the two thresholds: everything between
+	them is filled in a word at a time.
+
+	If enabled, the edge list of the output is found from the packed bits and stored in the clock edge cache, so
+	decoders calling GetClockEdges() or SampleOn*Edges() on our output don't have to scan it again.
+ */
 void ThresholdFilter::Refresh()
 {
 	if(!VerifyAllInputsOKAndAnalog())
@@ -103,30 +119,310 @@ void ThresholdFilter::Refresh()
 	//Setup
 	float midpoint = m_parameters[m_threshname].GetFloatVal();
 	float hys = m_parameters[m_hysname].GetFloatVal();
+	bool edges = m_parameters[m_edgesname].GetBoolVal();
 	auto cap = SetupDigitalOutputWaveform(din, 0, 0, 0);
+	if(len == 0)
+		return;
+
+	m_bits.resize((len + 63) / 64);
+	uint64_t* bits = &m_bits[0];
+	const float* samples = (const float*)&din->m_samples[0];
+
+	//Divide large waveforms (>1M points) into blocks and multithread them.
+	//Blocks are a whole number of words so no two threads ever write to the same word.
+	//Negative hysteresis lets a sample be past both thresholds at once, which breaks the fixup below, so don't split.
+	size_t numblocks = 1;
+	if( (len > 1000000) && (hys >= 0) )
+		numblocks = omp_get_max_threads();
+	size_t lastblock = numblocks - 1;
+	size_t blocksize = (len / numblocks) - ((len / numblocks) % 64);
 
 	//Threshold all of our samples
 	//Optimized inner loop if no hysteresis
 	if(hys == 0)
 	{
 		#pragma omp parallel for
-		for(size_t i=0; i<len; i++)
-			cap->m_samples[i] = din->m_samples[i] > midpoint;
+		for(size_t i=0; i<numblocks; i++)
+		{
+			size_t istart = i*blocksize;
+			size_t iend = (i == lastblock) ? len : istart + blocksize;
+			Compare(samples + istart, iend - istart, midpoint, true, bits + istart/64);
+		}
 	}
 	else
 	{
-		bool cur = din->m_samples[0] > midpoint;
 		float thresh_rising = midpoint + hys/2;
 		float thresh_falling = midpoint - hys/2;
+		bool initial = samples[0] > midpoint;
+
+		//We don't know the state going into each block yet, so assume low for all but the first
+		vector<size_t> firstDecisive(numblocks);
+		vector<uint8_t> finalState(numblocks);
+
+		#pragma omp parallel for
+		for(size_t i=0; i<numblocks; i++)
+		{
+			size_t istart = i*blocksize;
+			size_t iend = (i == lastblock) ? len : istart + blocksize;
+			finalState[i] = HysteresisBlock(
+				samples + istart,
+				iend - istart,
+				thresh_rising,
+				thresh_falling,
+				(i == 0) && initial,
+				bits + istart/64,
+				firstDecisive[i]);
+		}
+
+		//Once a sample is past either threshold the state no longer depends on what came before it.
+		//So the guess only affects samples before that point, and we can correct them now that we know the real state.
+		bool cur = initial;
+		for(size_t i=0; i<numblocks; i++)
+		{
+			size_t istart = i*blocksize;
+			size_t iend = (i == lastblock) ? len : istart + blocksize;
+
+			if( (i > 0) && cur)
+				SetBitRange(bits, istart, istart + firstDecisive[i]);
+			if(firstDecisive[i] < iend - istart)
+				cur = finalState[i];
+		}
+	}
+
+	//Expand the bits to output samples and find edges
+	vector< vector<int64_t> > rising(numblocks);
+	vector< vector<int64_t> > falling(numblocks);
+	vector< vector<int64_t> > any(numblocks);
+
+	#pragma omp parallel for
+	for(size_t i=0; i<numblocks; i++)
+	{
+		size_t istart = i*blocksize;
+		size_t iend = (i == lastblock) ? len : istart + blocksize;
+
+		UnpackBits(bits + istart/64, iend - istart, cap, istart);
+		if(edges)
+			FindEdgesBlock(cap, bits, istart, iend, rising[i], falling[i], any[i]);
+	}
+
+	if(edges)
+	{
+		SetClockEdges(cap, CLOCK_EDGE_RISING, MergeBlocks(rising));
+		SetClockEdges(cap, CLOCK_EDGE_FALLING, MergeBlocks(falling));
+		SetClockEdges(cap, CLOCK_EDGE_ANY, MergeBlocks(any));
+	}
+}
+
+/**
+	@brief Compares samples against a threshold, producing a packed bit vector
+
+	@param in			Input samples
+	@param count		Number of samples
+	@param threshold	Threshold to compare against
+	@param above		True to set bits for samples greater than the threshold, false for less than
+	@param out			Output bits. Unused bits at the end of the last word are zero.
+ */
+void ThresholdFilter::Compare(const float* in, size_t count, float threshold, bool above, uint64_t* out)
+{
+	if(g_hasAvx2)
+		CompareAVX2(in, count, threshold, above, out);
+	else
+		CompareGeneric(in, count, threshold, above, out);
+}
+
+void ThresholdFilter::CompareGeneric(const float* in, size_t count, float threshold, bool above, uint64_t* out)
+{
+	for(size_t base=0; base<count; base += 64)
+	{
+		size_t n = min((size_t)64, count - base);
+		uint64_t word = 0;
+		for(size_t j=0; j<n; j++)
+		{
+			float f = in[base + j];
+			if(above ? (f > threshold) : (f < threshold))
+				word |= (1ULL << j);
+		}
+		out[base >> 6] = word;
+	}
+}
 
-		for(size_t i=0; i<len; i++)
+/**
+	@brief Optimized AVX2 backend for Compare()
+
+	Builds each 64-bit word from eight compares of eight samples each.
+ */
+__attribute__((target("avx2")))
+void ThresholdFilter::CompareAVX2(const float* in, size_t count, float threshold, bool above, uint64_t* out)
+{
+	size_t end = count - (count % 64);
+	__m256 vthresh = _mm256_set1_ps(threshold);
+
+	for(size_t base=0; base<end; base += 64)
+	{
+		uint64_t word = 0;
+		for(size_t j=0; j<8; j++)
+		{
+			__m256 v = _mm256_loadu_ps(in + base + j*8);
+			__m256 cmp;
+			if(above)
+				cmp = _mm256_cmp_ps(v, vthresh, _CMP_GT_OQ);
+			else
+				cmp = _mm256_cmp_ps(v, vthresh, _CMP_LT_OQ);
+			word |= static_cast<uint64_t>(_mm256_movemask_ps(cmp)) << (j*8);
+		}
+		out[base >> 6] = word;
+	}
+
+	//Get any extras we didn't get in the SIMD loop
+	if(end < count)
+		CompareGeneric(in + end, count - end, threshold, above, out + (end >> 6));
+}
+
+/**
+	@brief Runs the hysteresis state machine over a block of samples
+
+	@param in				Input samples
+	@param count			Number of samples
+	@param rising			Threshold a low signal has to go above to become high
+	@param falling			Threshold a high signal has to go below to become low
+	@param cur				State going into the block
+	@param out				Output bits
+	@param firstDecisive	Index of the first sample past either threshold (count if there are none)
+
+	@return State at the end of the block
+ */
+bool ThresholdFilter::HysteresisBlock(
+	const float* in,
+	size_t count,
+	float rising,
+	float falling,
+	bool cur,
+	uint64_t* out,
+	size_t& firstDecisive)
+{
+	const size_t chunk = 4096;
+	uint64_t above[chunk / 64];
+	uint64_t below[chunk / 64];
+
+	firstDecisive = count;
+	for(size_t base=0; base<count; base += chunk)
+	{
+		size_t n = min(chunk, count - base);
+		size_t nwords = (n + 63) / 64;
+		Compare(in + base, n, rising, true, above);
+		Compare(in + base, n, falling, false, below);
+
+		for(size_t w=0; w<nwords; w++)
 		{
-			float f = din->m_samples[i];
-			if(cur && (f < thresh_falling))
-				cur = false;
-			else if(!cur && (f > thresh_rising))
-				cur = true;
-			cap->m_samples[i] = cur;
+			uint64_t up = above[w];
+			uint64_t down = below[w];
+			if( (firstDecisive == count) && (up | down) )
+				firstDecisive = base + w*64 + __builtin_ctzll(up | down);
+
+			//Jump from one candidate crossing to the next, filling everything in between at once
+			uint64_t word = 0;
+			size_t pos = 0;
+			while(pos < 64)
+			{
+				if(cur)
+				{
+					uint64_t m = down & HighMask(pos);
+					if(!m)
+					{
+						word |= HighMask(pos);
+						break;
+					}
+					size_t j = __builtin_ctzll(m);
+					word |= HighMask(pos) & ~HighMask(j);
+					pos = j + 1;
+					cur = false;
+				}
+				else
+				{
+					uint64_t m = up & HighMask(pos);
+					if(!m)
+						break;
+					size_t j = __builtin_ctzll(m);
+					word |= (1ULL << j);
+					pos = j + 1;
+					cur = true;
+				}
+			}
+			out[(base >> 6) + w] = word;
 		}
 	}
+
+	return cur;
+}
+
+/**
+	@brief Sets bits [istart, iend) of a packed bit vector
+ */
+void ThresholdFilter::SetBitRange(uint64_t* bits, size_t istart, size_t iend)
+{
+	for(size_t i=istart; i<iend; )
+	{
+		size_t w = i >> 6;
+		size_t lo = i & 63;
+		size_t hi = min((size_t)64, lo + (iend - i));
+		bits[w] |= HighMask(lo) & ~HighMask(hi);
+		i += hi - lo;
+	}
+}
+
+/**
+	@brief Finds edges in samples [istart, iend) of the packed output
+
+	Timestamps match Filter::GetClockEdges(): the start of the first sample with the new value.
+ */
+void ThresholdFilter::FindEdgesBlock(
+	DigitalWaveform* cap,
+	const uint64_t* bits,
+	size_t istart,
+	size_t iend,
+	vector<int64_t>& rising,
+	vector<int64_t>& falling,
+	vector<int64_t>& any)
+{
+	for(size_t base=istart; base<iend; base += 64)
+	{
+		size_t w = base >> 6;
+		uint64_t word = bits[w];
+
+		//The very first sample can't be an edge, so pretend the previous value was the same
+		uint64_t prev = (w == 0) ? (word & 1) : (bits[w-1] >> 63);
+		uint64_t changes = word ^ ((word << 1) | prev);
+		changes &= ~HighMask(iend - base);
+
+		while(changes)
+		{
+			size_t j = __builtin_ctzll(changes);
+			changes &= changes - 1;
+
+			size_t i = base + j;
+			int64_t t = cap->m_offsets[i] * cap->m_timescale + cap->m_triggerPhase;
+			any.push_back(t);
+			if( (word >> j) & 1)
+				rising.push_back(t);
+			else
+				falling.push_back(t);
+		}
+	}
+}
+
+/**
+	@brief Concatenates per-block edge lists
+ */
+Filter::EdgeListPtr ThresholdFilter::MergeBlocks(const vector< vector<int64_t> >& blocks)
+{
+	auto edges = make_shared<vector<int64_t> >();
+
+	size_t total = 0;
+	for(auto& b : blocks)
+		total += b.size();
+	edges->reserve(total);
+	for(auto& b : blocks)
+		edges->insert(edges->end(), b.begin(), b.end());
+
+	return edges;
 }
@@ -52,8 +52,44 @@ public:
 	PROTOCOL_DECODER_INITPROC(ThresholdFilter)
 
 protected:
+	static void Compare(const float* in, size_t count, float threshold, bool above, uint64_t* out);
+	static void CompareGeneric(const float* in, size_t count, float threshold, bool above, uint64_t* out);
+	static void CompareAVX2(const float* in, size_t count, float threshold, bool above, uint64_t* out);
+
+	static bool HysteresisBlock(
+		const float* in,
+		size_t count,
+		float rising,
+		float falling,
+		bool cur,
+		uint64_t* out,
+		size_t& firstDecisive);
+
+	static void SetBitRange(uint64_t* bits, size_t istart, size_t iend);
+
+	static void FindEdgesBlock(
+		DigitalWaveform* cap,
+		const uint64_t* bits,
+		size_t istart,
+		size_t iend,
+		std::vector<int64_t>& rising,
+		std::vector<int64_t>& falling,
+		std::vector<int64_t>& any);
+
+	static EdgeListPtr MergeBlocks(const std::vector< std::vector<int64_t> >& blocks);
+
+	/**
+		@brief Returns a mask of bits pos and above
+	 */
+	static uint64_t HighMask(size_t pos)
+	{ return (pos >= 64) ? 0 : (~0ULL << pos); }
+
 	std::string m_threshname;
 	std::string m_hysname;
+	std::string m_edgesname;
+
+	///@brief Thresholded samples, one bit each
+	std::vector<uint64_t> m_bits;
 };
 
 #endif
@@ -107,8 +107,9 @@ void TopMeasurement::Refresh()
 	size_t len = din->m_samples.size();
 
 	//Make a histogram of the waveform
-	float min = GetMinVoltage(din);
-	float max = GetMaxVoltage(din);
+	float min;
+	float max;
+	GetMinMaxVoltage(din, min, max);
 	size_t nbins = 64;
 	vector<size_t> hist = MakeHistogram(din, min, max, nbins);
 
@@ -108,8 +108,9 @@ void UndershootMeasurement::Refresh()
 	size_t len = din->m_samples.size();
 
 	//Figure out the nominal top of the waveform
-	float top = GetTopVoltage(din);
-	float base = GetBaseVoltage(din);
+	float top;
+	float base;
+	GetBaseAndTopVoltage(din, base, top);
 	float midpoint = (top+base)/2;
 
 	//Create the output
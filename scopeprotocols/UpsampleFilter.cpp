@@ -37,29 +37,6 @@
 
 using namespace std;
 
-float sinc(float x, float width);
-float blackman(float x, float width);
-
-float sinc(float x, float width)
-{
-	float xi = x - width/2;
-
-	if(fabs(xi) < 1e-7)
-		return 1.0f;
-	else
-	{
-		float px = M_PI*xi;
-		return sin(px) / px;
-	}
-}
-
-float blackman(float x, float width)
-{
-	if(x > width)
-		return 0;
-	return 0.42 - 0.5*cos(2*M_PI * x / width) + 0.08 * cos(4*M_PI*x/width);
-}
-
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Construction / destruction
 
@@ -141,69 +118,32 @@ void UpsampleFilter::Refresh()
 
 	//Get the input data
 	auto din = GetAnalogInputWaveform(0);
-
-	//Configuration parameters that eventually have to be user specified
-	size_t upsample_factor = m_parameters[m_factorname].GetIntVal();
-	size_t window = 5;
-	size_t kernel = window*upsample_factor;
+	size_t len = din->m_samples.size();
+	size_t upsample_factor = max((int64_t)1, m_parameters[m_factorname].GetIntVal());
 
 	//Create the interpolation filter
-	float frac_kernel = kernel * 1.0f / upsample_factor;
 	vector<float> filter;
-	for(size_t i=0; i<kernel; i++)
+	const size_t radius = 3;
+	PolyphaseResampler::MakeWindowedSincKernel(upsample_factor, radius, filter);
+	m_resampler.SetFilter(upsample_factor, 1, filter, upsample_factor * radius);
+
+	//Samples need to be uniformly spaced for the interpolation filter.
+	//If they're not, linearly interpolate onto a grid at the typical input sample spacing first.
+	const float* samples = (const float*)&din->m_samples[0];
+	int64_t tstart = 0;
+	int64_t tstep = din->m_timescale;
+	if(!din->m_densePacked && (len > 0) )
 	{
-		float frac = i*1.0f / upsample_factor;
-		filter.push_back(sinc(frac, frac_kernel) * blackman(frac, frac_kernel));
+		len = PolyphaseResampler::MakeUniformGrid(din, m_uniformSamples, tstart, tstep);
+		samples = &m_uniformSamples[0];
 	}
 
 	//Create the output and configure it
-	auto cap = new AnalogWaveform;
-
-	//TODO: make this work on not-dense-packed waveforms
-
-	//Fill out the input with samples
-	size_t len = din->m_samples.size();
-	for(size_t i=0; i < len; i++)
-	{
-		for(size_t j=0; j<upsample_factor; j++)
-		{
-			cap->m_offsets.push_back(i * upsample_factor + j);
-			cap->m_durations.push_back(1);
-			cap->m_samples.push_back(0);
-		}
-	}
-
-	//Logically, we upsample by inserting zeroes, then convolve with the sinc filter.
-	//Optimization: don't actually waste time multiplying by zero
-	//TODO: vectorize this instead of multithreading
-	size_t imax = len - window;
-	#pragma omp parallel for
-	for(size_t i=0; i < imax; i++)
-	{
-		size_t offset = i * upsample_factor;
-		for(size_t j=0; j<upsample_factor; j++)
-		{
-			size_t start = 0;
-			size_t sstart = 0;
-			if(j > 0)
-			{
-				sstart = 1;
-				start = upsample_factor - j;
-			}
-
-			float f = 0;
-			for(size_t k = start; k<kernel; k += upsample_factor, sstart ++)
-				f += filter[k] * din->m_samples[i + sstart];
-
-			cap->m_samples[offset + j] = f;
-		}
-	}
-
-	//Copy our time scales from the input, and correct for the upsampling
-	cap->m_timescale = din->m_timescale / upsample_factor;
-	cap->m_startTimestamp = din->m_startTimestamp;
-	cap->m_startFemtoseconds = din->m_startFemtoseconds;
-	cap->m_triggerPhase = din->m_triggerPhase;
+	size_t outlen = len * upsample_factor;
+	auto cap = SetupDenseOutputWaveform(din, 0, outlen);
+	cap->m_timescale = tstep / upsample_factor;
+	cap->m_triggerPhase = din->m_triggerPhase + tstart;
 
-	SetData(cap, 0);
+	//Do the actual interpolation
+	m_resampler.Process(samples, len, (float*)&cap->m_samples[0], outlen);
 }
@@ -35,6 +35,8 @@
 #ifndef UpsampleFilter_h
 #define UpsampleFilter_h
 
+#include "../scopehal/PolyphaseResampler.h"
+
 class UpsampleFilter : public Filter
 {
 public:
@@ -56,6 +58,9 @@ public:
 
 protected:
 	std::string m_factorname;
+
+	PolyphaseResampler m_resampler;
+	std::vector<float, AlignedAllocator<float, 64> > m_uniformSamples;
 };
 
 #endif
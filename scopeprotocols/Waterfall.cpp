@@ -39,10 +39,12 @@ using namespace std;
 WaterfallWaveform::WaterfallWaveform(size_t width, size_t height)
 	: m_width(width)
 	, m_height(height)
+	, m_head(0)
 {
+	//Circular buffer, followed by a mirror copy of it for GetData()
 	size_t npix = width*height;
-	m_outdata = new float[npix];
-	for(size_t i=0; i<npix; i++)
+	m_outdata = new float[2*npix];
+	for(size_t i=0; i<2*npix; i++)
 		m_outdata[i] = 0;
 }
 
@@ -52,6 +54,49 @@ WaterfallWaveform::~WaterfallWaveform()
 	m_outdata = NULL;
 }
 
+/**
+	@brief Drops the oldest row and returns a pointer to the new (newest) row, which replaces it in the circular buffer.
+
+	The contents of the new row are undefined and must be filled by the caller.
+ */
+float* WaterfallWaveform::AdvanceRow()
+{
+	float* row = m_outdata + m_head*m_width;
+	if(m_dirtyRows.size() < m_height)
+		m_dirtyRows.push_back(m_head);
+	m_head = (m_head + 1) % m_height;
+	MarkModified();
+	return row;
+}
+
+/**
+	@brief Copies the waterfall to a linear buffer (width*height floats), oldest row first
+ */
+void WaterfallWaveform::ExportData(float* out)
+{
+	//Two contiguous spans: head to the end of the buffer, then the start of the buffer to the head
+	size_t nfirst = (m_height - m_head) * m_width;
+	memcpy(out, m_outdata + m_head*m_width, nfirst * sizeof(float));
+	memcpy(out + nfirst, m_outdata, m_head * m_width * sizeof(float));
+}
+
+float* WaterfallWaveform::GetData()
+{
+	//Bring the mirror copies of any rows written since the last call up to date
+	size_t npix = m_width*m_height;
+	if(m_dirtyRows.size() >= m_height)
+		memcpy(m_outdata + npix, m_outdata, npix * sizeof(float));
+	else
+	{
+		for(auto y : m_dirtyRows)
+			memcpy(m_outdata + npix + y*m_width, m_outdata + y*m_width, m_width * sizeof(float));
+	}
+	m_dirtyRows.clear();
+
+	//Rows head...height-1 of the buffer are followed by the mirrors of rows 0...head-1
+	return m_outdata + m_head*m_width;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Construction / destruction
 
@@ -141,17 +186,9 @@ void Waterfall::Refresh()
 	if(cap == NULL)
 		cap = new WaterfallWaveform(m_width, m_height);
 	cap->m_timescale = din->m_timescale;
-	float* data = cap->GetData();
-
-	//Move the whole waterfall down by one row
-	for(size_t y=0; y < m_height-1 ; y++)
-	{
-		for(size_t x=0; x<m_width; x++)
-			data[y*m_width + x] = data[(y+1)*m_width + x];
-	}
 
-	//Zero the new row
-	float* prow = data + (m_height-1)*m_width;
+	//Scroll the waterfall by one row (this just recycles the oldest row of the circular buffer), then zero the new row
+	float* prow = cap->AdvanceRow();
 	for(size_t x=0; x<m_width; x++)
 		prow[x] = 0;
 
@@ -45,14 +45,49 @@ public:
 	WaterfallWaveform(const WaterfallWaveform&) =delete;
 	WaterfallWaveform& operator=(const WaterfallWaveform&) =delete;
 
-	float* GetData()
+	/**
+		@brief Gets the waterfall as a linear image, oldest row first.
+
+		Rows are stored in a circular buffer followed by a mirror copy of it, so the image is always the contiguous
+		window starting at the head and no reordering is needed. Only rows written since the last call are mirrored.
+		The returned pointer moves as rows are added, so don't hold on to it across refreshes.
+	 */
+	float* GetData();
+
+	/**
+		@brief Gets the raw circular row buffer. Logical row 0 (the oldest) is physical row GetHead().
+	 */
+	float* GetRawData()
 	{ return m_outdata; }
 
+	///Physical index of the oldest row in the circular buffer
+	size_t GetHead()
+	{ return m_head; }
+
+	///Gets a row by logical index (0 is the oldest, height-1 the newest)
+	float* GetRow(size_t y)
+	{ return m_outdata + ((m_head + y) % m_height) * m_width; }
+
+	float* AdvanceRow();
+	void ExportData(float* out);
+
+	size_t GetWidth()
+	{ return m_width; }
+
+	size_t GetHeight()
+	{ return m_height; }
+
 protected:
 	size_t m_width;
 	size_t m_height;
 
 	float* m_outdata;
+
+	///Physical index of the oldest row
+	size_t m_head;
+
+	///Rows of m_outdata changed since their mirror copies (second half of m_outdata) were last updated
+	std::vector<size_t> m_dirtyRows;
 };
 
 class Waterfall : public Filter
@@ -97,6 +97,7 @@ void ScopeProtocolStaticInit()
 	AddDecoderClass(EthernetRGMIIDecoder);
 	AddDecoderClass(EthernetRMIIDecoder);
 	AddDecoderClass(EthernetAutonegotiationDecoder);
+	AddDecoderClass(ExpressionFilter);
 	AddDecoderClass(EyeBitRateMeasurement);
 	AddDecoderClass(EyePattern);
 	AddDecoderClass(EyeHeightMeasurement);
@@ -184,5 +185,7 @@ void ScopeProtocolStaticInit()
 
 	AddStatisticClass(AverageStatistic);
 	AddStatisticClass(MaximumStatistic);
+	AddStatisticClass(MedianStatistic);
 	AddStatisticClass(MinimumStatistic);
+	AddStatisticClass(StandardDeviationStatistic);
 }
@@ -85,6 +85,7 @@
 #include "Ethernet1000BaseXDecoder.h"
 #include "Ethernet10GBaseRDecoder.h"
 #include "Ethernet64b66bDecoder.h"
+#include "ExpressionFilter.h"
 #include "EyeBitRateMeasurement.h"
 #include "EyePattern.h"
 #include "EyeHeightMeasurement.h"
@@ -172,7 +173,9 @@
 
 #include "AverageStatistic.h"
 #include "MaximumStatistic.h"
+#include "MedianStatistic.h"
 #include "MinimumStatistic.h"
+#include "StandardDeviationStatistic.h"
 
 void ScopeProtocolStaticInit();
 